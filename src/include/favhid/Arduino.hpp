@@ -3,19 +3,27 @@
 
 #pragma once
 
+#include "Latency.hpp"
 #include "protocol.hpp"
 
 #include <Windows.h>
 
 #include <winrt/base.h>
 
+#include <array>
+#include <functional>
 #include <optional>
+#include <span>
+#include <stop_token>
+#include <string>
 
 namespace FAVHID {
 
+class Recorder;
+
 struct Response {
   MessageType type;
-  std::string data;
+  std::string data {};
 
   constexpr bool IsOK() const {
     return type == MessageType::Response_OK;
@@ -64,6 +72,12 @@ class Arduino final {
 
   static std::optional<Arduino> Open();
   static std::optional<Arduino> Open(const OpaqueID& serial);
+  /* Open a specific path, such as a COM port (`\\.\COM3`) or the named pipe
+   * of an `Emulator`.
+   *
+   * Resets will re-open the same path.
+   */
+  static std::optional<Arduino> OpenPath(std::wstring_view path);
 
   /* Push a new HID descriptor to the end of the list.
    *
@@ -77,9 +91,194 @@ class Arduino final {
    */
   Response PushDescriptor(const void* descriptor, size_t descriptorSize);
 
-  /// Send a HID report
+  /* Send a HID report.
+   *
+   * If only part of the report has changed since the last report with the
+   * same ID, only the changed bytes are sent, if that's smaller.
+   */
   Response WriteReport(uint8_t reportID, const void* report, size_t size);
 
+  /* Stop waiting for the device to acknowledge each `WriteReport()`.
+   *
+   * This is useful for streaming data, where a lost report is superseded by
+   * the next one anyway; the send rate is then limited by the USB link
+   * instead of by round trips.
+   *
+   * Every `statusInterval` reports, `WriteReport()` checks the device's
+   * cumulative status. That call waits for a full round trip, so it's as
+   * slow as an acknowledged report; the other calls return `Response_OK`
+   * without waiting. The check returns `Response_HIDWriteFailed` if any
+   * report since the last check was lost, failed, or arrived out of
+   * sequence, or if the device didn't get the latest report. Delta reports
+   * are not used in this mode.
+   *
+   * The device can only buffer `maxInFlightRequests` messages, so the status
+   * is checked at least every `maxInFlightRequests - 1` reports, whatever
+   * `statusInterval` is.
+   *
+   * Pass 0 to go back to acknowledged reports. Returns false if the device
+   * does not support `Capability::UnacknowledgedReport`, or can't buffer
+   * at least 2 messages.
+   */
+  bool SetUnacknowledgedReports(uint16_t statusInterval);
+
+  struct UnacknowledgedReportStats {
+    // Counted by the client
+    uint32_t sentCount {};
+    // Counted by the device
+    uint32_t receivedCount {};
+    uint32_t failedCount {};
+    MessageType lastFailure {MessageType::Response_OK};
+    uint32_t outOfSequenceCount {};
+    // Compares the sequence numbers of the last report sent and the last
+    // report received; if false, the current state was lost
+    bool isLatestReceived {true};
+
+    constexpr uint32_t GetLostCount() const {
+      return sentCount - receivedCount;
+    }
+  };
+
+  /* Fetch the device's cumulative status for unacknowledged reports.
+   *
+   * This waits for the device to process every report sent so far. Counters
+   * are reset when the device is re-opened.
+   */
+  UnacknowledgedReportStats GetUnacknowledgedReportStats();
+
+  /* Measure the latency of each `WriteReport()`.
+   *
+   * The device reports when it received and dispatched each report; the
+   * responses are also used to estimate the offset between the host and
+   * device clocks, so that one-way latencies can be calculated. Delta reports
+   * are not used in this mode, and it has no effect while unacknowledged
+   * reports are enabled.
+   *
+   * Returns false if the device does not support
+   * `Capability::TimestampedReport`.
+   */
+  bool SetTimestampedReports(bool enabled);
+
+  struct ReportLatency {
+    // From `WriteReport()` to the device receiving the report
+    LatencyHistogram toDevice;
+    // From `WriteReport()` to the device handing it to the HID endpoint
+    LatencyHistogram toHID;
+    // From `WriteReport()` to receiving the response
+    LatencyHistogram roundTrip;
+  };
+  const ReportLatency& GetReportLatency() const;
+  void ClearReportLatency();
+
+  /* Record every descriptor and report sent from now on.
+   *
+   * Full reports are recorded, even if deltas are sent. The recorder is not
+   * owned, and must outlive this `Arduino`, or be detached by passing
+   * `nullptr`.
+   */
+  void SetRecorder(Recorder*);
+
+  // Full-speed bulk packets, as used by the Arduino Micro's CDC endpoint
+  static constexpr size_t USB_PACKET_SIZE = 64;
+
+  /* Avoid splitting messages across USB packets.
+   *
+   * Each write to the device is a separate USB transfer, which starts a new
+   * packet. When several messages are sent without waiting for a response,
+   * such as by `WriteReports()` with `SetUnacknowledgedReports()`, they're
+   * coalesced into a single transfer. The firmware only handles a message
+   * once every packet containing it has arrived, so a message that starts
+   * part-way through a packet may spill into the next one, adding a
+   * packet's worth of latency that depends on the previous message.
+   *
+   * When enabled, zero bytes are added before any message that would
+   * otherwise span more packets of its transfer than its size needs.
+   * Returns false if the device does not support
+   * `Capability::PacketPadding`.
+   */
+  bool SetPacketAlignment(bool enabled);
+
+  struct PacketStats {
+    // Writes to the device; each starts a new packet
+    uint32_t transferCount {};
+    uint32_t messageCount {};
+    // Spread over more packets than necessary; always 0 while aligned
+    uint32_t splitMessageCount {};
+    uint64_t messageBytes {};
+    uint64_t paddingBytes {};
+    uint64_t packetCount {};
+
+    // The proportion of packet capacity used by messages
+    constexpr double GetEfficiency() const {
+      if (packetCount == 0) {
+        return 1.0;
+      }
+      return static_cast<double>(messageBytes)
+        / static_cast<double>(packetCount * USB_PACKET_SIZE);
+    }
+  };
+  const PacketStats& GetPacketStats() const;
+  void ClearPacketStats();
+
+  struct DeviceEvent {
+    DeviceEventType type;
+    uint8_t reportID;
+    std::string report;
+  };
+  using DeviceEventCallback = std::function<void(const DeviceEvent&)>;
+
+  /* Receive output and feature reports that the host writes to the device.
+   *
+   * The device sends events whenever they happen, so they're mixed in with
+   * responses; any call that reads a response delivers the events that
+   * arrived before it, and `PollDeviceEvents()` delivers them while nothing
+   * else is being sent. The callback is called on the thread making that
+   * call, and must not call this `Arduino`.
+   *
+   * Pass an empty callback to disable events. Returns false if the device
+   * does not support `Capability::DeviceEvents`.
+   */
+  bool SetDeviceEventCallback(DeviceEventCallback);
+
+  /* Deliver any events that have already arrived, without waiting.
+   *
+   * Returns the number of events delivered. If nothing else is being sent,
+   * call this regularly; the interval between calls is the longest an event
+   * can wait.
+   */
+  size_t PollDeviceEvents();
+
+  struct ReportEntry {
+    uint8_t reportID;
+    const void* report;
+    // Maximum 255 bytes per report
+    size_t size;
+  };
+
+  /* Send several HID reports, with a single response.
+   *
+   * If the device supports `Capability::MultiReport`, they're sent in as few
+   * messages as the device's `maxDataLength` allows, with up to
+   * `maxInFlightRequests` messages sent before waiting for a response;
+   * otherwise, or if `SetUnacknowledgedReports()` or
+   * `SetTimestampedReports()` is enabled, they're sent one at a time, as
+   * `WriteReport()` would. With
+   * `Capability::MultiDeltaReport`, entries are delta-encoded within the
+   * batch when that's smaller, as `WriteReport()` does.
+   *
+   * If any report fails, the response type is `Response_MultiReportFailed`,
+   * and `data[i]` is the `MessageType` status of `entries[i]`.
+   */
+  Response WriteReports(std::span<const ReportEntry> entries);
+
+  /* Optional features and limits negotiated when the device was opened.
+   *
+   * Optional features are used automatically when available; if the firmware
+   * doesn't support `GetCapabilities`, no optional features are used, and
+   * this is `Capabilities {}`.
+   */
+  const Capabilities& GetCapabilities() const;
+
   /* Store a configuration ID in RAM.
    *
    * This can be used for any purpose, but is primarily intended for
@@ -94,19 +293,21 @@ class Arduino final {
    * are retained. This is useful to make the operating system pick up new
    * HID descriptors.
    * 
-   * This may take several seconds; if it returns false, this instance is no
-   * longer valid.
+   * This may take several seconds, and stops waiting for the device to
+   * reconnect if `stopToken` is stopped; if it returns false, this instance
+   * is no longer valid.
    */
-  [[nodiscard]] bool ResetUSB();
+  [[nodiscard]] bool ResetUSB(std::stop_token stopToken = {});
 
   /* Fully reboot the device.
    *
    * This purges all data in RAM, including descriptors and past reports.
    *
-   * This may take several seconds; if it returns false, this instance is no
-   * longer valid.
+   * This may take several seconds, and stops waiting for the device to
+   * reconnect if `stopToken` is stopped; if it returns false, this instance
+   * is no longer valid.
    */
-  [[nodiscard]] bool HardReset();
+  [[nodiscard]] bool HardReset(std::stop_token stopToken = {});
 
   /* Retrieves the serial number from EEPROM.
    *
@@ -128,10 +329,83 @@ class Arduino final {
   using THandle = winrt::file_handle;
 
   THandle mHandle;
+  Capabilities mCapabilities {};
+  // Only set if opened with `OpenPath()`
+  std::wstring mPath;
+  // The last report the device acknowledged for each report ID; used as the
+  // base for delta reports
+  std::array<std::string, 0x100> mLastReports;
+
+  // 0 if reports are acknowledged
+  uint16_t mUnacknowledgedStatusInterval {};
+  uint16_t mUnacknowledgedSinceCheck {};
+  uint8_t mNextSequence {};
+  UnacknowledgedReportStats mUnacknowledgedStats;
+  // Failed + lost, as of the last periodic check
+  uint32_t mUnacknowledgedProblems {};
+
+  Recorder* mRecorder {nullptr};
+
+  bool mTimestampedReports {false};
+  ClockOffsetEstimator mClockOffset;
+  ReportLatency mReportLatency;
+
+  DeviceEventCallback mDeviceEventCallback;
+  // Read by `PollDeviceEvents()` before the rest of the message arrived
+  std::optional<ShortMessageHeader> mPartialMessageHeader;
+
+  bool mPacketAlignment {false};
+  // Messages to send in a single transfer; see `CoalescedWrites`
+  std::string mTransfer;
+  bool mCoalescing {false};
+  PacketStats mPacketStats;
+
+  /* While this exists, `Write()` adds to the current transfer instead of
+   * sending it; it's sent by `FlushWrites()`, or before a response is read.
+   *
+   * If destroyed without flushing, e.g. by an exception, the unsent
+   * messages are discarded.
+   */
+  class CoalescedWrites final {
+   public:
+    explicit CoalescedWrites(Arduino*);
+    ~CoalescedWrites();
+
+    CoalescedWrites(const CoalescedWrites&) = delete;
+    CoalescedWrites& operator=(const CoalescedWrites&) = delete;
+
+   private:
+    Arduino* mArduino;
+  };
 
   Arduino(THandle&&);
+  // Sends immediately, unless a `CoalescedWrites` exists
   void Write(const void* data, size_t size);
+  // Send the current transfer, if any
+  void FlushWrites();
+  // Skips and delivers any device events
   Response ReadResponse();
+  Response ReadMessage();
+  void EnableDeviceEvents(bool enabled);
+  void DispatchDeviceEvent(const Response&);
+  THandle Reopen(const OpaqueID& serial);
+  void NegotiateCapabilities();
+  std::optional<Response>
+  WriteDeltaReport(uint8_t reportID, const void* report, size_t size);
+  // `deltaSize` is 0 if the entry is sent in full
+  size_t GetMultiReportEntrySize(const ReportEntry&, size_t deltaSize) const;
+  // Split so that several batches can be in flight at once
+  void SendMultiReport(
+    std::span<const ReportEntry> entries,
+    std::span<const size_t> deltaSizes);
+  Response FinishMultiReport(std::span<const ReportEntry> entries);
+  size_t GetMaxInFlightRequests() const;
+  // 0 if unacknowledged reports can't be used
+  size_t GetMaxUnacknowledgedReports() const;
+  Response
+  WriteUnacknowledgedReport(uint8_t reportID, const void* report, size_t size);
+  Response
+  WriteTimestampedReport(uint8_t reportID, const void* report, size_t size);
 
   static THandle OpenHandle(const std::optional<OpaqueID>& serial = {});
 };
@@ -0,0 +1,85 @@
+// Copyright 2023 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: ISC
+
+#pragma once
+
+#include "FAVJoyState2Report.hpp"
+
+#include <cinttypes>
+#include <functional>
+#include <span>
+#include <vector>
+
+namespace FAVHID {
+
+/** How a single axis responds to input.
+ *
+ * Inputs are normalized to [-1, 1], and the curve is symmetric around 0:
+ *
+ * 1. Magnitudes below `deadzone` are 0
+ * 2. Magnitudes above `saturation` are 1
+ * 3. Magnitudes in between are rescaled to [0, 1], then passed through
+ *    `response`
+ */
+struct AxisCurve {
+  float deadzone {0.0f};
+  float saturation {1.0f};
+  /* Maps [0, 1] to [0, 1]; linear if empty.
+   *
+   * This is only called when an `AxisProcessor` is created, to fill a
+   * lookup table, so it can be arbitrarily expensive.
+   */
+  std::function<float(float)> response {};
+
+  // `x^exponent`; exponents above 1 are less sensitive near the center
+  static AxisCurve Power(
+    float exponent,
+    float deadzone = 0.0f,
+    float saturation = 1.0f);
+};
+
+/** Applies `AxisCurve`s to many axes at once, producing `int16_t` values.
+ *
+ * Axis `i` of each frame uses `curves[i]`; for example, with 8 devices, pass
+ * 64 curves, and process all 64 axes of a frame in a single call. The
+ * curves are precomputed into lookup tables, and axes are processed several
+ * at a time with SIMD where available.
+ */
+class AxisProcessor final {
+ public:
+  // Linear interpolation is used between entries
+  static constexpr size_t LUT_SEGMENTS = 256;
+
+  AxisProcessor(std::span<const AxisCurve> curves);
+
+  size_t GetAxisCount() const;
+
+  /* Convert `in[i]` in [-1, 1] using `curves[i]`, with saturation.
+   *
+   * Both spans must have `GetAxisCount()` elements.
+   */
+  void Process(std::span<const float> in, std::span<int16_t> out) const;
+
+  /* Convert 8 axes per report, in `FAVJoyState2Report::SetAxes()` order.
+   *
+   * `in` must have `8 * reports.size()` elements, and there must be that
+   * many curves. Only the axes of each report are changed.
+   */
+  void Process(
+    std::span<const float> in,
+    std::span<FAVJoyState2Report> reports) const;
+
+ private:
+  // Structure-of-arrays, so that several axes can be loaded at once
+  std::vector<float> mDeadzones;
+  std::vector<float> mScales;
+  // `LUT_SEGMENTS + 1` entries per axis
+  std::vector<float> mTables;
+  size_t mAxisCount {};
+
+  // Process `count` axes, using the curves starting at `firstAxis`
+  void
+  Process(const float* in, int16_t* out, size_t firstAxis, size_t count) const;
+};
+
+}// namespace FAVHID
@@ -0,0 +1,73 @@
+// Copyright 2023 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: ISC
+
+#pragma once
+
+#include "FAVJoyState2Report.hpp"
+
+#include <atomic>
+#include <cinttypes>
+
+namespace FAVHID {
+
+/** The state of a `FAVJoyState2` device, shared between threads.
+ *
+ * Each control can be updated from any thread without locks; for example,
+ * one thread can update the axes while another sets buttons. Updates only
+ * change the specified control, so threads can't overwrite each other's
+ * controls with stale values.
+ *
+ *   ConcurrentReport state;
+ *   // Thread 1
+ *   state.SetAxis(0, x);
+ *   // Thread 2
+ *   state.SetButton(3, true);
+ *   // Sending thread
+ *   FAVJoyState2Report report;
+ *   if (const auto version = state.Snapshot(&report); version != lastSent) {
+ *     device.WriteReport(report, 0);
+ *     lastSent = version;
+ *   }
+ */
+class ConcurrentReport final {
+ public:
+  ConcurrentReport();
+  ConcurrentReport(const FAVJoyState2Report&);
+
+  ConcurrentReport(const ConcurrentReport&) = delete;
+  ConcurrentReport& operator=(const ConcurrentReport&) = delete;
+
+  // Axis index in `FAVJoyState2Report::SetAxes()` order
+  void SetAxis(uint8_t axisIndex, int16_t value);
+  void SetButton(uint8_t buttonIndex, bool on = true);
+  // Same values as `FAVJoyState2Report::SetPOV()`
+  void SetPOV(uint8_t hatIndex, uint8_t value);
+
+  /* Copy the current state, and return its version.
+   *
+   * The copy is consistent: if it includes an update, it also includes
+   * every update that completed before that one. Writers are never blocked;
+   * instead, the copy is retried if an update completes while copying.
+   *
+   * The version changes whenever the state changes, so it can be used to
+   * skip sending unchanged reports.
+   */
+  uint64_t Snapshot(FAVJoyState2Report*) const;
+
+  uint64_t GetVersion() const;
+
+ private:
+  static constexpr uint8_t AXIS_COUNT = 8;
+  static constexpr uint8_t BUTTON_WORD_COUNT = 128 / 32;
+  static constexpr uint8_t HAT_COUNT = 4;
+
+  std::atomic<int16_t> mAxes[AXIS_COUNT];
+  // Bit N of word W is button (32 * W) + N
+  std::atomic<uint32_t> mButtons[BUTTON_WORD_COUNT];
+  // In `FAVJoyState2Report::SetPOVs()` format
+  std::atomic<uint16_t> mPOVs;
+  // Incremented after every update
+  std::atomic<uint64_t> mVersion;
+};
+
+}// namespace FAVHID
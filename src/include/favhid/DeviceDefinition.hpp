@@ -0,0 +1,78 @@
+// Copyright 2023 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: ISC
+
+#pragma once
+
+#include "FAVJoyState2.hpp"
+
+#include <cinttypes>
+#include <filesystem>
+#include <string_view>
+#include <vector>
+
+namespace FAVHID {
+
+/** Text definitions of `FAVJoyState2` devices.
+ *
+ * Each non-empty line defines the next device; any field that isn't
+ * specified has the `DeviceProfile` default, and `#` starts a comment:
+ *
+ *   # The same as FAVJoyState2::Report
+ *   device
+ *   # A 12-button box with a single hat
+ *   device axes=0 hats=1 buttons=12
+ *   device axes=6 bits=8 extra=velocity
+ *
+ * The fields are `axes`, `bits` (8 or 16), `hats`, `buttons`, and `extra`
+ * (`none`, or a comma-separated list of `velocity`, `acceleration`, and
+ * `force`).
+ *
+ * Throws `std::runtime_error`, including the line number, if the text is
+ * invalid.
+ */
+std::vector<DeviceProfile> ParseDeviceDefinitions(std::string_view text);
+
+// Parse the text, and create the descriptors and config ID
+FAVJoyState2::Configuration CompileDeviceDefinitions(std::string_view text);
+
+/* Like `CompileDeviceDefinitions(text)`, but cached on disk.
+ *
+ * The cache file is named after a hash of the text; if it exists, and its
+ * descriptors match those generated from its profiles, it is used without
+ * parsing the text. Otherwise, the result is written to the cache; failing
+ * to write it is not an error.
+ *
+ * As `configID` depends on the descriptors, not the text, editing the text
+ * without changing the devices does not reconfigure the Arduino.
+ */
+FAVJoyState2::Configuration CompileDeviceDefinitions(
+  std::string_view text,
+  const std::filesystem::path& cacheDirectory);
+
+#pragma pack(push, 1)
+/* Followed by `deviceCount` `CachedDeviceDefinition`s, each followed by
+ * `descriptorSize` bytes of descriptor.
+ */
+struct DeviceDefinitionCacheHeader {
+  static constexpr char MAGIC[8] {'F', 'A', 'V', 'H', 'D', 'E', 'F', '\0'};
+  static constexpr uint32_t CURRENT_VERSION = 3;
+
+  char magic[8] {};
+  uint32_t version {};
+  // Of the text the cache was compiled from
+  uint64_t textHash {};
+  OpaqueID configID {};
+  uint32_t deviceCount {};
+};
+
+struct CachedDeviceDefinition {
+  uint8_t axisCount {};
+  uint8_t axisBits {};
+  uint8_t hatCount {};
+  uint8_t buttonCount {};
+  uint8_t extraAxes {};
+  uint16_t descriptorSize {};
+};
+#pragma pack(pop)
+
+}// namespace FAVHID
@@ -0,0 +1,109 @@
+// Copyright 2023 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: ISC
+
+#pragma once
+
+#include "protocol.hpp"
+
+#include <functional>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace FAVHID {
+
+/** A host-side implementation of the FAVHID firmware protocol.
+ *
+ * This is a reference implementation of the protocol, so that clients and
+ * new protocol features can be tested without an Arduino. Reports are not
+ * forwarded to a real HID device; they're stored so they can be inspected.
+ *
+ * `Process()` is transport-agnostic; `Serve()` makes the emulator available
+ * on a named pipe, which can be opened with `Arduino::OpenPath()`.
+ */
+class Emulator final {
+ public:
+  static constexpr std::wstring_view DEFAULT_PIPE_NAME {
+    L"\\\\.\\pipe\\favhid-emulator"};
+
+  Emulator();
+  Emulator(const OpaqueID& serial);
+
+  /* Handle bytes from the client, returning any bytes to send back.
+   *
+   * Partial messages are buffered until the rest arrives.
+   */
+  std::string Process(std::string_view input);
+
+  /* Returns true if the client asked for the connection to be reset.
+   *
+   * Transports should disconnect the client, and start accepting new
+   * connections; the client must send a new hello.
+   */
+  bool TakeDisconnectRequest();
+
+  /* Change the advertised capabilities.
+   *
+   * Optional messages that aren't advertised are rejected with
+   * `Response_UnhandledRequest`; if empty, `GetCapabilities` is rejected too,
+   * and there are no optional messages, like older firmware.
+   */
+  void SetCapabilities(const std::optional<Capabilities>&);
+
+  /* Act as if the host wrote an output or feature report.
+   *
+   * Like the firmware, this is dropped unless the client has enabled device
+   * events. `Serve()` sends it immediately; other transports receive it in
+   * the output of the next `Process()` call, which can be an empty call.
+   */
+  void SendDeviceEvent(
+    DeviceEventType,
+    uint8_t reportID,
+    std::string_view report);
+
+  // Serve clients on a named pipe until stopped
+  void Serve(std::wstring_view pipeName, std::stop_token);
+
+  OpaqueID GetSerialNumber() const;
+  OpaqueID GetVolatileConfigID() const;
+  std::vector<std::string> GetDescriptors() const;
+  // The last report successfully written with the specified ID, if any
+  std::optional<std::string> GetLastReport(uint8_t reportID) const;
+
+ private:
+  mutable std::mutex mMutex;
+
+  OpaqueID mSerialNumber;
+  OpaqueID mVolatileConfigID;
+  std::vector<std::string> mDescriptors;
+  std::map<uint8_t, std::string> mReports;
+  std::optional<Capabilities> mCapabilities;
+  UnacknowledgedReportStatus mUnacknowledgedStatus;
+
+  std::string mInput;
+  // Encoded `DeviceEvent` messages
+  std::string mPendingEvents;
+  // Called with the lock held when an event is added to `mPendingEvents`,
+  // so that `Serve()` can send it without waiting for the client
+  std::function<void()> mOnPendingEvent;
+  bool mDeviceEventsEnabled {false};
+  bool mHelloReceived {false};
+  bool mDisconnectRequested {false};
+
+  void Disconnect();
+  // Returns the number of bytes consumed, or 0 if more bytes are needed
+  size_t ProcessMessage(std::string_view input, std::string& output);
+  MessageType
+  WriteReport(uint8_t reportID, const char* report, size_t size);
+  // `delta` is the bitmap and changed bytes
+  MessageType
+  WriteDeltaReport(uint8_t reportID, const char* delta, size_t size);
+  bool HasReportID(uint8_t reportID) const;
+  bool HasCapability(Capability::Flags) const;
+};
+
+}// namespace FAVHID
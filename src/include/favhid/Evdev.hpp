@@ -0,0 +1,198 @@
+// Copyright 2023 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: ISC
+
+#pragma once
+
+#include "FAVJoyState2Report.hpp"
+
+#include <array>
+#include <chrono>
+#include <cinttypes>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <span>
+#include <stop_token>
+#include <string>
+#include <vector>
+
+namespace FAVHID {
+
+/* The parts of a Linux `struct input_event` that we use.
+ *
+ * This and `EvdevTranslator` don't depend on Linux headers, so that
+ * translation can be tested on any platform.
+ */
+struct EvdevEvent {
+  uint16_t type {};
+  uint16_t code {};
+  int32_t value {};
+};
+
+// Values from `linux/input-event-codes.h`
+namespace Evdev {
+constexpr uint16_t EventSync = 0x00;
+constexpr uint16_t EventKey = 0x01;
+constexpr uint16_t EventAbsolute = 0x03;
+
+constexpr uint16_t SyncReport = 0;
+constexpr uint16_t SyncDropped = 3;
+
+constexpr uint16_t AbsX = 0x00;
+constexpr uint16_t AbsY = 0x01;
+constexpr uint16_t AbsZ = 0x02;
+constexpr uint16_t AbsRX = 0x03;
+constexpr uint16_t AbsRY = 0x04;
+constexpr uint16_t AbsRZ = 0x05;
+constexpr uint16_t AbsThrottle = 0x06;
+constexpr uint16_t AbsRudder = 0x07;
+// ABS_HAT0X; hat N is (AbsHat0X + 2N, AbsHat0X + 2N + 1)
+constexpr uint16_t AbsHat0X = 0x10;
+constexpr uint16_t AbsCount = 0x40;
+
+constexpr uint16_t ButtonMisc = 0x100;
+constexpr uint16_t ButtonJoystick = 0x120;
+constexpr uint16_t ButtonTriggerHappy = 0x2c0;
+constexpr uint16_t KeyCount = 0x300;
+}// namespace Evdev
+
+/** Translates evdev events into a `FAVJoyState2Report`.
+ *
+ * Changes are collected until the `SYN_REPORT` at the end of each frame,
+ * so a report never contains half of a frame.
+ */
+class EvdevTranslator final {
+ public:
+  struct AxisInfo {
+    // ABS_* code
+    uint16_t code {};
+    int32_t minimum {};
+    int32_t maximum {};
+  };
+
+  // No mappings
+  EvdevTranslator();
+
+  /* The standard mapping:
+   *
+   * - ABS_X to ABS_RZ are x to rz; ABS_THROTTLE and ABS_RUDDER are the
+   *   sliders; other axes are ignored
+   * - ABS_HAT0 to ABS_HAT3 are hats 0 to 3
+   * - BTN_JOYSTICK and BTN_GAMEPAD codes are buttons 0 to 31, then
+   *   BTN_TRIGGER_HAPPY codes are buttons 32 to 71, then BTN_MISC codes are
+   *   buttons 72 to 81
+   *
+   * `axes` should list the axes the device has, with their ranges.
+   */
+  static EvdevTranslator CreateDefault(std::span<const AxisInfo> axes);
+
+  /* Map an ABS_* code to an axis.
+   *
+   * Axes are numbered as for `FAVJoyState2Report::SetAxes()`; `minimum` and
+   * `maximum` are scaled to INT16_MIN and INT16_MAX.
+   */
+  void MapAxis(const AxisInfo&, uint8_t axisIndex);
+  // Map a KEY_* or BTN_* code to a button
+  void MapButton(uint16_t code, uint8_t buttonIndex);
+  // Map an evdev hat (ABS_HATnX and ABS_HATnY) to a report hat
+  void MapHat(uint8_t evdevHat, uint8_t hatIndex);
+
+  /* Process a single event.
+   *
+   * Returns true if it completed a frame that changed the report.
+   *
+   * After `SYN_DROPPED`, everything up to and including the next
+   * `SYN_REPORT` is ignored; `IsResyncNeeded()` is then true until the
+   * caller feeds the device's current state, followed by a `SYN_REPORT`.
+   */
+  bool Process(const EvdevEvent&);
+  // Process events in order, returning true if any frame changed the report
+  bool Process(std::span<const EvdevEvent>);
+
+  bool IsResyncNeeded() const;
+  const FAVJoyState2Report& GetReport() const;
+
+ private:
+  static constexpr uint8_t UNMAPPED = 0xff;
+  struct AxisMapping {
+    uint8_t axisIndex {UNMAPPED};
+    int32_t minimum {};
+    int32_t maximum {};
+  };
+  // Index is the ABS_* code
+  std::array<AxisMapping, Evdev::AbsCount> mAxes;
+  // Index is the evdev hat; value is the report hat
+  std::array<uint8_t, 4> mHats;
+  // Index is the KEY_* or BTN_* code
+  std::array<uint8_t, Evdev::KeyCount> mButtons;
+
+  std::array<int16_t, 8> mAxisValues {};
+  // x, y pairs, from -1 to 1, with -1 being left/up
+  std::array<int8_t, 8> mHatValues {};
+
+  FAVJoyState2Report mPending {};
+  FAVJoyState2Report mReport {};
+  bool mPendingChanged {false};
+  bool mDropping {false};
+  bool mResyncNeeded {false};
+};
+
+#ifdef __linux__
+/** Reads many evdev devices with a single epoll loop.
+ *
+ * Each source produces reports for one `FAVJoyState2` device index.
+ */
+class EvdevSource final {
+ public:
+  EvdevSource();
+  ~EvdevSource();
+
+  EvdevSource(const EvdevSource&) = delete;
+  EvdevSource& operator=(const EvdevSource&) = delete;
+
+  /* Open an event device, such as `/dev/input/event3`.
+   *
+   * The default mapping is used, based on the device's axes. Throws
+   * `std::system_error` on failure.
+   */
+  void AddDevice(const std::filesystem::path&, uint8_t deviceIndex);
+
+  /* Read `struct input_event`s from an open file descriptor, such as a pipe
+   * containing a recorded event stream.
+   *
+   * The file descriptor is not closed by `EvdevSource`. As it's not a device,
+   * state is not resynchronized after `SYN_DROPPED`.
+   */
+  void AddFD(int fd, uint8_t deviceIndex, EvdevTranslator);
+
+  using Callback
+    = std::function<void(uint8_t deviceIndex, const FAVJoyState2Report&)>;
+
+  /* Wait for and process input.
+   *
+   * `callback` is called at most once per source, with the latest complete
+   * frame, even if several frames were read; this lets slow consumers catch
+   * up instead of falling behind.
+   *
+   * Returns false if every source has reached end-of-file.
+   */
+  bool Poll(std::chrono::milliseconds timeout, const Callback& callback);
+
+  // Call `Poll()` until stopped, or every source reaches end-of-file
+  void Run(std::stop_token, const Callback& callback);
+
+ private:
+  struct Source;
+
+  int mEpoll {-1};
+  std::vector<std::unique_ptr<Source>> mSources;
+  size_t mOpenSources {};
+
+  void Add(std::unique_ptr<Source>);
+  // Returns false on end-of-file
+  bool Read(Source&, bool* changed);
+  void Resync(Source&);
+};
+#endif
+
+}// namespace FAVHID
@@ -4,8 +4,14 @@
 #pragma once
 
 #include "Arduino.hpp"
+#include "FAVJoyState2Report.hpp"
+#include "Profile.hpp"
 
-#include <stdexcept>
+#include <functional>
+#include <span>
+#include <stop_token>
+#include <string>
+#include <vector>
 
 #include <dinput.h>
 
@@ -20,7 +26,14 @@ class FAVJoyState2 final {
 
   static constexpr uint8_t MAX_DEVICES = 8;
 
-  static std::string_view GetDescriptor(uint8_t device);
+  // Not limited to MAX_DEVICES; any device index that fits in a report ID
+  // is valid
+  static std::string GetDescriptor(uint8_t device);
+
+  uint8_t GetDeviceCount() const;
+
+  // Whether the device uses `Report`, rather than a custom profile
+  bool IsDefaultProfile(uint8_t deviceIndex) const;
 
   // Open the the first Arduino Micro running compatible firmware, and create
   // the specified number of virtual joysticks
@@ -31,93 +44,132 @@ class FAVJoyState2 final {
     const OpaqueID& serial,
     uint8_t deviceCount = 1);
 
+  /* Open the first compatible Arduino Micro, creating one virtual joystick
+   * per profile.
+   *
+   * Devices using the default `DeviceProfile` use `Report`; for others, use
+   * the `Report` type from the matching `Profile<>`, or
+   * `WriteReport(const DeviceProfile&, ...)`.
+   */
+  static std::optional<FAVJoyState2> Open(
+    std::span<const DeviceProfile> profiles);
+  static std::optional<FAVJoyState2> Open(
+    const OpaqueID& serial,
+    std::span<const DeviceProfile> profiles);
+  /* Use an Arduino that is already open, such as one opened with
+   * `Arduino::OpenPath()`.
+   */
+  static FAVJoyState2 Open(
+    Arduino&&,
+    std::span<const DeviceProfile> profiles);
+
+  /* Everything that is pushed to the Arduino for a set of profiles.
+   *
+   * `configID` is derived from the descriptors, so the Arduino is only
+   * reconfigured if the descriptors change. This is computed by the
+   * `Open()` overloads that take profiles; it can also be computed ahead of
+   * time, or loaded from a cache - see `DeviceDefinition.hpp`.
+   */
+  struct Configuration {
+    std::vector<DeviceProfile> profiles {};
+    // `descriptors[i]` is for `profiles[i]`
+    std::vector<std::string> descriptors {};
+    OpaqueID configID {};
+  };
+  // Throws `std::logic_error` if there are no profiles, or too many
+  static Configuration GetConfiguration(
+    std::span<const DeviceProfile> profiles);
+  // The `configID` that `GetConfiguration()` gives for these descriptors
+  static OpaqueID GetConfigID(
+    std::span<const DeviceProfile> profiles,
+    std::span<const std::string> descriptors);
+
+  static std::optional<FAVJoyState2> Open(const Configuration&);
+  static std::optional<FAVJoyState2> Open(
+    const OpaqueID& serial,
+    const Configuration&);
+  static FAVJoyState2 Open(Arduino&&, const Configuration&);
+
+  // Steps of opening a device; see `PendingFAVJoyState2`
+  enum class OpenPhase : uint8_t {
+    Discovering,
+    // Clearing a different configuration from the Arduino
+    Resetting,
+    PushingDescriptors,
+    // Waiting for the Arduino to reconnect with the new descriptors
+    Reenumerating,
+    Ready,
+  };
+  using OpenProgressCallback = std::function<void(OpenPhase)>;
+
   /* Create and write a HID report based on the provided DIJOYSTATE2.
    *
    * Directly calling `WriteReport(const Report&, uint8_t deviceIndex)` is
-   * more efficient; this function exists just for familiarity.
+   * slightly more efficient; this function exists just for familiarity.
    */
   void WriteReport(const DIJOYSTATE2&, uint8_t deviceIndex = 0);
 
-#pragma pack(push, 1)
+  /* Convert and write a DIJOYSTATE2 for every device.
+   *
+   * `states[i]` is written to device `i`; there must not be more states than
+   * devices.
+   */
+  void WriteReports(std::span<const DIJOYSTATE2> states);
+
   // The raw HID report actually used
-  struct Report final {
-    // Standard axes from INT16_MIN to INT16_MAX
-    int16_t x, y, z, rx, ry, rz;
-    // 2 additional axes from INT16_MIN to INT16_MAX
-    int16_t slider[2];
-    /* 4x 8-way+center POV hats, with 4 bits each.
-     *
-     * - 0b1111: center
-     * - 0b0000-0b0111: degrees from north / 45, i.e.:
-     *   - 0b0000: N
-     *   - 0b0001: NE
-     *   - 0b0010: E
-     *   - 0b0011: SE
-     *   - 0b0100: S
-     *   - 0b0101: SW
-     *   - 0b0110: W
-     *   - 0b0111: NW
-     *
-     * IMPORTANT: these are 4 sequential 4-byte fields - so,
-     * despite the values being little-endian, the fields are
-     * in the opposite order to what you'd expect
-     */
-    uint8_t povs[2] { 0xff, 0xff };
-    // 128 buttons, 1 bit per button
-    uint8_t buttons[128 / 8];
-
-    // The following fields from DIJOYSTATE2 are not currently supported:
-    //
-    // int16_t vx, vy, vz;
-    // int16_t rvx, rvy, rvz;
-    // int16_t vslider[2];
-    // int16_t ax, ay, az;
-    // int16_t arx, ary, arz;
-    // int16_t aslider[2];
-    // int16_t fx, fy, fz;
-    // int16_t frx, fry, frz;
-    // int16_t fslider[2];
-
-    inline void SetButton(uint8_t buttonIndex, bool on = true) {
-      if (buttonIndex >= (sizeof(buttons) * 8)) {
-        throw std::logic_error("button index out of range");
-      }
-
-      const uint8_t bitOffset = buttonIndex % 8;
-      const uint8_t byteOffset = (buttonIndex - bitOffset) / 8;
-
-      auto& byte = this->buttons[byteOffset];
-      if (on) {
-        byte |= (1 << bitOffset);
-      } else {
-        byte &= ~static_cast<uint8_t>(1 << bitOffset);
-      }
-    }
-
-    // See documentation of 'povs' field for information
-    // on values
-    inline void SetPOV(uint8_t hatIndex, uint8_t value) {
-      if (hatIndex >= (sizeof(povs) * 2)) {
-        throw std::logic_error("hat index out of range");
-      }
-
-      const auto bitOffset = 4 - (4 * (hatIndex % 2));
-      const auto byteOffset = 1 - (hatIndex / 2);
-      auto& byte = this->povs[byteOffset];
-
-      byte &= ~(0b1111 << bitOffset);
-      byte |= (value << bitOffset);
-    }
-  };
-#pragma pack(pop)
+  using Report = FAVJoyState2Report;
+
   // Write the specified raw HID report.
   void WriteReport(const Report&, uint8_t deviceIndex);
+  // Write `reports[i]` to device `i`
+  void WriteReports(std::span<const Report> reports);
+
+  // Write a report for a device created with a `Profile<>`
+  template <class TReport>
+    requires requires { TReport::ProfileDescription; }
+  void WriteReport(const TReport& report, uint8_t deviceIndex) {
+    this->WriteReport(
+      TReport::ProfileDescription, report.data(), report.size(), deviceIndex);
+  }
+
+  /* Write a raw report for a device created with the specified profile.
+   *
+   * Throws `std::logic_error` if the device has a different profile, or if
+   * the size does not match.
+   */
+  void WriteReport(
+    const DeviceProfile&,
+    const void* report,
+    size_t size,
+    uint8_t deviceIndex);
+
+  /* Convert a DIJOYSTATE2 to a raw HID report.
+   *
+   * Only the fields supported by `Report` are used.
+   */
+  static Report ToReport(const DIJOYSTATE2&) noexcept;
 
  private:
-  FAVJoyState2(uint8_t deviceCount, Arduino&&);
+  friend class PendingFAVJoyState2;
+
+  FAVJoyState2(const Configuration&, Arduino&&);
+
+  /* Push the configuration, unless the Arduino already has it.
+   *
+   * Returns false if stopped before pushing any descriptors, or while
+   * waiting for the Arduino to reconnect; once pushing starts, the USB reset
+   * is always requested, so that the Arduino isn't left with descriptors
+   * that the OS hasn't seen.
+   */
+  static bool Configure(
+    Arduino&,
+    const Configuration&,
+    const OpenProgressCallback&,
+    std::stop_token);
 
   Arduino mDevice;
   uint8_t mCount {};
+  std::vector<DeviceProfile> mProfiles;
   OpaqueID mConfigID;
 };
 
@@ -0,0 +1,126 @@
+// Copyright 2023 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: ISC
+
+#pragma once
+
+#include <cinttypes>
+#include <cstddef>
+#include <cstring>
+#include <span>
+#include <stdexcept>
+
+namespace FAVHID {
+
+#pragma pack(push, 1)
+/** The raw HID report used by `FAVJoyState2`.
+ *
+ * This is available as `FAVJoyState2::Report`; it's in a separate header
+ * as it doesn't depend on Windows, so can be used by input sources on other
+ * platforms.
+ */
+struct FAVJoyState2Report final {
+  // Standard axes from INT16_MIN to INT16_MAX
+  int16_t x, y, z, rx, ry, rz;
+  // 2 additional axes from INT16_MIN to INT16_MAX
+  int16_t slider[2];
+  /* 4x 8-way+center POV hats, with 4 bits each.
+   *
+   * - 0b1111: center
+   * - 0b0000-0b0111: degrees from north / 45, i.e.:
+   *   - 0b0000: N
+   *   - 0b0001: NE
+   *   - 0b0010: E
+   *   - 0b0011: SE
+   *   - 0b0100: S
+   *   - 0b0101: SW
+   *   - 0b0110: W
+   *   - 0b0111: NW
+   *
+   * IMPORTANT: these are 4 sequential 4-byte fields - so,
+   * despite the values being little-endian, the fields are
+   * in the opposite order to what you'd expect
+   */
+  uint8_t povs[2] { 0xff, 0xff };
+  // 128 buttons, 1 bit per button
+  uint8_t buttons[128 / 8];
+
+  // The following fields from DIJOYSTATE2 are not currently supported:
+  //
+  // int16_t vx, vy, vz;
+  // int16_t rvx, rvy, rvz;
+  // int16_t vslider[2];
+  // int16_t ax, ay, az;
+  // int16_t arx, ary, arz;
+  // int16_t aslider[2];
+  // int16_t fx, fy, fz;
+  // int16_t frx, fry, frz;
+  // int16_t fslider[2];
+
+  inline void SetButton(uint8_t buttonIndex, bool on = true) {
+    if (buttonIndex >= (sizeof(buttons) * 8)) {
+      throw std::logic_error("button index out of range");
+    }
+
+    const uint8_t bitOffset = buttonIndex % 8;
+    const uint8_t byteOffset = (buttonIndex - bitOffset) / 8;
+
+    auto& byte = this->buttons[byteOffset];
+    if (on) {
+      byte |= (1 << bitOffset);
+    } else {
+      byte &= ~static_cast<uint8_t>(1 << bitOffset);
+    }
+  }
+
+  /* The `povs` value for a direction.
+   *
+   * `x` is -1 for west, 1 for east; `y` is -1 for north, 1 for south; both
+   * 0 is center.
+   */
+  static constexpr uint8_t GetPOVValue(int8_t x, int8_t y) noexcept {
+    constexpr uint8_t values[3][3] {
+      {0b0111, 0b0000, 0b0001},
+      {0b0110, 0b1111, 0b0010},
+      {0b0101, 0b0100, 0b0011},
+    };
+    return values[y + 1][x + 1];
+  }
+
+  // See documentation of 'povs' field for information
+  // on values
+  inline void SetPOV(uint8_t hatIndex, uint8_t value) {
+    if (hatIndex >= (sizeof(povs) * 2)) {
+      throw std::logic_error("hat index out of range");
+    }
+
+    const auto bitOffset = 4 - (4 * (hatIndex % 2));
+    const auto byteOffset = 1 - (hatIndex / 2);
+    auto& byte = this->povs[byteOffset];
+
+    byte &= ~(0b1111 << bitOffset);
+    byte |= (value << bitOffset);
+  }
+
+  // Set all 128 buttons; bit N of the mask is button N
+  inline void SetButtons(std::span<const uint8_t, sizeof(buttons)> mask) noexcept {
+    memcpy(this->buttons, mask.data(), sizeof(buttons));
+  }
+
+  // Set all 8 axes, in field order: x, y, z, rx, ry, rz, slider[0], slider[1]
+  inline void SetAxes(std::span<const int16_t, 8> values) noexcept {
+    static_assert(offsetof(FAVJoyState2Report, slider) == 6 * sizeof(int16_t));
+    memcpy(&this->x, values.data(), 8 * sizeof(int16_t));
+  }
+
+  /* Set all 4 hats at once; hat N is in bits (4 * N) to (4 * N) + 3.
+   *
+   * See documentation of 'povs' field for information on values.
+   */
+  inline void SetPOVs(uint16_t packed) noexcept {
+    this->povs[1] = static_cast<uint8_t>(((packed & 0x0f) << 4) | ((packed >> 4) & 0x0f));
+    this->povs[0] = static_cast<uint8_t>((((packed >> 8) & 0x0f) << 4) | (packed >> 12));
+  }
+};
+#pragma pack(pop)
+
+}// namespace FAVHID
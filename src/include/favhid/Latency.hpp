@@ -0,0 +1,85 @@
+// Copyright 2023 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: ISC
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cinttypes>
+#include <optional>
+
+namespace FAVHID {
+
+/** A histogram of latencies, with power-of-two microsecond buckets.
+ *
+ * Bucket 0 is [0, 2us); bucket N is [2^N us, 2^(N+1) us). Negative
+ * latencies, which can happen if clocks are not perfectly aligned, are
+ * counted as 0.
+ */
+class LatencyHistogram final {
+ public:
+  static constexpr size_t BUCKET_COUNT = 32;
+  using Buckets = std::array<uint64_t, BUCKET_COUNT>;
+
+  void Add(std::chrono::microseconds);
+  void Clear();
+
+  uint64_t GetCount() const;
+  std::chrono::microseconds GetMin() const;
+  std::chrono::microseconds GetMax() const;
+  std::chrono::microseconds GetMean() const;
+  /* Upper bound of the bucket containing the specified percentile.
+   *
+   * For example, `GetPercentile(0.99)` for the 99th percentile.
+   */
+  std::chrono::microseconds GetPercentile(double) const;
+  const Buckets& GetBuckets() const;
+
+ private:
+  Buckets mBuckets {};
+  uint64_t mCount {};
+  uint64_t mTotal {};
+  uint32_t mMin {};
+  uint32_t mMax {};
+};
+
+/** Estimates the offset between the host and device clocks.
+ *
+ * Each sample is an NTP-style exchange: the host sends at `hostSent`, the
+ * device receives at `deviceReceived` and replies at `deviceSent`, and the
+ * host receives the reply at `hostReceived`.
+ *
+ * The device uses a free-running 32-bit microsecond counter, so all times
+ * are 32-bit microseconds, and may wrap.
+ *
+ * Of the most recent samples, the one with the smallest round-trip time is
+ * used, as it has the least queueing delay; older samples age out so that
+ * drift between the clocks is tracked.
+ */
+class ClockOffsetEstimator final {
+ public:
+  static constexpr size_t WINDOW_SIZE = 32;
+
+  void AddSample(
+    uint32_t hostSent,
+    uint32_t deviceReceived,
+    uint32_t deviceSent,
+    uint32_t hostReceived);
+  void Clear();
+
+  // `deviceTime - hostTime`, modulo 2^32, if there are any samples
+  std::optional<uint32_t> GetOffset() const;
+  // Convert a device time to host time; requires at least one sample
+  uint32_t ToHostTime(uint32_t deviceTime) const;
+
+ private:
+  struct Sample {
+    uint32_t offset;
+    uint32_t roundTrip;
+  };
+  std::array<Sample, WINDOW_SIZE> mSamples {};
+  size_t mSampleCount {};
+  size_t mNextSample {};
+};
+
+}// namespace FAVHID
@@ -0,0 +1,99 @@
+// Copyright 2023 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: ISC
+
+#pragma once
+
+#include "FAVJoyState2.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <optional>
+#include <thread>
+
+namespace FAVHID {
+
+/** Opens a `FAVJoyState2` on a background thread.
+ *
+ * Opening can take several seconds if the Arduino needs to be reset and
+ * reconfigured; this starts immediately, and lets the caller carry on and
+ * check on progress, or cancel.
+ *
+ *   PendingFAVJoyState2 pending {
+ *     FAVJoyState2::GetConfiguration(profiles),
+ *     [](auto phase) { ShowProgress(phase); }};
+ *   // ... other initialization ...
+ *   auto device = pending.Get();
+ */
+class PendingFAVJoyState2 final {
+ public:
+  using Phase = FAVJoyState2::OpenPhase;
+  using ProgressCallback = FAVJoyState2::OpenProgressCallback;
+  using OpenFunction = std::function<std::optional<Arduino>()>;
+
+  /* `progress` is called on the background thread when each phase starts.
+   *
+   * Phases that aren't needed are skipped; for example, if the Arduino
+   * already has the configuration, `Discovering` is followed by `Ready`.
+   */
+  PendingFAVJoyState2(
+    FAVJoyState2::Configuration,
+    ProgressCallback progress = {});
+  PendingFAVJoyState2(
+    const OpaqueID& serial,
+    FAVJoyState2::Configuration,
+    ProgressCallback progress = {});
+  /* Open the Arduino with a custom function, such as `Arduino::OpenPath()`.
+   *
+   * It is called on the background thread, and may return an empty
+   * optional if the Arduino isn't available.
+   */
+  PendingFAVJoyState2(
+    FAVJoyState2::Configuration,
+    OpenFunction open,
+    ProgressCallback progress = {});
+  // Cancels, and waits for the background thread
+  ~PendingFAVJoyState2();
+
+  PendingFAVJoyState2(const PendingFAVJoyState2&) = delete;
+  PendingFAVJoyState2& operator=(const PendingFAVJoyState2&) = delete;
+
+  // The most recently started phase; `Ready` once the device is open
+  Phase GetPhase() const;
+
+  /* Stop as soon as possible.
+   *
+   * Waits for the Arduino to reconnect during `Resetting` and
+   * `Reenumerating` are interrupted. `Discovering` is not, and once
+   * descriptors are being pushed, the USB reset is still requested, so that
+   * the Arduino isn't left with descriptors that the OS hasn't seen.
+   */
+  void Cancel();
+
+  // Returns true if `Get()` will not wait
+  bool WaitFor(std::chrono::milliseconds timeout) const;
+
+  /* Wait for the device, and take it.
+   *
+   * Returns an empty optional if no Arduino was found, or if cancelled in
+   * time; rethrows any failure. Can only be called once.
+   */
+  std::optional<FAVJoyState2> Get();
+
+ private:
+  FAVJoyState2::Configuration mConfiguration;
+  OpenFunction mOpen;
+  ProgressCallback mProgress;
+
+  std::atomic<Phase> mPhase {Phase::Discovering};
+  std::future<std::optional<FAVJoyState2>> mResult;
+
+  // Last, so that it's stopped before anything it uses is destroyed
+  std::jthread mThread;
+
+  std::optional<FAVJoyState2> Run(std::stop_token);
+  void Enter(Phase);
+};
+
+}// namespace FAVHID
@@ -0,0 +1,207 @@
+// Copyright 2023 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: ISC
+
+#pragma once
+
+#include <cinttypes>
+#include <cstring>
+#include <initializer_list>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+namespace FAVHID {
+
+/* Optional groups of axes, in addition to the standard 8.
+ *
+ * Each group has 6 axes, and they're appended in the order below.
+ */
+enum class ExtraAxes : uint8_t {
+  None = 0,
+  // vx, vy, vz, rvx, rvy, rvz, using the HID Vx/Vy/Vz/Vbrx/Vbry/Vbrz usages
+  Velocity = 1 << 0,
+  /* ax, ay, az, arx, ary, arz
+   *
+   * HID has no acceleration usages; these use the X..Rz usages with
+   * acceleration units, which DirectInput maps to `DIJOYSTATE2::lAX` etc.
+   */
+  Acceleration = 1 << 1,
+  // fx, fy, fz, frx, fry, frz; as `Acceleration`, but with force and
+  // torque units, for `DIJOYSTATE2::lFX` etc
+  Force = 1 << 2,
+};
+
+constexpr ExtraAxes operator|(ExtraAxes a, ExtraAxes b) {
+  return static_cast<ExtraAxes>(
+    static_cast<uint8_t>(a) | static_cast<uint8_t>(b));
+}
+
+constexpr ExtraAxes operator&(ExtraAxes a, ExtraAxes b) {
+  return static_cast<ExtraAxes>(
+    static_cast<uint8_t>(a) & static_cast<uint8_t>(b));
+}
+
+/** The shape of a `FAVJoyState2` virtual joystick.
+ *
+ * The report is laid out as:
+ *
+ * 1. `axisCount` standard axes (in order: x, y, z, rx, ry, rz, slider,
+ *    slider), followed by any `extraAxes`; each axis is `axisBits` wide
+ * 2. `hatCount` 4-bit hats, padded to a whole byte
+ * 3. `buttonCount` 1-bit buttons, padded to a whole byte
+ *
+ * The default values match `FAVJoyState2::Report`; smaller profiles give
+ * smaller reports, so less time is spent on the serial link.
+ *
+ * See `Profile<>` for a compile-time version with a matching report type.
+ */
+struct DeviceProfile {
+  static constexpr uint8_t MAX_STANDARD_AXES = 8;
+  // Per `ExtraAxes` group
+  static constexpr uint8_t EXTRA_AXES_PER_GROUP = 6;
+
+  uint8_t axisCount {MAX_STANDARD_AXES};
+  // 8 or 16
+  uint8_t axisBits {16};
+  uint8_t hatCount {4};
+  uint8_t buttonCount {128};
+  ExtraAxes extraAxes {ExtraAxes::None};
+
+  constexpr bool operator==(const DeviceProfile&) const = default;
+
+  constexpr bool HasExtraAxes(ExtraAxes group) const {
+    return (extraAxes & group) != ExtraAxes::None;
+  }
+
+  constexpr uint8_t GetTotalAxisCount() const {
+    uint8_t ret = axisCount;
+    for (const auto group:
+         {ExtraAxes::Velocity, ExtraAxes::Acceleration, ExtraAxes::Force}) {
+      if (HasExtraAxes(group)) {
+        ret += EXTRA_AXES_PER_GROUP;
+      }
+    }
+    return ret;
+  }
+
+  constexpr size_t GetHatsOffset() const {
+    return GetTotalAxisCount() * (axisBits / 8);
+  }
+
+  constexpr size_t GetButtonsOffset() const {
+    return GetHatsOffset() + ((hatCount + 1) / 2);
+  }
+
+  constexpr size_t GetReportSize() const {
+    return GetButtonsOffset() + ((buttonCount + 7) / 8);
+  }
+
+  constexpr bool IsValid() const {
+    constexpr auto allExtraAxes
+      = ExtraAxes::Velocity | ExtraAxes::Acceleration | ExtraAxes::Force;
+    return axisCount <= MAX_STANDARD_AXES
+      && (extraAxes & allExtraAxes) == extraAxes
+      && (axisBits == 8 || axisBits == 16) && GetReportSize() > 0;
+  }
+
+  // Throws `std::logic_error` if invalid
+  std::string GetDescriptor(uint8_t reportID) const;
+};
+
+/** A compile-time `DeviceProfile`, with a matching report type.
+ *
+ * For example, a 12-button box with a single hat and no axes:
+ *
+ *   using ButtonBox = Profile<0, 8, 1, 12>;
+ *   ButtonBox::Report report;
+ *   report.SetButton(3);
+ *
+ * ... sends a 3-byte report instead of `FAVJoyState2::Report`'s 33 bytes.
+ */
+template <
+  uint8_t TAxisCount,
+  uint8_t TAxisBits,
+  uint8_t THatCount,
+  uint8_t TButtonCount,
+  ExtraAxes TExtraAxes = ExtraAxes::None>
+struct Profile final {
+  static constexpr DeviceProfile Description {
+    .axisCount = TAxisCount,
+    .axisBits = TAxisBits,
+    .hatCount = THatCount,
+    .buttonCount = TButtonCount,
+    .extraAxes = TExtraAxes,
+  };
+  static_assert(Description.IsValid());
+
+  class Report final {
+   public:
+    static constexpr DeviceProfile ProfileDescription = Description;
+    using Axis = std::conditional_t<TAxisBits == 8, int8_t, int16_t>;
+
+    constexpr Report() {
+      // Center all the hats
+      const auto begin = ProfileDescription.GetHatsOffset();
+      const auto end = ProfileDescription.GetButtonsOffset();
+      for (size_t i = begin; i < end; ++i) {
+        mBytes[i] = 0xff;
+      }
+    }
+
+    constexpr const uint8_t* data() const {
+      return mBytes;
+    }
+
+    constexpr size_t size() const {
+      return sizeof(mBytes);
+    }
+
+    // Standard axes first, then any extra axes, in `DeviceProfile` order
+    inline void SetAxis(uint8_t axisIndex, Axis value) {
+      if (axisIndex >= ProfileDescription.GetTotalAxisCount()) {
+        throw std::logic_error("axis index out of range");
+      }
+      memcpy(mBytes + (axisIndex * sizeof(Axis)), &value, sizeof(Axis));
+    }
+
+    /* Set a hat; see `FAVJoyState2::Report::povs` for values.
+     *
+     * As with `FAVJoyState2::Report`, DirectInput numbers the hats in the
+     * opposite order to the HID fields, so hat 0 is the last field.
+     */
+    inline void SetPOV(uint8_t hatIndex, uint8_t value) {
+      if (hatIndex >= THatCount) {
+        throw std::logic_error("hat index out of range");
+      }
+
+      const auto field = (THatCount - 1) - hatIndex;
+      const auto bitOffset = 4 * (field % 2);
+      const auto byteOffset = ProfileDescription.GetHatsOffset() + (field / 2);
+      auto& byte = mBytes[byteOffset];
+
+      byte &= ~(0b1111 << bitOffset);
+      byte |= ((value & 0b1111) << bitOffset);
+    }
+
+    inline void SetButton(uint8_t buttonIndex, bool on = true) {
+      if (buttonIndex >= TButtonCount) {
+        throw std::logic_error("button index out of range");
+      }
+
+      const uint8_t bitOffset = buttonIndex % 8;
+      const auto byteOffset
+        = ProfileDescription.GetButtonsOffset() + (buttonIndex / 8);
+      auto& byte = mBytes[byteOffset];
+      if (on) {
+        byte |= (1 << bitOffset);
+      } else {
+        byte &= ~static_cast<uint8_t>(1 << bitOffset);
+      }
+    }
+
+   private:
+    uint8_t mBytes[ProfileDescription.GetReportSize()] {};
+  };
+};
+
+}// namespace FAVHID
@@ -0,0 +1,129 @@
+// Copyright 2023 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: ISC
+
+#pragma once
+
+#include "protocol.hpp"
+
+#include <Windows.h>
+
+#include <winrt/base.h>
+
+#include <chrono>
+#include <functional>
+#include <span>
+#include <stop_token>
+#include <string>
+#include <string_view>
+
+namespace FAVHID {
+
+class Arduino;
+
+#pragma pack(push, 1)
+struct RecordingFileHeader {
+  static constexpr char MAGIC[8] {'F', 'A', 'V', 'H', 'R', 'E', 'C', '\0'};
+  static constexpr uint32_t CURRENT_VERSION = 1;
+
+  char magic[8] {};
+  uint32_t version {};
+};
+
+// Followed by `size` bytes of data
+struct RecordedFrameHeader {
+  // Since the `Recorder` was created
+  uint64_t timestampUS {};
+  // `PushDescriptor` or `Report`
+  MessageType type {};
+  // Only meaningful for `Report`
+  uint8_t reportID {};
+  uint16_t size {};
+};
+#pragma pack(pop)
+
+/** Records descriptors and reports sent by an `Arduino` to a file.
+ *
+ * Attach with `Arduino::SetRecorder()`. Frames are buffered in memory, and
+ * only written to disk when the buffer is full, on `Flush()`, or on
+ * destruction; recording a frame does not make any system calls.
+ *
+ * If the file already exists, it is replaced; frame timestamps start from
+ * zero for each `Recorder`, so recordings can't be appended to.
+ */
+class Recorder final {
+ public:
+  static constexpr size_t DEFAULT_BUFFER_SIZE = 64 * 1024;
+
+  Recorder(std::wstring_view path, size_t bufferSize = DEFAULT_BUFFER_SIZE);
+  ~Recorder();
+
+  Recorder(const Recorder&) = delete;
+  Recorder& operator=(const Recorder&) = delete;
+
+  void RecordDescriptor(const void* descriptor, size_t size);
+  void RecordReport(uint8_t reportID, const void* report, size_t size);
+
+  void Flush();
+
+ private:
+  winrt::file_handle mFile;
+  std::string mBuffer;
+  size_t mBufferSize;
+  std::chrono::steady_clock::time_point mStartTime;
+
+  void Append(
+    MessageType type,
+    uint8_t reportID,
+    const void* data,
+    size_t size);
+};
+
+/** Re-sends a recording made by `Recorder`.
+ *
+ * The file is memory-mapped rather than read into memory.
+ */
+class Replayer final {
+ public:
+  // Throws `std::runtime_error` if the file is not a valid recording
+  Replayer(std::wstring_view path);
+  ~Replayer();
+
+  Replayer(const Replayer&) = delete;
+  Replayer& operator=(const Replayer&) = delete;
+
+  struct Frame {
+    std::chrono::microseconds timestamp;
+    MessageType type;
+    uint8_t reportID;
+    std::span<const uint8_t> data;
+  };
+
+  /* Call `callback` for every complete frame, in order.
+   *
+   * A truncated final frame (e.g. if the recorder crashed) is ignored.
+   */
+  void ForEachFrame(const std::function<void(const Frame&)>& callback) const;
+
+  enum class Timing {
+    // Wait so that frames are sent with the same spacing they were recorded
+    // with
+    Original,
+    AsFastAsPossible,
+  };
+
+  struct Result {
+    size_t frameCount {};
+    // Frames that did not get a `Response_OK`
+    size_t failureCount {};
+  };
+
+  Result Replay(Arduino&, Timing, std::stop_token = {}) const;
+
+ private:
+  winrt::file_handle mFile;
+  winrt::handle mMapping;
+  const uint8_t* mView {nullptr};
+  size_t mSize {};
+};
+
+}// namespace FAVHID
@@ -0,0 +1,108 @@
+// Copyright 2023 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: ISC
+
+#pragma once
+
+#include "FAVJoyState2Report.hpp"
+
+#include <array>
+#include <chrono>
+#include <cinttypes>
+#include <mutex>
+#include <span>
+#include <vector>
+
+namespace FAVHID {
+
+/** Smooths axes from producers that update slower than the HID poll rate.
+ *
+ * Producers `Submit()` reports whenever they have new data, such as game
+ * telemetry at 30-60Hz; the sending thread calls `Sample()` at the output
+ * rate, and writes the result with `FAVJoyState2::WriteReport()`, so the
+ * axes move smoothly instead of in steps.
+ *
+ * Only the 8 axes are smoothed; buttons and hats are always copied from the
+ * latest submitted report.
+ *
+ * `Submit()` and `Sample()` can be called from different threads.
+ */
+class ReportInterpolator final {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  static constexpr std::chrono::microseconds DEFAULT_MAX_INTERVAL {250'000};
+  static constexpr std::chrono::microseconds DEFAULT_MAX_EXTRAPOLATION {
+    50'000};
+
+  enum class Mode {
+    /* Move from the current output to each new report, taking as long as
+     * the producer took between the last two reports.
+     *
+     * The output never overshoots, but trails the producer by up to one
+     * report.
+     */
+    Interpolate,
+    /* Continue the movement between the last two reports, for up to
+     * `maxExtrapolation` after the latest one, then return to the latest
+     * report over the same time.
+     *
+     * This adds no delay, but overshoots when the input changes direction or
+     * stops.
+     */
+    Extrapolate,
+  };
+
+  /* Reports more than `maxInterval` apart are treated as a jump, and the
+   * new axes are used immediately, so that a producer that pauses doesn't
+   * lead to a slow ramp.
+   */
+  ReportInterpolator(
+    uint8_t deviceCount,
+    Mode,
+    std::chrono::microseconds maxInterval = DEFAULT_MAX_INTERVAL,
+    std::chrono::microseconds maxExtrapolation = DEFAULT_MAX_EXTRAPOLATION);
+
+  size_t GetDeviceCount() const;
+
+  void Submit(
+    const FAVJoyState2Report&,
+    uint8_t deviceIndex,
+    Clock::time_point now = Clock::now());
+
+  // The report to send for the device at `now`
+  FAVJoyState2Report Sample(
+    uint8_t deviceIndex,
+    Clock::time_point now = Clock::now()) const;
+  // Sample device `i` into `reports[i]`
+  void Sample(
+    std::span<FAVJoyState2Report> reports,
+    Clock::time_point now = Clock::now()) const;
+
+ private:
+  static constexpr size_t AXIS_COUNT = 8;
+  using Axes = std::array<int16_t, AXIS_COUNT>;
+
+  // The axes move in a straight line from `from` to `to`
+  struct Device {
+    FAVJoyState2Report latest {};
+    Clock::time_point latestAt {};
+    bool hasLatest {false};
+
+    Axes from {};
+    Axes to {};
+    Clock::time_point fromTime {};
+    Clock::time_point toTime {};
+  };
+
+  Mode mMode;
+  std::chrono::microseconds mMaxInterval;
+  std::chrono::microseconds mMaxExtrapolation;
+  mutable std::mutex mMutex;
+  std::vector<Device> mDevices;
+
+  // Callers must hold `mMutex`
+  Axes GetAxes(const Device&, Clock::time_point now) const;
+  FAVJoyState2Report GetReport(const Device&, Clock::time_point now) const;
+};
+
+}// namespace FAVHID
@@ -0,0 +1,93 @@
+// Copyright 2023 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: ISC
+
+#pragma once
+
+#include "FAVJoyState2Report.hpp"
+
+#include <array>
+#include <chrono>
+#include <cinttypes>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+namespace FAVHID {
+
+/** Chooses which device's report to send next when the link is saturated.
+ *
+ * Producers `Submit()` reports as often as they like; only the latest
+ * report for each device is kept. The sending thread calls `Next()` each
+ * time it can send, and writes the result with
+ * `FAVJoyState2::WriteReport()`.
+ *
+ * `Submit()` and `Next()` are thread-safe, so producers and the sending
+ * thread can be different threads; neither holds the lock for longer
+ * than it takes to compare and copy a few reports.
+ *
+ * Reports that change buttons or hats are sent before reports that only
+ * change axes, so that presses aren't delayed by continuously moving axes.
+ *
+ * Button presses are never lost to coalescing: a button that is pressed in
+ * any submitted report is pressed in the next report sent for that device,
+ * even if it was released again before it was sent. Once sent, a press is
+ * held for at least the minimum pulse width, so that the host sees it.
+ */
+class ReportScheduler final {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  enum class Lane {
+    // Buttons or hats changed
+    Edge,
+    // Only axes changed
+    Axis,
+  };
+
+  struct Pending {
+    uint8_t deviceIndex;
+    Lane lane;
+    FAVJoyState2Report report;
+  };
+
+  /* A minimum pulse width of a few times the HID polling interval is
+   * recommended, so that a press isn't missed by a slow host poll.
+   */
+  ReportScheduler(
+    uint8_t deviceCount,
+    std::chrono::microseconds minimumPulseWidth = {});
+
+  // Replace the pending report for the device
+  void Submit(const FAVJoyState2Report&, uint8_t deviceIndex);
+
+  /* The next report to send, if any report differs from what was sent.
+   *
+   * The result is treated as sent. Devices in the same lane take turns.
+   * Held presses are released by a later call, once their minimum pulse
+   * width has passed.
+   */
+  std::optional<Pending> Next(Clock::time_point now = Clock::now());
+
+ private:
+  static constexpr size_t BUTTON_COUNT = 128;
+
+  struct Device {
+    FAVJoyState2Report submitted {};
+    FAVJoyState2Report sent {};
+    // Buttons pressed in any report submitted since the last send
+    uint8_t latched[BUTTON_COUNT / 8] {};
+    std::array<Clock::time_point, BUTTON_COUNT> pressSentAt {};
+  };
+
+  std::chrono::microseconds mMinimumPulseWidth;
+
+  std::mutex mMutex;
+  std::vector<Device> mDevices;
+  // Round-robin position for each lane
+  size_t mNextDevice[2] {};
+
+  FAVJoyState2Report GetReportToSend(const Device&, Clock::time_point now)
+    const;
+};
+
+}// namespace FAVHID
@@ -0,0 +1,134 @@
+// Copyright 2023 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: ISC
+
+#pragma once
+
+#include "FAVJoyState2Report.hpp"
+
+#include <cinttypes>
+#include <initializer_list>
+#include <span>
+#include <vector>
+
+namespace FAVHID {
+
+// The state of every physical input, for a single frame
+struct RoutingInput {
+  std::span<const int16_t> axes;
+  // One byte per button; non-zero is pressed
+  std::span<const uint8_t> buttons;
+  // Same values as `FAVJoyState2Report::povs`
+  std::span<const uint8_t> hats;
+};
+
+/** A compiled set of mappings from physical inputs to virtual devices.
+ *
+ * Create with `RoutingBuilder`. Mappings are compiled to a flat array of
+ * instructions, ordered by where they write, so evaluation is a single
+ * linear pass with no lookups or virtual calls.
+ */
+class RoutingTable final {
+ public:
+  // Number of reports needed by `Evaluate()`
+  size_t GetDeviceCount() const;
+
+  /* Write the reports for the specified input state.
+   *
+   * Every report is reset first: axes are 0, hats are centered, and
+   * buttons are released. Throws `std::logic_error` if `reports` or any
+   * span in `input` is too small for the mappings.
+   */
+  void Evaluate(
+    const RoutingInput& input,
+    std::span<FAVJoyState2Report> reports) const;
+
+ private:
+  friend class RoutingBuilder;
+
+  enum class Opcode : uint8_t {
+    CopyAxis,
+    InvertAxis,
+    PositiveHalfAxis,
+    NegativeHalfAxis,
+    OrButton,
+    CopyHat,
+    HatFromButtons,
+  };
+
+  struct Instruction {
+    Opcode op {};
+    // Button bit mask, or the bit offset of a hat within its byte
+    uint8_t bits {};
+    // Byte offset of the output in the array of reports
+    uint16_t offset {};
+    // Input indices; only `HatFromButtons` uses more than one
+    uint32_t sources[4] {};
+  };
+
+  std::vector<Instruction> mInstructions;
+  size_t mDeviceCount {};
+  size_t mMinAxes {};
+  size_t mMinButtons {};
+  size_t mMinHats {};
+};
+
+/** Declarative mappings for a `RoutingTable`.
+ *
+ * Any number of inputs can be mapped to the same output; buttons are
+ * combined with OR, and for axes and hats, the last mapping wins.
+ *
+ *   const auto table = RoutingBuilder {}
+ *     .Axis(0, {.device = 0, .index = 0})
+ *     .Button(3, {.device = 1, .index = 0})
+ *     .Button(4, {.device = 1, .index = 0})
+ *     .HatFromButtons({5, 6, 7, 8}, {.device = 0, .index = 0})
+ *     .Compile();
+ */
+class RoutingBuilder final {
+ public:
+  struct Output {
+    uint8_t device {};
+    // Axis index in `FAVJoyState2Report::SetAxes()` order, button, or hat
+    uint8_t index {};
+  };
+
+  enum class AxisHalf {
+    Positive,
+    Negative,
+  };
+
+  struct HatButtons {
+    uint32_t up;
+    uint32_t right;
+    uint32_t down;
+    uint32_t left;
+  };
+
+  RoutingBuilder& Axis(uint32_t inputAxis, Output, bool invert = false);
+  /* Map half of an input axis to the full range of an output axis.
+   *
+   * For example, a single trigger axis can become separate brake and
+   * throttle axes.
+   */
+  RoutingBuilder& Axis(uint32_t inputAxis, AxisHalf, Output);
+  RoutingBuilder& Button(uint32_t inputButton, Output);
+  RoutingBuilder& Hat(uint32_t inputHat, Output);
+  // Combine 4 buttons into an 8-way hat
+  RoutingBuilder& HatFromButtons(const HatButtons&, Output);
+
+  RoutingTable Compile() const;
+
+ private:
+  std::vector<RoutingTable::Instruction> mInstructions;
+  size_t mDeviceCount {};
+  size_t mMinAxes {};
+  size_t mMinButtons {};
+  size_t mMinHats {};
+
+  void Add(
+    RoutingTable::Opcode,
+    Output,
+    std::initializer_list<uint32_t> sources);
+};
+
+}// namespace FAVHID
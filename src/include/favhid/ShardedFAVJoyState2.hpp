@@ -0,0 +1,67 @@
+// Copyright 2023 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: ISC
+
+#pragma once
+
+#include "FAVJoyState2.hpp"
+
+#include <memory>
+#include <optional>
+#include <span>
+#include <vector>
+
+namespace FAVHID {
+
+/** Virtual joysticks spread across several Arduinos.
+ *
+ * Device indices are global: with 8 devices per board, devices 0-7 are on
+ * the first board, 8-15 on the second, and so on.
+ *
+ * Each board is configured on its own thread when opening, and
+ * `WriteReports()` writes to every board concurrently, so throughput
+ * scales with the number of boards.
+ */
+class ShardedFAVJoyState2 final {
+ public:
+  using Report = FAVJoyState2::Report;
+
+  /* Open the Arduinos with the specified serial numbers, in parallel.
+   *
+   * Returns an empty optional if any of them could not be opened.
+   */
+  static std::optional<ShardedFAVJoyState2> Open(
+    std::span<const OpaqueID> serials,
+    uint8_t devicesPerBoard = FAVJoyState2::MAX_DEVICES);
+
+  // Use boards that are already open; they may have different device counts
+  ShardedFAVJoyState2(std::vector<FAVJoyState2>&& boards);
+  ~ShardedFAVJoyState2();
+
+  ShardedFAVJoyState2(ShardedFAVJoyState2&&) noexcept;
+  ShardedFAVJoyState2& operator=(ShardedFAVJoyState2&&) noexcept;
+
+  size_t GetDeviceCount() const;
+
+  struct Location {
+    size_t board {};
+    uint8_t deviceIndex {};
+  };
+  Location GetLocation(size_t deviceIndex) const;
+
+  // Write a single report, on the calling thread
+  void WriteReport(const Report&, size_t deviceIndex);
+
+  /* Write `reports[i]` to device `i`, writing to all boards concurrently.
+   *
+   * Returns once every board has finished. If any board fails, the first
+   * exception is rethrown.
+   */
+  void WriteReports(std::span<const Report> reports);
+
+ private:
+  struct Shared;
+  std::unique_ptr<Shared> mShared;
+  std::vector<Location> mLocations;
+};
+
+}// namespace FAVHID
@@ -0,0 +1,176 @@
+// Copyright 2023 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: ISC
+
+#pragma once
+
+#include "FAVJoyState2.hpp"
+
+#include <Windows.h>
+
+#include <winrt/base.h>
+
+#include <atomic>
+#include <chrono>
+#include <optional>
+#include <span>
+#include <stop_token>
+#include <string_view>
+#include <vector>
+
+namespace FAVHID {
+
+/** A single report in shared memory, protected by a sequence lock.
+ *
+ * The sequence is odd while a write is in progress; readers copy the report,
+ * and retry if the sequence changed while they were copying. Neither reads
+ * nor writes make system calls, and readers never block writers.
+ *
+ * Concurrent writers to the same slot are serialized by spinning; in
+ * practice, each slot should have a single writer.
+ *
+ * A new slot contains a default `FAVJoyState2Report`, at sequence 0.
+ */
+class alignas(64) SharedReportSlot final {
+ public:
+  static constexpr size_t DEFAULT_READ_ATTEMPTS = 100;
+
+  SharedReportSlot();
+
+  void Write(const FAVJoyState2Report&);
+  /* Returns the sequence number of the copied report; this is always even.
+   *
+   * Returns `std::nullopt` without modifying the report if a write was in
+   * progress for `maxAttempts` attempts.
+   */
+  std::optional<uint32_t> Read(
+    FAVJoyState2Report*,
+    size_t maxAttempts = DEFAULT_READ_ATTEMPTS) const;
+
+  uint32_t GetSequence() const;
+
+  /* Recover from a writer that exited part-way through a write.
+   *
+   * If the sequence is still the odd `abandonedSequence`, the slot is
+   * overwritten with `report` and the sequence becomes even again;
+   * otherwise, returns false. The writer must really be gone: if it
+   * resumes, the slot may contain a mix of both reports.
+   */
+  bool Reclaim(uint32_t abandonedSequence, const FAVJoyState2Report& report);
+
+ private:
+  static constexpr size_t WORD_COUNT
+    = (sizeof(FAVJoyState2Report) + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+  static_assert(std::atomic<uint32_t>::is_always_lock_free);
+
+  std::atomic<uint32_t> mSequence;
+  // Individually atomic so that racing reads are defined; the sequence
+  // makes the whole report consistent
+  std::atomic<uint32_t> mWords[WORD_COUNT];
+
+  // Lets tests leave a write unfinished, as if the writer had exited
+  friend struct SharedReportSlotTestHook;
+
+  // Wait for other writers, then make the sequence odd; returns the new
+  // sequence
+  uint32_t Claim();
+  void StoreWords(const FAVJoyState2Report&);
+};
+
+// Followed by `slotCount` `SharedReportSlot`s
+struct alignas(64) SharedReportsHeader {
+  static constexpr char MAGIC[8] {'F', 'A', 'V', 'H', 'S', 'H', 'M', '\0'};
+  static constexpr uint32_t CURRENT_VERSION = 1;
+
+  char magic[8] {};
+  uint32_t version {};
+  uint32_t slotCount {};
+};
+
+/** Owns a `FAVJoyState2`, and sends reports written by other processes.
+ *
+ * Creates a named shared memory region with one `SharedReportSlot` per
+ * device; other processes write to the slots with `SharedReportClient`.
+ * `Run()` sends changed slots as fast as the device accepts them; if a
+ * slot changes several times while a previous send is in progress, only
+ * the latest report is sent.
+ *
+ * If a client exits part-way through a write, the slot is skipped until
+ * `ABANDONED_WRITE_TIMEOUT` has passed, then reset to the last report that
+ * was sent.
+ */
+class SharedReportServer final {
+ public:
+  static constexpr std::wstring_view DEFAULT_NAME {
+    L"Local\\FAVHID-SharedReports"};
+  static constexpr std::chrono::microseconds DEFAULT_IDLE_INTERVAL {500};
+  static constexpr std::chrono::milliseconds ABANDONED_WRITE_TIMEOUT {250};
+
+  /* Throws `std::runtime_error` if another server is using the same name.
+   *
+   * Every device must use the default `DeviceProfile`.
+   */
+  SharedReportServer(
+    FAVJoyState2&&,
+    std::wstring_view name = DEFAULT_NAME);
+  ~SharedReportServer();
+
+  SharedReportServer(const SharedReportServer&) = delete;
+  SharedReportServer& operator=(const SharedReportServer&) = delete;
+
+  /* Send every slot that has changed since it was last sent.
+   *
+   * Returns the number of changed slots. A single changed slot is sent on
+   * its own; if several changed, the reports for all devices up to the
+   * last changed one are sent together.
+   */
+  size_t PushChanges();
+
+  // Call `PushChanges()` until stopped, sleeping while nothing changes
+  void Run(
+    std::stop_token,
+    std::chrono::microseconds idleInterval = DEFAULT_IDLE_INTERVAL);
+
+ private:
+  FAVJoyState2 mDevice;
+  winrt::handle mMapping;
+  void* mView {nullptr};
+  std::span<SharedReportSlot> mSlots;
+
+  struct SlotState {
+    uint32_t sentSequence {};
+    // Odd if a write was in progress when the slot was last read
+    uint32_t busySequence {};
+    std::chrono::steady_clock::time_point busySince {};
+  };
+  std::vector<SlotState> mSlotStates;
+  std::vector<FAVJoyState2Report> mReports;
+
+  void ReclaimIfAbandoned(uint8_t slotIndex);
+};
+
+/** Writes reports to a `SharedReportServer` in another process.
+ *
+ * Writing a report only touches shared memory; it does not make any
+ * system calls, or wait for the report to be sent.
+ */
+class SharedReportClient final {
+ public:
+  // Throws if the server is not running
+  SharedReportClient(
+    std::wstring_view name = SharedReportServer::DEFAULT_NAME);
+  ~SharedReportClient();
+
+  SharedReportClient(const SharedReportClient&) = delete;
+  SharedReportClient& operator=(const SharedReportClient&) = delete;
+
+  size_t GetDeviceCount() const;
+
+  void WriteReport(const FAVJoyState2Report&, uint8_t deviceIndex);
+
+ private:
+  winrt::handle mMapping;
+  void* mView {nullptr};
+  std::span<SharedReportSlot> mSlots;
+};
+
+}// namespace FAVHID
@@ -0,0 +1,99 @@
+// Copyright 2023 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: ISC
+
+#pragma once
+
+#include "FAVJoyState2.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <stop_token>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace FAVHID {
+
+/** A `FAVJoyState2` that reconnects automatically.
+ *
+ * The device is opened, written to, and reopened if it fails, on a
+ * background thread; `WriteReport()` only stores the report and wakes that
+ * thread, so it never waits for the device. Only the latest report for each
+ * device is kept.
+ *
+ * When the device comes back, opening it re-pushes the descriptors if the
+ * volatile config ID doesn't match, then the latest report for every
+ * device is sent again.
+ */
+class SupervisedFAVJoyState2 final {
+ public:
+  using OpenFunction = std::function<std::optional<FAVJoyState2>()>;
+  static constexpr std::chrono::milliseconds DEFAULT_RETRY_INTERVAL {500};
+
+  // Connect with `FAVJoyState2::Open(profiles)`
+  SupervisedFAVJoyState2(
+    std::span<const DeviceProfile> profiles,
+    std::chrono::milliseconds retryInterval = DEFAULT_RETRY_INTERVAL);
+  /* Connect with a custom function, e.g. to open a specific serial number.
+   *
+   * `open` is called on the background thread; it must create the same
+   * devices as `profiles`. It may return an empty optional or throw to
+   * indicate that the device isn't available yet.
+   */
+  SupervisedFAVJoyState2(
+    std::span<const DeviceProfile> profiles,
+    OpenFunction open,
+    std::chrono::milliseconds retryInterval = DEFAULT_RETRY_INTERVAL);
+  ~SupervisedFAVJoyState2();
+
+  SupervisedFAVJoyState2(const SupervisedFAVJoyState2&) = delete;
+  SupervisedFAVJoyState2& operator=(const SupervisedFAVJoyState2&) = delete;
+
+  void WriteReport(const FAVJoyState2Report&, uint8_t deviceIndex);
+
+  template <class TReport>
+    requires requires { TReport::ProfileDescription; }
+  void WriteReport(const TReport& report, uint8_t deviceIndex) {
+    this->WriteReport(
+      TReport::ProfileDescription, report.data(), report.size(), deviceIndex);
+  }
+
+  // Throws `std::logic_error` if the device has a different profile
+  void WriteReport(
+    const DeviceProfile&,
+    const void* report,
+    size_t size,
+    uint8_t deviceIndex);
+
+  bool IsConnected() const;
+  // How many times the device has been opened successfully
+  size_t GetConnectionCount() const;
+
+ private:
+  std::vector<DeviceProfile> mProfiles;
+  OpenFunction mOpen;
+  std::chrono::milliseconds mRetryInterval;
+
+  std::mutex mMutex;
+  std::condition_variable_any mWake;
+  // Empty if nothing has been written for the device yet
+  std::vector<std::string> mReports;
+  std::vector<bool> mDirty;
+
+  std::atomic<bool> mConnected {false};
+  std::atomic<size_t> mConnectionCount {0};
+
+  // Last, so that it's stopped before anything it uses is destroyed
+  std::jthread mThread;
+
+  void Run(std::stop_token);
+  // Returns false if the device failed
+  bool SendDirtyReports(FAVJoyState2&, std::stop_token);
+};
+
+}// namespace FAVHID
@@ -0,0 +1,74 @@
+// Copyright 2023 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: ISC
+
+#pragma once
+
+#include <cinttypes>
+#include <ostream>
+
+/** Timing of protocol phases, for viewing in Perfetto or chrome://tracing.
+ *
+ * Tracing is only compiled in if `FAVHID_ENABLE_TRACING` is defined (the
+ * `FAVHID_ENABLE_TRACING` CMake option); otherwise, `FAVHID_TRACE_SCOPE()`
+ * expands to nothing. When compiled in, it is enabled by default.
+ *
+ * Each thread records to its own fixed-size buffer, without locks or
+ * allocations; once a thread's buffer is full, its oldest events are
+ * overwritten. Recording an event costs two clock reads.
+ *
+ * When a thread exits, its buffer is reused by the next thread that
+ * records an event, so threads that don't overlap share a thread ID in the
+ * trace.
+ *
+ *   FAVHID::Trace::SetEnabled(true);
+ *   // ... use an `Arduino` ...
+ *   std::ofstream f {"favhid-trace.json"};
+ *   FAVHID::Trace::WriteChromeJSON(f);
+ */
+namespace FAVHID::Trace {
+
+// Events per thread
+constexpr size_t BUFFER_SIZE = 8192;
+
+void SetEnabled(bool);
+bool IsEnabled();
+
+/* Write the recorded events in the Chrome trace-event JSON format.
+ *
+ * Threads may keep recording while this is called; events that are
+ * overwritten while they're being written may be inconsistent.
+ */
+void WriteChromeJSON(std::ostream&);
+// Exclude events that have already been recorded from `WriteChromeJSON()`
+void Clear();
+
+// Records an event covering the lifetime of the scope
+class Scope final {
+ public:
+  // `name` must remain valid until the trace has been written, e.g. a
+  // string literal
+  explicit Scope(const char* name) noexcept;
+  ~Scope();
+
+  Scope(const Scope&) = delete;
+  Scope& operator=(const Scope&) = delete;
+
+ private:
+  const char* mName;
+  // 0 if tracing is disabled
+  uint64_t mBeginNS;
+};
+
+}// namespace FAVHID::Trace
+
+#ifdef FAVHID_ENABLE_TRACING
+#define FAVHID_TRACE_CONCAT_IMPL(a, b) a##b
+#define FAVHID_TRACE_CONCAT(a, b) FAVHID_TRACE_CONCAT_IMPL(a, b)
+#define FAVHID_TRACE_SCOPE(name) \
+  const ::FAVHID::Trace::Scope FAVHID_TRACE_CONCAT( \
+    favhidTraceScope, __LINE__) { \
+    name \
+  }
+#else
+#define FAVHID_TRACE_SCOPE(name)
+#endif
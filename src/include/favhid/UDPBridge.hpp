@@ -0,0 +1,188 @@
+// Copyright 2023 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: ISC
+
+#pragma once
+
+#include "Latency.hpp"
+
+#include <chrono>
+#include <cinttypes>
+#include <functional>
+#include <map>
+#include <optional>
+#include <span>
+#include <stop_token>
+#include <string>
+#include <string_view>
+
+namespace FAVHID {
+
+class Arduino;
+
+enum class UDPBridgeMessageType : uint8_t {
+  Report = 1,
+  Status = 2,
+};
+
+#pragma pack(push, 1)
+// Followed by the report
+struct UDPBridgeReportHeader {
+  static constexpr uint8_t HAS_CLOCK_OFFSET = 1 << 0;
+
+  UDPBridgeMessageType type {UDPBridgeMessageType::Report};
+  uint8_t reportID {};
+  uint8_t flags {};
+  // Random per sender, so that a restarted sender isn't treated as stale
+  uint32_t session {};
+  // Shared by all report IDs, so that gaps show lost datagrams
+  uint32_t sequence {};
+  // Sender clock, in the same format as `ReportTimestamps`
+  uint32_t sentUS {};
+  // `receiverTime - senderTime`, if `HAS_CLOCK_OFFSET` is set
+  uint32_t clockOffsetUS {};
+};
+
+// Sent back by the receiver, in response to some reports
+struct UDPBridgeStatus {
+  UDPBridgeMessageType type {UDPBridgeMessageType::Status};
+  uint32_t session {};
+  // `sentUS` from the report this responds to
+  uint32_t reportSentUS {};
+  // Receiver clock
+  uint32_t receivedUS {};
+  uint32_t repliedUS {};
+  uint32_t receivedCount {};
+  uint32_t lostCount {};
+  uint32_t staleCount {};
+};
+#pragma pack(pop)
+
+/** Sends reports to a `UDPBridgeReceiver` on another machine.
+ *
+ * `WriteReport()` sends a single datagram and returns without waiting for
+ * a response, so reports may be lost; as each report carries the full
+ * state, a lost report is corrected by the next one with the same ID.
+ *
+ * Only IPv4 is supported.
+ */
+class UDPBridgeSender final {
+ public:
+  // Throws `std::system_error` if the address can't be resolved
+  UDPBridgeSender(std::string_view host, uint16_t port);
+  ~UDPBridgeSender();
+
+  UDPBridgeSender(const UDPBridgeSender&) = delete;
+  UDPBridgeSender& operator=(const UDPBridgeSender&) = delete;
+
+  // Like `Arduino::WriteReport()`, but never waits for the receiver
+  void WriteReport(uint8_t reportID, const void* report, size_t size);
+
+  /* Process any status messages from the receiver.
+   *
+   * This is called by `WriteReport()`, so only needs to be called directly
+   * to refresh the stats while not sending.
+   */
+  void ReceiveStatus();
+
+  struct Stats {
+    uint32_t sentCount {};
+    // As of the last status message from the receiver
+    uint32_t receivedCount {};
+    uint32_t lostCount {};
+    uint32_t staleCount {};
+    // From sending a report to the receiver receiving it
+    LatencyHistogram oneWay;
+    LatencyHistogram roundTrip;
+  };
+  const Stats& GetStats() const;
+
+ private:
+  uintptr_t mSocket;
+  uint32_t mSession {};
+  uint32_t mSequence {};
+  ClockOffsetEstimator mClockOffset;
+  Stats mStats;
+};
+
+/** Receives reports from a `UDPBridgeSender`, and passes them to a device.
+ *
+ * Datagrams that arrive after a later datagram for the same report ID are
+ * discarded, as they would replace newer state with older state.
+ *
+ * Every `statusInterval` reports, starting with the first, a status
+ * message is sent back so that the sender can measure latency and loss.
+ *
+ * Reports from a new session, such as a restarted sender, are only
+ * accepted once the current session has sent nothing for
+ * `sessionTimeout`; until then, they are discarded, so that a second
+ * sender can't take over, and the stats aren't reset back and forth.
+ */
+class UDPBridgeReceiver final {
+ public:
+  static constexpr uint32_t DEFAULT_STATUS_INTERVAL = 32;
+  static constexpr std::chrono::milliseconds DEFAULT_SESSION_TIMEOUT {1000};
+
+  // Listen on all IPv4 addresses; use port 0 for any available port
+  UDPBridgeReceiver(
+    uint16_t port,
+    uint32_t statusInterval = DEFAULT_STATUS_INTERVAL,
+    std::chrono::milliseconds sessionTimeout = DEFAULT_SESSION_TIMEOUT);
+  ~UDPBridgeReceiver();
+
+  UDPBridgeReceiver(const UDPBridgeReceiver&) = delete;
+  UDPBridgeReceiver& operator=(const UDPBridgeReceiver&) = delete;
+
+  uint16_t GetPort() const;
+
+  using Callback
+    = std::function<void(uint8_t reportID, std::span<const uint8_t> report)>;
+
+  /* Wait for and process datagrams.
+   *
+   * All datagrams that have already arrived are read, and `callback` is
+   * called at most once per report ID, with the latest report.
+   *
+   * Returns false if nothing arrived before the timeout.
+   */
+  bool Poll(std::chrono::milliseconds timeout, const Callback& callback);
+
+  // Write reports to the device until stopped
+  void Run(Arduino&, std::stop_token);
+
+  struct Stats {
+    uint32_t receivedCount {};
+    // Datagrams that never arrived, based on gaps in the sequence numbers
+    uint32_t lostCount {};
+    // Discarded, as a later report with the same ID arrived first
+    uint32_t staleCount {};
+    // Discarded, as they were from a different session
+    uint32_t otherSessionCount {};
+    // Discarded, and not counted as received, as the same datagram was the
+    // last one for its report ID
+    uint32_t duplicateCount {};
+    // Only measured once the sender has estimated the clock offset
+    LatencyHistogram oneWay;
+  };
+  const Stats& GetStats() const;
+
+ private:
+  uintptr_t mSocket;
+  uint32_t mStatusInterval;
+  std::chrono::milliseconds mSessionTimeout;
+
+  std::optional<uint32_t> mSession;
+  std::chrono::steady_clock::time_point mSessionActiveAt {};
+  uint32_t mFirstSequence {};
+  uint32_t mLastSequence {};
+  std::map<uint8_t, uint32_t> mLastSequences;
+  Stats mStats;
+  std::string mBuffer;
+
+  void SendStatus(
+    const UDPBridgeReportHeader&,
+    uint32_t receivedUS,
+    const void* address,
+    int addressSize);
+};
+
+}// namespace FAVHID
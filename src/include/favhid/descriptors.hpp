@@ -3,6 +3,8 @@
 
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <bit>
 #include <cassert>
 #include <cinttypes>
@@ -327,6 +329,19 @@ class LogicalMaximum final : public IntegerEntry<0x25, V> {
   }
 };
 
+/* 4-bit signed exponents, from the least significant nibble: system,
+ * length, mass, time, temperature, current, luminous intensity.
+ *
+ * For example, 0xE011 is SI linear (1), length^1, time^-2: m/s^2. This is a
+ * global item, so reset it with `Unit {0}` when done.
+ */
+template <class V>
+class Unit final : public UnsignedIntegerEntry<0x65, V> {
+ public:
+  constexpr Unit(V value) : UnsignedIntegerEntry<0x65, V>(value) {
+  }
+};
+
 namespace Input {
 template <class V>
 class Input final : public UnsignedIntegerEntry<0x81, V> {
@@ -369,6 +384,42 @@ constexpr Input DataVariableAbsoluteNullState {
 constexpr Input Padding {Flags::Constant};
 }// namespace Input
 
+// Data sent by the host, such as LEDs or force feedback effects
+namespace Output {
+template <class V>
+class Output final : public UnsignedIntegerEntry<0x91, V> {
+ public:
+  constexpr Output(V flags) : UnsignedIntegerEntry<0x91, V>(flags) {
+  }
+};
+
+// Same meanings as for `Input`; `Volatile` is only valid for `Output` and
+// `Feature`
+namespace Flags = Input::Flags;
+
+constexpr Output DataVariableAbsolute {Flags::Variable};
+constexpr Output DataVariableAbsoluteVolatile {
+  Flags::Variable | Flags::Volatile};
+constexpr Output Padding {Flags::Constant};
+}// namespace Output
+
+// Configuration that the host can read or write at any time
+namespace Feature {
+template <class V>
+class Feature final : public UnsignedIntegerEntry<0xb1, V> {
+ public:
+  constexpr Feature(V flags) : UnsignedIntegerEntry<0xb1, V>(flags) {
+  }
+};
+
+namespace Flags = Input::Flags;
+
+constexpr Feature DataVariableAbsolute {Flags::Variable};
+constexpr Feature DataVariableAbsoluteVolatile {
+  Flags::Variable | Flags::Volatile};
+constexpr Feature Padding {Flags::Constant};
+}// namespace Feature
+
 template <class... Entries>
 class Descriptor final : public Entry<(... + Entries::Capacity)> {
  private:
@@ -390,6 +441,148 @@ class Descriptor final : public Entry<(... + Entries::Capacity)> {
   }
 };
 
+/** Serialize a descriptor to a `std::array` of exactly the used size.
+ *
+ * `Descriptor` and `Collection` reserve the worst-case size of every entry,
+ * so a constexpr `Descriptor` carries a zero-padded buffer and a `size_t`.
+ * This evaluates the descriptor twice - once to find the used size, and
+ * once to copy the bytes - so the result can be `static constexpr` data
+ * with no padding.
+ *
+ * `TFactory` must be a captureless lambda (or another default-constructible
+ * type) that returns a `Descriptor`, e.g.:
+ *
+ *   constexpr auto MY_DESCRIPTOR = Compile([] {
+ *     return Descriptor { UsagePage::GenericDesktop, ... };
+ *   });
+ */
+template <class TFactory>
+constexpr auto Compile(TFactory) {
+  constexpr auto size = TFactory {}().size();
+
+  std::array<uint8_t, size> ret {};
+  const auto descriptor = TFactory {}();
+  std::copy_n(descriptor.data(), size, ret.begin());
+  return ret;
+}
+
+/* Call `callback(prefixOffset, dataOffset, dataSize)` for every item in a
+ * serialized descriptor.
+ *
+ * This is just enough of a parser to find items in descriptors built with
+ * this library; it does not validate the descriptor.
+ */
+template <class TCallback>
+constexpr void ForEachItem(
+  const uint8_t* descriptor,
+  size_t size,
+  TCallback&& callback) {
+  size_t i = 0;
+  while (i < size) {
+    const uint8_t prefix = descriptor[i];
+    // Long items: 0xfe, size, tag, data...
+    if (prefix == 0xfe) {
+      const size_t dataSize = (i + 1 < size) ? descriptor[i + 1] : 0;
+      callback(i, i + 3, dataSize);
+      i += 3 + dataSize;
+      continue;
+    }
+
+    constexpr size_t SHORT_ITEM_SIZES[] {0, 1, 2, 4};
+    const auto dataSize = SHORT_ITEM_SIZES[prefix & 0x03];
+    callback(i, i + 1, dataSize);
+    i += 1 + dataSize;
+  }
+}
+
+/** A compiled descriptor with Report IDs that can be changed at runtime.
+ *
+ * Descriptors that only differ by Report ID can share a single skeleton;
+ * `Stamp()` copies the skeleton and patches the data byte of every
+ * `ReportID` item, so you can create as many copies as you need without
+ * instantiating the descriptor once per Report ID.
+ *
+ * Create these with `CompileTemplate()`.
+ */
+template <size_t TSize, size_t TPatchCount>
+class Template final {
+ public:
+  static constexpr size_t Size = TSize;
+
+  constexpr Template(
+    const std::array<uint8_t, TSize>& skeleton,
+    const std::array<size_t, TPatchCount>& reportIDOffsets)
+    : mSkeleton(skeleton), mReportIDOffsets(reportIDOffsets) {
+  }
+
+  constexpr const std::array<uint8_t, TSize>& GetSkeleton() const {
+    return mSkeleton;
+  }
+
+  constexpr const std::array<size_t, TPatchCount>& GetReportIDOffsets()
+    const {
+    return mReportIDOffsets;
+  }
+
+  /// `out` must have space for at least `Size` bytes
+  constexpr void Stamp(uint8_t reportID, uint8_t* out) const {
+    std::copy_n(mSkeleton.data(), TSize, out);
+    for (const auto offset: mReportIDOffsets) {
+      out[offset] = reportID;
+    }
+  }
+
+  constexpr std::array<uint8_t, TSize> Stamp(uint8_t reportID) const {
+    std::array<uint8_t, TSize> ret {};
+    this->Stamp(reportID, ret.data());
+    return ret;
+  }
+
+ private:
+  std::array<uint8_t, TSize> mSkeleton;
+  std::array<size_t, TPatchCount> mReportIDOffsets;
+};
+
+// Report ID is tag 0b1000, type 'global' (0b01), and a 1-byte value
+constexpr uint8_t REPORT_ID_ITEM_PREFIX = 0x85;
+
+template <size_t TSize>
+constexpr size_t CountReportIDItems(const std::array<uint8_t, TSize>& desc) {
+  size_t count = 0;
+  ForEachItem(
+    desc.data(), desc.size(), [&](size_t prefixOffset, size_t, size_t) {
+      if (desc[prefixOffset] == REPORT_ID_ITEM_PREFIX) {
+        ++count;
+      }
+    });
+  return count;
+}
+
+/** Compile a descriptor into a `Template`, with every `ReportID` item marked
+ * as a patch point.
+ *
+ * `TFactory` has the same requirements as for `Compile()`; the Report IDs it
+ * uses are placeholders, but must fit in a single byte.
+ */
+template <class TFactory>
+constexpr auto CompileTemplate(TFactory) {
+  constexpr auto patchCount = CountReportIDItems(Compile(TFactory {}));
+  const auto skeleton = Compile(TFactory {});
+
+  std::array<size_t, patchCount> offsets {};
+  size_t i = 0;
+  ForEachItem(
+    skeleton.data(),
+    skeleton.size(),
+    [&](size_t prefixOffset, size_t dataOffset, size_t) {
+      if (skeleton[prefixOffset] == REPORT_ID_ITEM_PREFIX) {
+        offsets[i++] = dataOffset;
+      }
+    });
+
+  return Template<skeleton.size(), patchCount> {skeleton, offsets};
+}
+
 }// namespace FAVHID::Descriptors
 
 namespace FAVHID::Descriptors::Dynamic {
@@ -12,6 +12,11 @@
 
 namespace FAVHID {
 
+/* Only change this for incompatible changes to existing messages.
+ *
+ * New messages are optional features, advertised by `GetCapabilities`, so
+ * that clients keep working with older firmware.
+ */
 #define FAVHID_PROTO_VERSION "2023111702"
 constexpr uint8_t SERIAL_SIZE = 16;
 constexpr uint8_t FIRST_AVAILABLE_REPORT_ID = 3;
@@ -86,10 +91,82 @@ enum class MessageType : uint8_t {
   ResetUSB,
   // No data
   HardReset,
+  /* Data: { uint8_t count, MultiReportEntryHeader + char[] report... }
+   *
+   * Returns `Response_OK` if every report was written, or
+   * `Response_MultiReportFailed` with one `MessageType` status per entry.
+   */
+  MultiReport,
+  /* Data: { uint8_t reportID, uint8_t bitmap[], char[] changedBytes }
+   *
+   * Only the bytes that differ from the last successfully-written report with
+   * the same ID are sent; bit N of the bitmap is set if byte N changed. The
+   * bitmap is `(previousReportSize + 7) / 8` bytes long.
+   *
+   * Returns `Response_NoDeltaBase` if there is no previous report; the
+   * client should send a full `Report` instead.
+   */
+  DeltaReport,
+  /* Returned data: Capabilities
+   *
+   * Optional features should be advertised here instead of changing
+   * `FAVHID_PROTO_VERSION`, so that clients and firmware can be updated
+   * independently.
+   *
+   * Firmware that predates this returns `Response_UnhandledRequest`; clients
+   * should assume `Capabilities {}`, so none of the optional messages are
+   * used.
+   */
+  GetCapabilities,
+  /* Data: { uint8_t sequence, uint8_t reportID, char[] report }
+   *
+   * Like `Report`, but there is no response; failures are counted, and
+   * can be checked with `GetUnacknowledgedReportStatus`. The sequence
+   * number should increase by one for each message, wrapping at 255; the
+   * device counts reports that don't follow on from the previous one.
+   */
+  UnacknowledgedReport,
+  /* Returned data: UnacknowledgedReportStatus
+   *
+   * Counters are reset on every new connection.
+   */
+  GetUnacknowledgedReportStatus,
+  /* Data: { uint8_t reportID, char[] report }
+   *
+   * Like `Report`, but `Response_OK` has `ReportTimestamps` as data.
+   */
+  TimestampedReport,
+  /* Data: { uint8_t enabled }
+   *
+   * While enabled, the device sends a `DeviceEvent` whenever the host writes
+   * an output or feature report. Events are disabled on every new
+   * connection.
+   */
+  SetDeviceEvents,
+  /* Sent by the device, not the client; there is no response.
+   *
+   * Data: { DeviceEventHeader, char[] report }
+   *
+   * Events can arrive at any time between other messages from the device,
+   * including while the client is waiting for a response, but never inside
+   * one.
+   */
+  DeviceEvent,
+  /* Data: { uint8_t count, MultiDeltaReportEntryHeader + char[] data... }
+   *
+   * Like `MultiReport`, but each entry's data is either the full report, or
+   * the `{ bitmap, changedBytes }` of a `DeltaReport` with the entry's
+   * report ID. Delta entries without a previous report fail with
+   * `Response_NoDeltaBase`.
+   */
+  MultiDeltaReport,
 
   Response_OK = 128,
   Response_IncorrectLength,
   Response_HIDWriteFailed,
+  // Data: MessageType[count], one per entry
+  Response_MultiReportFailed,
+  Response_NoDeltaBase,
 
   Response_UnhandledRequest = 255,
 };
@@ -110,6 +187,83 @@ struct LongMessageHeader {
   }
 };
 
+namespace Capability {
+using Flags = uint32_t;
+
+constexpr Flags MultiReport = 1 << 0;
+constexpr Flags DeltaReport = 1 << 1;
+constexpr Flags UnacknowledgedReport = 1 << 2;
+constexpr Flags TimestampedReport = 1 << 3;
+constexpr Flags DeviceEvents = 1 << 4;
+// Zero bytes between messages are skipped, so clients can pad messages to
+// USB packet boundaries
+constexpr Flags PacketPadding = 1 << 5;
+constexpr Flags MultiDeltaReport = 1 << 6;
+}// namespace Capability
+
+/** Optional features and limits of the device.
+ *
+ * New fields must only be appended; clients copy as much as they receive,
+ * and leave any missing fields at their defaults.
+ */
+struct Capabilities {
+  Capability::Flags flags {};
+  /* Number of messages the client may send before reading a response.
+   *
+   * Unacknowledged reports count until the next response is read, so the
+   * client must check their status at least this often.
+   */
+  uint8_t maxInFlightRequests {1};
+  // Largest `dataLength` the device accepts in a single message; 0 if unknown
+  uint16_t maxDataLength {};
+  // How often the host polls the HID endpoint, in milliseconds; 0 if unknown
+  uint8_t hidPollIntervalMS {};
+};
+
+struct UnacknowledgedReportStatus {
+  // Of the most recently received report
+  uint8_t lastSequence {};
+  uint32_t receivedCount {};
+  uint32_t failedCount {};
+  MessageType lastFailure {MessageType::Response_OK};
+  // Reports whose sequence number wasn't one more than the previous one's,
+  // because reports in between were lost, or were duplicated or reordered
+  uint32_t outOfSequenceCount {};
+};
+
+// Free-running device clock, in microseconds; wraps every ~71 minutes
+struct ReportTimestamps {
+  // When the message header was read
+  uint32_t receivedUS {};
+  // When the report was handed to the HID endpoint
+  uint32_t dispatchedUS {};
+};
+
+enum class DeviceEventType : uint8_t {
+  // For example, keyboard LEDs or force feedback effects
+  OutputReport = 1,
+  FeatureReport = 2,
+};
+
+struct DeviceEventHeader {
+  DeviceEventType type;
+  uint8_t reportID;
+};
+
+struct MultiReportEntryHeader {
+  uint8_t reportID;
+  uint8_t reportSize;
+};
+
+struct MultiDeltaReportEntryHeader {
+  uint8_t reportID;
+  // Of the data that follows, which is smaller than the report for deltas
+  uint8_t dataSize;
+  // 1 if the data is a `DeltaReport` bitmap and changed bytes, 0 if it's
+  // the full report
+  uint8_t isDelta;
+};
+
 #pragma pack(pop)
 
 }// namespace FAVHID
\ No newline at end of file
@@ -3,9 +3,19 @@
 
 #include "favhid/Arduino.hpp"
 
+#include "favhid/Recording.hpp"
+#include "favhid/Trace.hpp"
 #include "favhid/protocol.hpp"
 
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <iostream>
+#include <limits>
+#include <mutex>
+#include <utility>
+#include <vector>
 
 #include <SetupAPI.h>
 
@@ -17,37 +27,110 @@ constexpr std::string_view MSG_HELLO_ACK {"ACKVER" FAVHID_PROTO_VERSION};
 static void
 WriteArduino(const winrt::file_handle& handle, const void* data, size_t size) {
   auto h = handle.get();
-  winrt::check_bool(WriteFile(h, data, static_cast<DWORD>(size), nullptr, nullptr));
+  {
+    FAVHID_TRACE_SCOPE("WriteFile");
+    winrt::check_bool(WriteFile(h, data, static_cast<DWORD>(size), nullptr, nullptr));
+  }
+  FAVHID_TRACE_SCOPE("FlushFileBuffers");
   winrt::check_bool(FlushFileBuffers(h));
 }
 
-static winrt::file_handle OpenArduino(std::wstring_view port) {
-  winrt::file_handle f {
-    CreateFileW(std::format(L"\\\\.\\{}", port).c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, 0, NULL) };
-  COMMCONFIG config {sizeof(COMMCONFIG)};
-  DWORD configSize = sizeof(config);
-  winrt::check_bool(GetCommConfig(f.get(), &config, &configSize));
-  auto& dcb = config.dcb;
-  dcb.BaudRate = 115200;
-  dcb.ByteSize = 8;
-  dcb.Parity = NOPARITY;
-  dcb.StopBits = ONESTOPBIT;
-  dcb.fDtrControl = DTR_CONTROL_ENABLE;
-  dcb.fRtsControl = RTS_CONTROL_DISABLE;
-  winrt::check_bool(SetCommConfig(f.get(), &config, sizeof(config)));
+// Pipes (e.g. `Emulator`) can return short reads
+static void
+ReadArduino(const winrt::file_handle& handle, void* data, size_t size) {
+  auto it = static_cast<char*>(data);
+  while (size > 0) {
+    DWORD bytesRead {};
+    winrt::check_bool(ReadFile(
+      handle.get(), it, static_cast<DWORD>(size), &bytesRead, nullptr));
+    if (bytesRead == 0) {
+      throw std::runtime_error("Unexpected end of stream");
+    }
+    it += bytesRead;
+    size -= bytesRead;
+  }
+}
 
-  WriteArduino(f, MSG_HELLO.data(), MSG_HELLO.size());
+// Bytes that can be read without blocking
+static size_t GetAvailableBytes(const winrt::file_handle& handle) {
+  if (GetFileType(handle.get()) == FILE_TYPE_PIPE) {
+    DWORD available {};
+    winrt::check_bool(
+      PeekNamedPipe(handle.get(), nullptr, 0, nullptr, &available, nullptr));
+    return available;
+  }
 
-  char buf[MSG_HELLO_ACK.size()];
-  DWORD bytesRead {};
+  COMSTAT status {};
+  winrt::check_bool(ClearCommError(handle.get(), nullptr, &status));
+  return status.cbInQue;
+}
+
+/* Create a message with the smallest header that fits.
+ *
+ * The returned buffer has space for `dataSize` bytes of data, starting at
+ * `*data`.
+ */
+static std::string
+MakeMessage(MessageType type, size_t dataSize, char** data) {
+  FAVHID_TRACE_SCOPE("MakeMessage");
+  const bool isLongMessage = dataSize > 0xff;
+  const auto headerSize
+    = isLongMessage ? sizeof(LongMessageHeader) : sizeof(ShortMessageHeader);
 
-  winrt::check_bool(ReadFile(f.get(), buf, sizeof(buf), &bytesRead, nullptr));
+  std::string buf(headerSize + dataSize, '\0');
+  auto it = buf.data();
+  if (isLongMessage) {
+    *reinterpret_cast<LongMessageHeader*>(it) = {
+      .type = type,
+      .dataLength = static_cast<uint16_t>(dataSize),
+    };
+  } else {
+    *reinterpret_cast<ShortMessageHeader*>(it) = {
+      .type = type,
+      .dataLength = static_cast<uint8_t>(dataSize),
+    };
+  }
+  *data = it + headerSize;
+  return buf;
+}
 
-  if (bytesRead != MSG_HELLO_ACK.size()) {
+static winrt::file_handle OpenArduinoPath(const std::wstring& path) {
+  FAVHID_TRACE_SCOPE("Open");
+  winrt::file_handle f {CreateFileW(
+    path.c_str(),
+    GENERIC_READ | GENERIC_WRITE,
+    0,
+    nullptr,
+    OPEN_EXISTING,
+    0,
+    NULL)};
+  if (!f) {
     return {};
   }
 
-  const std::string_view response {buf, bytesRead};
+  // Only actual serial ports need configuring; `Emulator` uses a pipe
+  if (GetFileType(f.get()) == FILE_TYPE_CHAR) {
+    COMMCONFIG config {};
+    config.dwSize = sizeof(config);
+    DWORD configSize = sizeof(config);
+    winrt::check_bool(GetCommConfig(f.get(), &config, &configSize));
+    auto& dcb = config.dcb;
+    dcb.BaudRate = 115200;
+    dcb.ByteSize = 8;
+    dcb.Parity = NOPARITY;
+    dcb.StopBits = ONESTOPBIT;
+    dcb.fDtrControl = DTR_CONTROL_ENABLE;
+    dcb.fRtsControl = RTS_CONTROL_DISABLE;
+    winrt::check_bool(SetCommConfig(f.get(), &config, sizeof(config)));
+  }
+
+  FAVHID_TRACE_SCOPE("Handshake");
+  WriteArduino(f, MSG_HELLO.data(), MSG_HELLO.size());
+
+  char buf[MSG_HELLO_ACK.size()];
+  ReadArduino(f, buf, sizeof(buf));
+
+  const std::string_view response {buf, sizeof(buf)};
   if (response != MSG_HELLO_ACK) {
     return {};
   }
@@ -55,6 +138,10 @@ static winrt::file_handle OpenArduino(std::wstring_view port) {
   return f;
 }
 
+static winrt::file_handle OpenArduino(std::wstring_view port) {
+  return OpenArduinoPath(std::format(L"\\\\.\\{}", port));
+}
+
 winrt::file_handle Arduino::OpenHandle(const std::optional<OpaqueID>& serial) {
   std::vector<std::wstring> ports;
   ULONG count = 255;
@@ -119,11 +206,163 @@ std::optional<Arduino> Arduino::Open(const OpaqueID& serial) {
   return Arduino {std::move(f)};
 }
 
+std::optional<Arduino> Arduino::OpenPath(std::wstring_view path) {
+  std::wstring pathString {path};
+  auto f = OpenArduinoPath(pathString);
+  if (!f) {
+    return {};
+  }
+  Arduino ret {std::move(f)};
+  ret.mPath = std::move(pathString);
+  return ret;
+}
+
+winrt::file_handle Arduino::Reopen(const OpaqueID& serial) {
+  if (mPath.empty()) {
+    return OpenHandle(serial);
+  }
+
+  try {
+    return OpenArduinoPath(mPath);
+  } catch (...) {
+    return {};
+  }
+}
+
 Arduino::Arduino(THandle&& h) : mHandle(std::move(h)) {
+  NegotiateCapabilities();
+}
+
+// Called for every new connection
+void Arduino::NegotiateCapabilities() {
+  FAVHID_TRACE_SCOPE("NegotiateCapabilities");
+  // Older firmware only supports the original messages
+  mCapabilities = {};
+  mUnacknowledgedSinceCheck = 0;
+  mNextSequence = 0;
+  mUnacknowledgedStats = {};
+  mUnacknowledgedProblems = 0;
+  // The device may have restarted, resetting its clock
+  mClockOffset.Clear();
+
+  ShortMessageHeader header {MessageType::GetCapabilities, 0};
+  Write(&header, sizeof(header));
+
+  const auto response = ReadResponse();
+  if (!response.IsOK()) {
+    // Older firmware
+    return;
+  }
+
+  // Newer firmware may append fields we don't know about, and older firmware
+  // may not send fields we do know about
+  Capabilities capabilities {};
+  memcpy(
+    &capabilities,
+    response.data.data(),
+    std::min(response.data.size(), sizeof(capabilities)));
+  mCapabilities = capabilities;
+
+  if (GetMaxUnacknowledgedReports() == 0) {
+    mUnacknowledgedStatusInterval = 0;
+  }
+  if (!(mCapabilities.flags & Capability::TimestampedReport)) {
+    mTimestampedReports = false;
+  }
+  if (!(mCapabilities.flags & Capability::DeviceEvents)) {
+    mDeviceEventCallback = {};
+  }
+  if (!(mCapabilities.flags & Capability::PacketPadding)) {
+    mPacketAlignment = false;
+  }
+  // The device disables events for each new connection
+  if (mDeviceEventCallback) {
+    EnableDeviceEvents(true);
+  }
+}
+
+const Capabilities& Arduino::GetCapabilities() const {
+  return mCapabilities;
+}
+
+size_t Arduino::GetMaxInFlightRequests() const {
+  return std::max<size_t>(mCapabilities.maxInFlightRequests, 1);
+}
+
+// Leaves room for the status request
+size_t Arduino::GetMaxUnacknowledgedReports() const {
+  if (!(mCapabilities.flags & Capability::UnacknowledgedReport)) {
+    return 0;
+  }
+  return GetMaxInFlightRequests() - 1;
 }
 
 void Arduino::Write(const void* data, size_t size) {
-  WriteArduino(mHandle, data, size);
+  constexpr auto PACKET = USB_PACKET_SIZE;
+  const auto packetsSpanned = [](size_t offset, size_t bytes) {
+    return (offset + bytes + PACKET - 1) / PACKET;
+  };
+
+  // Packets are relative to the start of the transfer
+  const auto packetOffset = mTransfer.size() % PACKET;
+  size_t padding = 0;
+  if (
+    packetOffset != 0
+    && packetsSpanned(packetOffset, size) > packetsSpanned(0, size)) {
+    if (mPacketAlignment) {
+      padding = PACKET - packetOffset;
+    } else {
+      ++mPacketStats.splitMessageCount;
+    }
+  }
+
+  ++mPacketStats.messageCount;
+  mPacketStats.messageBytes += size;
+  mPacketStats.paddingBytes += padding;
+  mTransfer.append(padding, '\0');
+  mTransfer.append(static_cast<const char*>(data), size);
+
+  if (!mCoalescing) {
+    FlushWrites();
+  }
+}
+
+void Arduino::FlushWrites() {
+  if (mTransfer.empty()) {
+    return;
+  }
+  ++mPacketStats.transferCount;
+  mPacketStats.packetCount
+    += (mTransfer.size() + USB_PACKET_SIZE - 1) / USB_PACKET_SIZE;
+  // Cleared first, so that a failed write isn't retried with the next one
+  const auto transfer = std::exchange(mTransfer, {});
+  WriteArduino(mHandle, transfer.data(), transfer.size());
+}
+
+Arduino::CoalescedWrites::CoalescedWrites(Arduino* arduino)
+  : mArduino(arduino) {
+  mArduino->mCoalescing = true;
+}
+
+Arduino::CoalescedWrites::~CoalescedWrites() {
+  mArduino->mCoalescing = false;
+  mArduino->mTransfer.clear();
+}
+
+bool Arduino::SetPacketAlignment(bool enabled) {
+  if (enabled && !(mCapabilities.flags & Capability::PacketPadding)) {
+    return false;
+  }
+  mPacketAlignment = enabled;
+  return true;
+}
+
+const Arduino::PacketStats& Arduino::GetPacketStats() const {
+  return mPacketStats;
+}
+
+void Arduino::ClearPacketStats() {
+  mPacketStats = {};
 }
 
 void Arduino::RandomizeSerialNumber() {
@@ -159,49 +398,121 @@ OpaqueID Arduino::GetSerialNumber() {
 }
 
 Response Arduino::ReadResponse() {
-  auto handle = mHandle.get();
+  FAVHID_TRACE_SCOPE("ReadResponse");
+  while (true) {
+    auto message = ReadMessage();
+    if (message.type != MessageType::DeviceEvent) {
+      return message;
+    }
+    DispatchDeviceEvent(message);
+  }
+}
+
+Response Arduino::ReadMessage() {
+  // The device can't respond to messages it hasn't received
+  FlushWrites();
+
   ShortMessageHeader header;
-  winrt::check_bool(
-    ReadFile(handle, &header, sizeof(header), nullptr, nullptr));
+  if (mPartialMessageHeader) {
+    header = *std::exchange(mPartialMessageHeader, std::nullopt);
+  } else {
+    ReadArduino(mHandle, &header, sizeof(header));
+  }
 
   if (header.dataLength == 0) {
     return {header.type};
   }
 
   std::string buf(header.dataLength, '\0');
-  winrt::check_bool(ReadFile(
-    handle, buf.data(), static_cast<DWORD>(buf.size()), nullptr, nullptr));
+  ReadArduino(mHandle, buf.data(), buf.size());
 
   return {header.type, std::move(buf)};
 }
 
+bool Arduino::SetDeviceEventCallback(DeviceEventCallback callback) {
+  if (callback && !(mCapabilities.flags & Capability::DeviceEvents)) {
+    return false;
+  }
+  if (static_cast<bool>(callback) != static_cast<bool>(mDeviceEventCallback)) {
+    EnableDeviceEvents(static_cast<bool>(callback));
+  }
+  mDeviceEventCallback = std::move(callback);
+  return true;
+}
+
+void Arduino::EnableDeviceEvents(bool enabled) {
+  char buf[sizeof(ShortMessageHeader) + 1];
+  *reinterpret_cast<ShortMessageHeader*>(buf) = {
+    .type = MessageType::SetDeviceEvents,
+    .dataLength = 1,
+  };
+  buf[sizeof(ShortMessageHeader)] = enabled ? 1 : 0;
+  Write(buf, sizeof(buf));
+
+  if (!ReadResponse().IsOK()) {
+    throw std::runtime_error("Failed to change device event state");
+  }
+}
+
+size_t Arduino::PollDeviceEvents() {
+  size_t count = 0;
+  // Every response has already been read, so anything else is an event.
+  // Serial ports can't be peeked, so the header is kept until the rest of
+  // the message has arrived, and this never waits for it.
+  while (true) {
+    const auto available = GetAvailableBytes(mHandle);
+    if (!mPartialMessageHeader) {
+      if (available < sizeof(ShortMessageHeader)) {
+        break;
+      }
+      ShortMessageHeader header;
+      ReadArduino(mHandle, &header, sizeof(header));
+      mPartialMessageHeader = header;
+      continue;
+    }
+    if (available < mPartialMessageHeader->dataLength) {
+      break;
+    }
+
+    const auto message = ReadMessage();
+    if (message.type != MessageType::DeviceEvent) {
+      throw std::runtime_error("Unexpected message from device");
+    }
+    DispatchDeviceEvent(message);
+    ++count;
+  }
+  return count;
+}
+
+void Arduino::DispatchDeviceEvent(const Response& message) {
+  // Events may still be in flight after they're disabled
+  if (!mDeviceEventCallback) {
+    return;
+  }
+  if (message.data.size() < sizeof(DeviceEventHeader)) {
+    throw std::runtime_error("Device event is too short");
+  }
+
+  const auto header
+    = *reinterpret_cast<const DeviceEventHeader*>(message.data.data());
+  mDeviceEventCallback({
+    .type = header.type,
+    .reportID = header.reportID,
+    .report = message.data.substr(sizeof(DeviceEventHeader)),
+  });
+}
+
 Response Arduino::PushDescriptor(
   const void* descriptor,
   size_t descriptorSize) {
-  const auto dataSize = descriptorSize;
-  const bool isLongMessage = dataSize > 0xff;
-  const auto headerSize
-    = isLongMessage ? sizeof(LongMessageHeader) : sizeof(ShortMessageHeader);
-  const auto messageSize = headerSize + dataSize;
-
-  std::string buf(messageSize, '\0');
-  auto it = buf.data();
-  if (isLongMessage) {
-    *reinterpret_cast<LongMessageHeader*>(it) = {
-      .type = MessageType::PushDescriptor,
-      .dataLength = static_cast<uint16_t>(dataSize),
-    };
-    it += sizeof(LongMessageHeader);
-  } else {
-    *reinterpret_cast<ShortMessageHeader*>(it) = {
-      .type = MessageType::PushDescriptor,
-      .dataLength = static_cast<uint8_t>(dataSize),
-    };
-    it += sizeof(ShortMessageHeader);
+  FAVHID_TRACE_SCOPE("PushDescriptor");
+  if (mRecorder) {
+    mRecorder->RecordDescriptor(descriptor, descriptorSize);
   }
 
+  char* it {};
+  auto buf = MakeMessage(MessageType::PushDescriptor, descriptorSize, &it);
   memcpy(it, descriptor, descriptorSize);
-  it += descriptorSize;
 
   // If you need to re-enable this, you have my sympathy.
   if constexpr (false) {
@@ -217,78 +528,562 @@ Response Arduino::PushDescriptor(
   return ReadResponse();
 }
 
+/* The size of the bitmap and changed bytes of a delta from `last`.
+ *
+ * Returns 0 if the delta wouldn't be smaller than the full report.
+ */
+static size_t
+GetDeltaSize(std::string_view last, const void* report, size_t size) {
+  if (last.size() != size || size == 0) {
+    return 0;
+  }
+  const auto bytes = static_cast<const char*>(report);
+  size_t changedCount = 0;
+  for (size_t i = 0; i < size; ++i) {
+    changedCount += (bytes[i] != last[i]) ? 1 : 0;
+  }
+  const auto deltaSize = ((size + 7) / 8) + changedCount;
+  return (deltaSize < size) ? deltaSize : 0;
+}
+
+// Write the bitmap and changed bytes; the bitmap must already be zeroed
+static void WriteDelta(
+  char* it,
+  std::string_view last,
+  const void* report,
+  size_t size) {
+  const auto bytes = static_cast<const char*>(report);
+  auto bitmap = reinterpret_cast<uint8_t*>(it);
+  it += (size + 7) / 8;
+  for (size_t i = 0; i < size; ++i) {
+    if (bytes[i] != last[i]) {
+      bitmap[i / 8] |= (1 << (i % 8));
+      *(it++) = bytes[i];
+    }
+  }
+}
+
+std::optional<Response> Arduino::WriteDeltaReport(
+  uint8_t reportID,
+  const void* report,
+  size_t size) {
+  if (!(mCapabilities.flags & Capability::DeltaReport)) {
+    return {};
+  }
+  const auto& last = mLastReports[reportID];
+  const auto deltaSize = GetDeltaSize(last, report, size);
+  if (deltaSize == 0) {
+    return {};
+  }
+
+  char* it {};
+  auto buf = MakeMessage(MessageType::DeltaReport, 1 + deltaSize, &it);
+  *(it++) = static_cast<char>(reportID);
+  WriteDelta(it, last, report, size);
+
+  Write(buf.data(), buf.size());
+  auto response = ReadResponse();
+  if (response.type == MessageType::Response_NoDeltaBase) {
+    return {};
+  }
+  return response;
+}
+
+bool Arduino::SetUnacknowledgedReports(uint16_t statusInterval) {
+  if (statusInterval && GetMaxUnacknowledgedReports() == 0) {
+    return false;
+  }
+  // Without acknowledgements, we can't tell if the delta base is current
+  std::ranges::for_each(mLastReports, [](auto& it) { it.clear(); });
+  mUnacknowledgedStatusInterval = statusInterval;
+  mUnacknowledgedSinceCheck = 0;
+  return true;
+}
+
+Arduino::UnacknowledgedReportStats Arduino::GetUnacknowledgedReportStats() {
+  ShortMessageHeader header {MessageType::GetUnacknowledgedReportStatus, 0};
+  Write(&header, sizeof(header));
+
+  const auto response = ReadResponse();
+  if (!response.IsOK()) {
+    throw std::runtime_error("Failed to get unacknowledged report status");
+  }
+
+  UnacknowledgedReportStatus status {};
+  memcpy(
+    &status,
+    response.data.data(),
+    std::min(response.data.size(), sizeof(status)));
+
+  auto& stats = mUnacknowledgedStats;
+  stats.receivedCount = status.receivedCount;
+  stats.failedCount = status.failedCount;
+  stats.lastFailure = status.lastFailure;
+  stats.outOfSequenceCount = status.outOfSequenceCount;
+  // Every report sent so far has been processed, so the device's last
+  // report must be our last report
+  const auto lastSent = static_cast<uint8_t>(mNextSequence - 1);
+  stats.isLatestReceived = (stats.sentCount == 0)
+    || (status.receivedCount > 0 && status.lastSequence == lastSent);
+  return stats;
+}
+
+Response Arduino::WriteUnacknowledgedReport(
+  uint8_t reportID,
+  const void* report,
+  size_t size) {
+  char* it {};
+  auto buf = MakeMessage(MessageType::UnacknowledgedReport, size + 2, &it);
+  *(it++) = static_cast<char>(mNextSequence++);
+  *(it++) = static_cast<char>(reportID);
+  memcpy(it, report, size);
+  Write(buf.data(), buf.size());
+  ++mUnacknowledgedStats.sentCount;
+
+  // The device can only buffer so many messages without a response
+  const auto interval = std::min<size_t>(
+    mUnacknowledgedStatusInterval, GetMaxUnacknowledgedReports());
+  if (++mUnacknowledgedSinceCheck < interval) {
+    return {MessageType::Response_OK};
+  }
+  mUnacknowledgedSinceCheck = 0;
+
+  FAVHID_TRACE_SCOPE("UnacknowledgedStatusCheck");
+  const auto stats = GetUnacknowledgedReportStats();
+  const auto problems
+    = stats.failedCount + stats.GetLostCount() + stats.outOfSequenceCount;
+  if (
+    std::exchange(mUnacknowledgedProblems, problems) != problems
+    || !stats.isLatestReceived) {
+    return {MessageType::Response_HIDWriteFailed};
+  }
+  return {MessageType::Response_OK};
+}
+
+bool Arduino::SetTimestampedReports(bool enabled) {
+  if (enabled && !(mCapabilities.flags & Capability::TimestampedReport)) {
+    return false;
+  }
+  mTimestampedReports = enabled;
+  return true;
+}
+
+const Arduino::ReportLatency& Arduino::GetReportLatency() const {
+  return mReportLatency;
+}
+
+void Arduino::ClearReportLatency() {
+  mReportLatency = {};
+}
+
+// Same units and wrapping as the device clock
+static uint32_t GetHostTimeUS() {
+  return static_cast<uint32_t>(
+    std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now().time_since_epoch())
+      .count());
+}
+
+Response Arduino::WriteTimestampedReport(
+  uint8_t reportID,
+  const void* report,
+  size_t size) {
+  char* it {};
+  auto buf = MakeMessage(MessageType::TimestampedReport, size + 1, &it);
+  *(it++) = static_cast<char>(reportID);
+  memcpy(it, report, size);
+
+  const auto sent = GetHostTimeUS();
+  Write(buf.data(), buf.size());
+  auto response = ReadResponse();
+  const auto received = GetHostTimeUS();
+
+  // The full report was sent, so it's a valid delta base for later
+  auto& last = mLastReports[reportID];
+  if (!response.IsOK()) {
+    last.clear();
+    return response;
+  }
+  last.assign(static_cast<const char*>(report), size);
+
+  if (response.data.size() < sizeof(ReportTimestamps)) {
+    return response;
+  }
+  ReportTimestamps timestamps;
+  memcpy(&timestamps, response.data.data(), sizeof(timestamps));
+
+  mClockOffset.AddSample(
+    sent, timestamps.receivedUS, timestamps.dispatchedUS, received);
+  const auto sinceSent = [&](uint32_t deviceTime) {
+    const auto hostTime = mClockOffset.ToHostTime(deviceTime);
+    return std::chrono::microseconds {static_cast<int32_t>(hostTime - sent)};
+  };
+  mReportLatency.toDevice.Add(sinceSent(timestamps.receivedUS));
+  mReportLatency.toHID.Add(sinceSent(timestamps.dispatchedUS));
+  mReportLatency.roundTrip.Add(std::chrono::microseconds {received - sent});
+
+  return response;
+}
+
+void Arduino::SetRecorder(Recorder* recorder) {
+  mRecorder = recorder;
+}
+
 Response
 Arduino::WriteReport(uint8_t reportID, const void* report, size_t size) {
-  const auto dataSize = size + 1;
-  const bool isLongMessage = dataSize > 0xff;
-  const auto headerSize
-    = isLongMessage ? sizeof(LongMessageHeader) : sizeof(ShortMessageHeader);
-  const auto messageSize = headerSize + dataSize;
+  FAVHID_TRACE_SCOPE("WriteReport");
+  if (mRecorder) {
+    mRecorder->RecordReport(reportID, report, size);
+  }
 
-  std::string buf(messageSize, '\0');
-  auto it = buf.data();
-  if (isLongMessage) {
-    *reinterpret_cast<LongMessageHeader*>(it) = {
-      .type = MessageType::Report,
-      .dataLength = static_cast<uint16_t>(dataSize),
-    };
-    it += sizeof(LongMessageHeader);
-  } else {
-    *reinterpret_cast<ShortMessageHeader*>(it) = {
-      .type = MessageType::Report,
-      .dataLength = static_cast<uint8_t>(dataSize),
-    };
-    it += sizeof(ShortMessageHeader);
+  if (mUnacknowledgedStatusInterval) {
+    return WriteUnacknowledgedReport(reportID, report, size);
+  }
+  if (mTimestampedReports) {
+    return WriteTimestampedReport(reportID, report, size);
+  }
+
+  auto& last = mLastReports[reportID];
+  if (auto response = WriteDeltaReport(reportID, report, size)) {
+    if (response->IsOK()) {
+      last.assign(static_cast<const char*>(report), size);
+    } else {
+      last.clear();
+    }
+    return *response;
   }
 
+  char* it {};
+  auto buf = MakeMessage(MessageType::Report, size + 1, &it);
+
   memcpy(it, &reportID, 1);
   it++;
 
   memcpy(it, report, size);
 
   Write(buf.data(), buf.size());
-  return ReadResponse();
+  auto response = ReadResponse();
+  if (response.IsOK()) {
+    last.assign(static_cast<const char*>(report), size);
+  } else {
+    last.clear();
+  }
+  return response;
 }
 
-bool Arduino::ResetUSB() {
+Response Arduino::WriteReports(std::span<const ReportEntry> entries) {
+  FAVHID_TRACE_SCOPE("WriteReports");
+  if (entries.empty()) {
+    return {MessageType::Response_OK};
+  }
+
+  std::string statuses;
+  statuses.reserve(entries.size());
+  bool allOK = true;
+
+  // `MultiReport` is always acknowledged, and has no timestamps
+  if (
+    !(mCapabilities.flags & Capability::MultiReport)
+    || mUnacknowledgedStatusInterval || mTimestampedReports) {
+    {
+      // Unacknowledged reports can share a transfer
+      CoalescedWrites coalesced {this};
+      for (const auto& entry: entries) {
+        const auto response
+          = WriteReport(entry.reportID, entry.report, entry.size);
+        statuses.push_back(static_cast<char>(response.type));
+        allOK = allOK && response.IsOK();
+      }
+      FlushWrites();
+    }
+    if (allOK) {
+      return {MessageType::Response_OK};
+    }
+    return {MessageType::Response_MultiReportFailed, std::move(statuses)};
+  }
+
+  const size_t maxDataSize = mCapabilities.maxDataLength
+    ? mCapabilities.maxDataLength
+    : std::numeric_limits<uint16_t>::max();
+
+  // 0 if the entry is sent in full. Report IDs that appear more than once
+  // are always sent in full, so a retry below can't overwrite a later entry
+  std::vector<size_t> deltaSizes(entries.size());
+  if (mCapabilities.flags & Capability::MultiDeltaReport) {
+    std::array<size_t, 0x100> idCounts {};
+    for (const auto& entry: entries) {
+      ++idCounts[entry.reportID];
+    }
+    for (size_t i = 0; i < entries.size(); ++i) {
+      const auto& entry = entries[i];
+      if (idCounts[entry.reportID] == 1) {
+        deltaSizes[i] = GetDeltaSize(
+          mLastReports[entry.reportID], entry.report, entry.size);
+      }
+    }
+  }
+
+  // Responses are read in the order the batches were sent
+  std::deque<std::span<const ReportEntry>> inFlight;
+  const auto finishOldest = [&]() {
+    const auto batch = inFlight.front();
+    inFlight.pop_front();
+    const auto response = FinishMultiReport(batch);
+    for (size_t i = 0; i < batch.size(); ++i) {
+      if (response.type == MessageType::Response_MultiReportFailed) {
+        statuses.push_back(
+          i < response.data.size() ? response.data[i]
+                                   : static_cast<char>(response.type));
+      } else {
+        statuses.push_back(static_cast<char>(response.type));
+      }
+    }
+    allOK = allOK && response.IsOK();
+  };
+
+  // Split into as few messages as the device accepts. This must finish
+  // before anything is sent: throwing with responses still unread would
+  // pair them with later requests
+  std::vector<size_t> batchSizes;
+  {
+    size_t count = 0;
+    size_t dataSize = 1;
+    for (size_t i = 0; i < entries.size(); ++i) {
+      const auto& entry = entries[i];
+      if (entry.size > 0xff) {
+        throw std::logic_error(
+          "Report is too large for a multi-report message");
+      }
+      const auto entrySize = GetMultiReportEntrySize(entry, deltaSizes[i]);
+      if (1 + entrySize > maxDataSize) {
+        throw std::logic_error("Report is too large for the device");
+      }
+      if (count == 0xff || dataSize + entrySize > maxDataSize) {
+        batchSizes.push_back(count);
+        count = 0;
+        dataSize = 1;
+      }
+      dataSize += entrySize;
+      ++count;
+    }
+    batchSizes.push_back(count);
+  }
+
+  {
+    // Batches sent before reading a response share a transfer; reading the
+    // last response sends everything
+    CoalescedWrites coalesced {this};
+    size_t sent = 0;
+    for (const auto count: batchSizes) {
+      const auto batch = entries.subspan(sent, count);
+      if (inFlight.size() >= GetMaxInFlightRequests()) {
+        finishOldest();
+      }
+      SendMultiReport(batch, std::span {deltaSizes}.subspan(sent, count));
+      inFlight.push_back(batch);
+      sent += count;
+    }
+    while (!inFlight.empty()) {
+      finishOldest();
+    }
+  }
+
+  // As with `WriteReport()`, resend in full if the device lost the delta
+  // base; `FinishMultiReport()` cleared it, so there won't be a delta
+  std::vector<ReportEntry> retries;
+  for (size_t i = 0; i < entries.size(); ++i) {
+    if (
+      static_cast<MessageType>(statuses[i])
+      == MessageType::Response_NoDeltaBase) {
+      retries.push_back(entries[i]);
+    }
+  }
+  if (!retries.empty()) {
+    const auto response = WriteReports(retries);
+    allOK = true;
+    size_t retry = 0;
+    for (auto& status: statuses) {
+      if (
+        static_cast<MessageType>(status)
+        == MessageType::Response_NoDeltaBase) {
+        status = (response.IsOK() || retry >= response.data.size())
+          ? static_cast<char>(response.type)
+          : response.data[retry];
+        ++retry;
+      }
+      allOK = allOK
+        && (static_cast<MessageType>(status) == MessageType::Response_OK);
+    }
+  }
+
+  if (allOK) {
+    return {MessageType::Response_OK};
+  }
+  return {MessageType::Response_MultiReportFailed, std::move(statuses)};
+}
+
+size_t Arduino::GetMultiReportEntrySize(
+  const ReportEntry& entry,
+  size_t deltaSize) const {
+  if (mCapabilities.flags & Capability::MultiDeltaReport) {
+    return sizeof(MultiDeltaReportEntryHeader)
+      + (deltaSize ? deltaSize : entry.size);
+  }
+  return sizeof(MultiReportEntryHeader) + entry.size;
+}
+
+void Arduino::SendMultiReport(
+  std::span<const ReportEntry> entries,
+  std::span<const size_t> deltaSizes) {
+  size_t dataSize = 1;
+  for (size_t i = 0; i < entries.size(); ++i) {
+    const auto& entry = entries[i];
+    if (mRecorder) {
+      mRecorder->RecordReport(entry.reportID, entry.report, entry.size);
+    }
+    dataSize += GetMultiReportEntrySize(entry, deltaSizes[i]);
+  }
+
+  const bool deltas = (mCapabilities.flags & Capability::MultiDeltaReport);
+  char* it {};
+  auto buf = MakeMessage(
+    deltas ? MessageType::MultiDeltaReport : MessageType::MultiReport,
+    dataSize,
+    &it);
+  *(it++) = static_cast<char>(entries.size());
+  for (size_t i = 0; i < entries.size(); ++i) {
+    const auto& entry = entries[i];
+    const auto deltaSize = deltaSizes[i];
+    if (!deltas) {
+      *reinterpret_cast<MultiReportEntryHeader*>(it) = {
+        .reportID = entry.reportID,
+        .reportSize = static_cast<uint8_t>(entry.size),
+      };
+      it += sizeof(MultiReportEntryHeader);
+    } else {
+      *reinterpret_cast<MultiDeltaReportEntryHeader*>(it) = {
+        .reportID = entry.reportID,
+        .dataSize = static_cast<uint8_t>(deltaSize ? deltaSize : entry.size),
+        .isDelta = static_cast<uint8_t>(deltaSize ? 1 : 0),
+      };
+      it += sizeof(MultiDeltaReportEntryHeader);
+      if (deltaSize) {
+        WriteDelta(it, mLastReports[entry.reportID], entry.report, entry.size);
+        it += deltaSize;
+        continue;
+      }
+    }
+    memcpy(it, entry.report, entry.size);
+    it += entry.size;
+  }
+
+  Write(buf.data(), buf.size());
+}
+
+Response Arduino::FinishMultiReport(std::span<const ReportEntry> entries) {
+  auto response = ReadResponse();
+
+  for (size_t i = 0; i < entries.size(); ++i) {
+    const auto& entry = entries[i];
+    const bool ok = response.IsOK()
+      || (response.type == MessageType::Response_MultiReportFailed
+          && i < response.data.size()
+          && static_cast<MessageType>(response.data[i])
+            == MessageType::Response_OK);
+    auto& last = mLastReports[entry.reportID];
+    if (ok) {
+      last.assign(static_cast<const char*>(entry.report), entry.size);
+    } else {
+      last.clear();
+    }
+  }
+
+  return response;
+}
+
+// Returns false if `stopToken` is stopped first
+static bool SleepUnlessStopped(
+  std::chrono::milliseconds duration,
+  std::stop_token stopToken) {
+  if (!stopToken.stop_possible()) {
+    Sleep(static_cast<DWORD>(duration.count()));
+    return true;
+  }
+  std::mutex mutex;
+  std::condition_variable_any wake;
+  std::unique_lock lock(mutex);
+  wake.wait_for(lock, stopToken, duration, [] { return false; });
+  return !stopToken.stop_requested();
+}
+
+bool Arduino::ResetUSB(std::stop_token stopToken) {
+  FAVHID_TRACE_SCOPE("ResetUSB");
   const auto serial = GetSerialNumber();
 
   ShortMessageHeader header {MessageType::ResetUSB, 0};
   Write(&header, sizeof(header));
   mHandle.close();
+  mPartialMessageHeader.reset();
+  // The new connection's delta base is unknown
+  std::ranges::for_each(mLastReports, [](auto& it) { it.clear(); });
+
+  {
+    FAVHID_TRACE_SCOPE("WaitForReset");
+    if (!SleepUnlessStopped(std::chrono::milliseconds(1000), stopToken)) {
+      return false;
+    }
 
-  Sleep(1000);
-
-  for (int i = 0; i < 25; ++i) {
-    mHandle = OpenHandle(serial);
-    if (mHandle) {
-      break;
+    for (int i = 0; i < 25; ++i) {
+      mHandle = Reopen(serial);
+      if (mHandle) {
+        break;
+      }
+      if (!SleepUnlessStopped(std::chrono::milliseconds(250), stopToken)) {
+        return false;
+      }
     }
-    Sleep(250);
   }
 
-  return !!mHandle;
+  if (!mHandle) {
+    return false;
+  }
+  NegotiateCapabilities();
+  return true;
 }
 
-bool Arduino::HardReset() {
+bool Arduino::HardReset(std::stop_token stopToken) {
+  FAVHID_TRACE_SCOPE("HardReset");
   const auto serial = GetSerialNumber();
 
   ShortMessageHeader header {MessageType::HardReset, 0};
   Write(&header, sizeof(header));
   mHandle.close();
+  mPartialMessageHeader.reset();
+  std::ranges::for_each(mLastReports, [](auto& it) { it.clear(); });
 
-  Sleep(2000);
-
-  for (int i = 0; i < 5; ++i) {
-    mHandle = OpenHandle(serial);
-    if (mHandle) {
-      break;
+  {
+    FAVHID_TRACE_SCOPE("WaitForReset");
+    if (!SleepUnlessStopped(std::chrono::milliseconds(2000), stopToken)) {
+      return false;
     }
 
-    Sleep(1000);
+    for (int i = 0; i < 5; ++i) {
+      mHandle = Reopen(serial);
+      if (mHandle) {
+        break;
+      }
+
+      if (!SleepUnlessStopped(std::chrono::milliseconds(1000), stopToken)) {
+        return false;
+      }
+    }
   }
 
-  return !!mHandle;
+  if (!mHandle) {
+    return false;
+  }
+  NegotiateCapabilities();
+  return true;
 }
 
 OpaqueID Arduino::GetVolatileConfigID() {
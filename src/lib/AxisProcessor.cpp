@@ -0,0 +1,221 @@
+// Copyright 2023 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: ISC
+
+#include "favhid/AxisProcessor.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define FAVHID_USE_SSE2
+#include <emmintrin.h>
+#elif defined(_M_ARM64) || defined(__aarch64__)
+#define FAVHID_USE_NEON
+#include <arm_neon.h>
+#endif
+
+namespace FAVHID {
+
+namespace {
+
+constexpr size_t LANES = 4;
+constexpr size_t TABLE_SIZE = AxisProcessor::LUT_SEGMENTS + 1;
+constexpr float INT16_SCALE = 32767.0f;
+
+/* Everything except the table lookup; returns |curve input| in [0, 1].
+ *
+ * The sign is applied afterwards, so the tables only cover [0, 1].
+ */
+inline float Normalize(float value, float deadzone, float scale) {
+  const auto magnitude = std::min(std::abs(value), 1.0f);
+  return std::clamp((magnitude - deadzone) * scale, 0.0f, 1.0f);
+}
+
+inline float Lookup(const float* table, float normalized) {
+  const auto position = normalized * AxisProcessor::LUT_SEGMENTS;
+  const auto index = std::min(
+    static_cast<size_t>(position), AxisProcessor::LUT_SEGMENTS - 1);
+  const auto fraction = position - index;
+  return table[index] + ((table[index + 1] - table[index]) * fraction);
+}
+
+inline int16_t Quantize(float value) {
+  return static_cast<int16_t>(
+    std::lround(std::clamp(value, -1.0f, 1.0f) * INT16_SCALE));
+}
+
+}// namespace
+
+AxisCurve AxisCurve::Power(float exponent, float deadzone, float saturation) {
+  return {
+    .deadzone = deadzone,
+    .saturation = saturation,
+    .response = [exponent](float x) { return std::pow(x, exponent); },
+  };
+}
+
+AxisProcessor::AxisProcessor(std::span<const AxisCurve> curves)
+  : mAxisCount(curves.size()) {
+  mDeadzones.resize(mAxisCount);
+  mScales.resize(mAxisCount);
+  mTables.resize(mAxisCount * TABLE_SIZE);
+
+  for (size_t i = 0; i < mAxisCount; ++i) {
+    const auto& curve = curves[i];
+    if (!(curve.deadzone >= 0.0f && curve.saturation > curve.deadzone
+          && curve.saturation <= 1.0f)) {
+      throw std::logic_error(
+        "Axis curves need 0 <= deadzone < saturation <= 1");
+    }
+    mDeadzones[i] = curve.deadzone;
+    mScales[i] = 1.0f / (curve.saturation - curve.deadzone);
+
+    auto table = mTables.data() + (i * TABLE_SIZE);
+    for (size_t j = 0; j < TABLE_SIZE; ++j) {
+      const auto x = static_cast<float>(j) / LUT_SEGMENTS;
+      table[j] = curve.response ? std::clamp(curve.response(x), 0.0f, 1.0f)
+                                : x;
+    }
+  }
+}
+
+size_t AxisProcessor::GetAxisCount() const {
+  return mAxisCount;
+}
+
+void AxisProcessor::Process(
+  std::span<const float> in,
+  std::span<int16_t> out) const {
+  if (in.size() != mAxisCount || out.size() != mAxisCount) {
+    throw std::logic_error("Axis count does not match the curves");
+  }
+  Process(in.data(), out.data(), 0, mAxisCount);
+}
+
+void AxisProcessor::Process(
+  std::span<const float> in,
+  std::span<FAVJoyState2Report> reports) const {
+  constexpr size_t AXES_PER_REPORT = 8;
+  if (
+    in.size() != reports.size() * AXES_PER_REPORT
+    || in.size() != mAxisCount) {
+    throw std::logic_error("Need 8 axes and curves per report");
+  }
+
+  for (size_t i = 0; i < reports.size(); ++i) {
+    int16_t axes[AXES_PER_REPORT];
+    const auto first = i * AXES_PER_REPORT;
+    Process(in.data() + first, axes, first, AXES_PER_REPORT);
+    reports[i].SetAxes(axes);
+  }
+}
+
+void AxisProcessor::Process(
+  const float* in,
+  int16_t* out,
+  size_t firstAxis,
+  size_t count) const {
+  const auto deadzones = mDeadzones.data() + firstAxis;
+  const auto scales = mScales.data() + firstAxis;
+  const auto tables = mTables.data() + (firstAxis * TABLE_SIZE);
+
+  size_t i = 0;
+#if defined(FAVHID_USE_SSE2)
+  const auto signMask = _mm_set1_ps(-0.0f);
+  const auto one = _mm_set1_ps(1.0f);
+  const auto zero = _mm_setzero_ps();
+  const auto segments = _mm_set1_ps(static_cast<float>(LUT_SEGMENTS));
+  const auto lastSegment = _mm_set1_epi32(LUT_SEGMENTS - 1);
+  const auto int16Scale = _mm_set1_ps(INT16_SCALE);
+
+  for (; i + LANES <= count; i += LANES) {
+    const auto value = _mm_loadu_ps(in + i);
+    const auto sign = _mm_and_ps(value, signMask);
+    const auto magnitude = _mm_min_ps(_mm_andnot_ps(signMask, value), one);
+    const auto normalized = _mm_min_ps(
+      _mm_max_ps(
+        _mm_mul_ps(
+          _mm_sub_ps(magnitude, _mm_loadu_ps(deadzones + i)),
+          _mm_loadu_ps(scales + i)),
+        zero),
+      one);
+
+    // SSE2 has no gather, so the table lookups are scalar
+    const auto position = _mm_mul_ps(normalized, segments);
+    // Truncation is floor, as `position` is not negative
+    auto index = _mm_cvttps_epi32(position);
+    // Clamp to the last segment, so that 1.0 interpolates within it
+    const auto beyond = _mm_cmpgt_epi32(index, lastSegment);
+    index = _mm_or_si128(
+      _mm_and_si128(beyond, lastSegment), _mm_andnot_si128(beyond, index));
+    const auto fraction = _mm_sub_ps(position, _mm_cvtepi32_ps(index));
+
+    alignas(16) int32_t indices[LANES];
+    _mm_store_si128(reinterpret_cast<__m128i*>(indices), index);
+    alignas(16) float lower[LANES];
+    alignas(16) float upper[LANES];
+    for (size_t lane = 0; lane < LANES; ++lane) {
+      const auto table = tables + ((i + lane) * TABLE_SIZE);
+      lower[lane] = table[indices[lane]];
+      upper[lane] = table[indices[lane] + 1];
+    }
+    const auto low = _mm_load_ps(lower);
+    const auto curved = _mm_add_ps(
+      low, _mm_mul_ps(_mm_sub_ps(_mm_load_ps(upper), low), fraction));
+
+    // Round to nearest, and saturate while packing to int16
+    const auto scaled = _mm_cvtps_epi32(
+      _mm_mul_ps(_mm_or_ps(curved, sign), int16Scale));
+    _mm_storel_epi64(
+      reinterpret_cast<__m128i*>(out + i),
+      _mm_packs_epi32(scaled, scaled));
+  }
+#elif defined(FAVHID_USE_NEON)
+  const auto one = vdupq_n_f32(1.0f);
+  const auto zero = vdupq_n_f32(0.0f);
+  const auto lastSegment = vdupq_n_u32(LUT_SEGMENTS - 1);
+
+  for (; i + LANES <= count; i += LANES) {
+    const auto value = vld1q_f32(in + i);
+    const auto negative = vcltq_f32(value, zero);
+    const auto magnitude = vminq_f32(vabsq_f32(value), one);
+    const auto normalized = vminq_f32(
+      vmaxq_f32(
+        vmulq_f32(
+          vsubq_f32(magnitude, vld1q_f32(deadzones + i)),
+          vld1q_f32(scales + i)),
+        zero),
+      one);
+
+    const auto position = vmulq_n_f32(normalized, LUT_SEGMENTS);
+    const auto index = vminq_u32(vcvtq_u32_f32(position), lastSegment);
+    const auto fraction = vsubq_f32(position, vcvtq_f32_u32(index));
+
+    uint32_t indices[LANES];
+    vst1q_u32(indices, index);
+    float lower[LANES];
+    float upper[LANES];
+    for (size_t lane = 0; lane < LANES; ++lane) {
+      const auto table = tables + ((i + lane) * TABLE_SIZE);
+      lower[lane] = table[indices[lane]];
+      upper[lane] = table[indices[lane] + 1];
+    }
+    const auto low = vld1q_f32(lower);
+    auto curved = vmlaq_f32(low, vsubq_f32(vld1q_f32(upper), low), fraction);
+    curved = vbslq_f32(negative, vnegq_f32(curved), curved);
+
+    // Round to nearest, and saturate while narrowing to int16
+    const auto scaled = vcvtnq_s32_f32(vmulq_n_f32(curved, INT16_SCALE));
+    vst1_s16(out + i, vqmovn_s32(scaled));
+  }
+#endif
+
+  for (; i < count; ++i) {
+    const auto curved = Lookup(
+      tables + (i * TABLE_SIZE), Normalize(in[i], deadzones[i], scales[i]));
+    out[i] = Quantize(std::signbit(in[i]) ? -curved : curved);
+  }
+}
+
+}// namespace FAVHID
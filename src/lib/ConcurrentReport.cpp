@@ -0,0 +1,119 @@
+// Copyright 2023 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: ISC
+
+#include "favhid/ConcurrentReport.hpp"
+
+#include <stdexcept>
+
+namespace FAVHID {
+
+ConcurrentReport::ConcurrentReport() : ConcurrentReport(FAVJoyState2Report {}) {
+}
+
+ConcurrentReport::ConcurrentReport(const FAVJoyState2Report& initial)
+  : mVersion(0) {
+  const int16_t axes[AXIS_COUNT] {
+    initial.x,
+    initial.y,
+    initial.z,
+    initial.rx,
+    initial.ry,
+    initial.rz,
+    initial.slider[0],
+    initial.slider[1],
+  };
+  for (uint8_t i = 0; i < AXIS_COUNT; ++i) {
+    mAxes[i].store(axes[i], std::memory_order_relaxed);
+  }
+
+  for (uint8_t i = 0; i < BUTTON_WORD_COUNT; ++i) {
+    uint32_t word {};
+    for (uint8_t j = 0; j < 4; ++j) {
+      word |= static_cast<uint32_t>(initial.buttons[(i * 4) + j]) << (8 * j);
+    }
+    mButtons[i].store(word, std::memory_order_relaxed);
+  }
+
+  // Inverse of `FAVJoyState2Report::SetPOVs()`
+  const auto high = initial.povs[1];
+  const auto low = initial.povs[0];
+  mPOVs.store(
+    static_cast<uint16_t>(
+      (high >> 4) | ((high & 0x0f) << 4) | ((low >> 4) << 8)
+      | ((low & 0x0f) << 12)),
+    std::memory_order_relaxed);
+}
+
+void ConcurrentReport::SetAxis(uint8_t axisIndex, int16_t value) {
+  if (axisIndex >= AXIS_COUNT) {
+    throw std::logic_error("axis index out of range");
+  }
+  mAxes[axisIndex].store(value, std::memory_order_relaxed);
+  mVersion.fetch_add(1, std::memory_order_release);
+}
+
+void ConcurrentReport::SetButton(uint8_t buttonIndex, bool on) {
+  if (buttonIndex >= BUTTON_WORD_COUNT * 32) {
+    throw std::logic_error("button index out of range");
+  }
+  auto& word = mButtons[buttonIndex / 32];
+  const uint32_t bit = 1u << (buttonIndex % 32);
+  if (on) {
+    word.fetch_or(bit, std::memory_order_relaxed);
+  } else {
+    word.fetch_and(~bit, std::memory_order_relaxed);
+  }
+  mVersion.fetch_add(1, std::memory_order_release);
+}
+
+void ConcurrentReport::SetPOV(uint8_t hatIndex, uint8_t value) {
+  if (hatIndex >= HAT_COUNT) {
+    throw std::logic_error("hat index out of range");
+  }
+  const auto shift = 4 * hatIndex;
+  const auto mask = static_cast<uint16_t>(0b1111 << shift);
+  auto povs = mPOVs.load(std::memory_order_relaxed);
+  while (!mPOVs.compare_exchange_weak(
+    povs,
+    static_cast<uint16_t>((povs & ~mask) | ((value << shift) & mask)),
+    std::memory_order_relaxed)) {
+  }
+  mVersion.fetch_add(1, std::memory_order_release);
+}
+
+uint64_t ConcurrentReport::Snapshot(FAVJoyState2Report* report) const {
+  int16_t axes[AXIS_COUNT];
+  uint32_t buttons[BUTTON_WORD_COUNT];
+  uint16_t povs;
+
+  auto version = mVersion.load(std::memory_order_acquire);
+  while (true) {
+    for (uint8_t i = 0; i < AXIS_COUNT; ++i) {
+      axes[i] = mAxes[i].load(std::memory_order_relaxed);
+    }
+    for (uint8_t i = 0; i < BUTTON_WORD_COUNT; ++i) {
+      buttons[i] = mButtons[i].load(std::memory_order_relaxed);
+    }
+    povs = mPOVs.load(std::memory_order_relaxed);
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    const auto after = mVersion.load(std::memory_order_acquire);
+    if (after == version) {
+      break;
+    }
+    version = after;
+  }
+
+  report->SetAxes(axes);
+  for (uint8_t i = 0; i < sizeof(report->buttons); ++i) {
+    report->buttons[i] = static_cast<uint8_t>(buttons[i / 4] >> (8 * (i % 4)));
+  }
+  report->SetPOVs(povs);
+  return version;
+}
+
+uint64_t ConcurrentReport::GetVersion() const {
+  return mVersion.load(std::memory_order_acquire);
+}
+
+}// namespace FAVHID
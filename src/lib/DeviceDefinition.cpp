@@ -0,0 +1,286 @@
+// Copyright 2023 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: ISC
+
+#include "favhid/DeviceDefinition.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <format>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <optional>
+#include <random>
+#include <stdexcept>
+
+namespace FAVHID {
+
+namespace {
+
+constexpr std::string_view WHITESPACE {" \t\r"};
+
+uint64_t HashText(std::string_view text) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (const auto c: text) {
+    hash = (hash ^ static_cast<uint8_t>(c)) * 0x100000001b3ull;
+  }
+  return hash;
+}
+
+[[noreturn]] void ThrowParseError(size_t line, std::string_view message) {
+  throw std::runtime_error(std::format("line {}: {}", line, message));
+}
+
+uint8_t ParseValue(size_t line, std::string_view key, std::string_view value) {
+  unsigned int ret {};
+  const auto end = value.data() + value.size();
+  const auto [ptr, ec] = std::from_chars(value.data(), end, ret);
+  if (ec != std::errc {} || ptr != end) {
+    ThrowParseError(line, std::format("`{}` must be a number", key));
+  }
+  if (ret > std::numeric_limits<uint8_t>::max()) {
+    ThrowParseError(line, std::format("`{}` is too large", key));
+  }
+  return static_cast<uint8_t>(ret);
+}
+
+// Comma-separated, such as `velocity,force`
+ExtraAxes ParseExtraAxes(size_t line, std::string_view value) {
+  auto ret = ExtraAxes::None;
+  while (true) {
+    const auto end = std::min(value.find(','), value.size());
+    const auto name = value.substr(0, end);
+    if (name == "velocity") {
+      ret = ret | ExtraAxes::Velocity;
+    } else if (name == "acceleration") {
+      ret = ret | ExtraAxes::Acceleration;
+    } else if (name == "force") {
+      ret = ret | ExtraAxes::Force;
+    } else if (name != "none") {
+      ThrowParseError(line, std::format("unknown extra axes `{}`", name));
+    }
+
+    if (end == value.size()) {
+      return ret;
+    }
+    value.remove_prefix(end + 1);
+  }
+}
+
+DeviceProfile ParseDevice(size_t line, std::string_view text) {
+  DeviceProfile ret {};
+  bool first = true;
+  while (!text.empty()) {
+    const auto end = std::min(text.find_first_of(WHITESPACE), text.size());
+    const auto token = text.substr(0, end);
+    text.remove_prefix(end);
+    text.remove_prefix(
+      std::min(text.find_first_not_of(WHITESPACE), text.size()));
+
+    if (first) {
+      if (token != "device") {
+        ThrowParseError(line, "expected `device`");
+      }
+      first = false;
+      continue;
+    }
+
+    const auto equals = token.find('=');
+    if (equals == token.npos) {
+      ThrowParseError(
+        line, std::format("expected `key=value`, got `{}`", token));
+    }
+    const auto key = token.substr(0, equals);
+    const auto value = token.substr(equals + 1);
+    if (key == "axes") {
+      ret.axisCount = ParseValue(line, key, value);
+    } else if (key == "bits") {
+      ret.axisBits = ParseValue(line, key, value);
+    } else if (key == "hats") {
+      ret.hatCount = ParseValue(line, key, value);
+    } else if (key == "buttons") {
+      ret.buttonCount = ParseValue(line, key, value);
+    } else if (key == "extra") {
+      ret.extraAxes = ParseExtraAxes(line, value);
+    } else {
+      ThrowParseError(line, std::format("unknown field `{}`", key));
+    }
+  }
+
+  if (!ret.IsValid()) {
+    ThrowParseError(line, "invalid device");
+  }
+  return ret;
+}
+
+std::filesystem::path GetCachePath(
+  const std::filesystem::path& directory,
+  uint64_t textHash) {
+  return directory / std::format("{:016x}.favhid-devices", textHash);
+}
+
+std::optional<FAVJoyState2::Configuration> ReadCache(
+  const std::filesystem::path& path,
+  uint64_t textHash) {
+  std::ifstream f {path, std::ios::binary};
+  if (!f) {
+    return {};
+  }
+  const std::string buffer {
+    std::istreambuf_iterator<char> {f}, std::istreambuf_iterator<char> {}};
+  std::string_view remaining {buffer};
+  auto read = [&remaining](void* out, size_t size) {
+    if (remaining.size() < size) {
+      return false;
+    }
+    memcpy(out, remaining.data(), size);
+    remaining.remove_prefix(size);
+    return true;
+  };
+
+  DeviceDefinitionCacheHeader header;
+  if (
+    !read(&header, sizeof(header))
+    || memcmp(header.magic, header.MAGIC, sizeof(header.magic)) != 0
+    || header.version != header.CURRENT_VERSION
+    || header.textHash != textHash || header.deviceCount == 0
+    || header.deviceCount > (0x100 - FIRST_AVAILABLE_REPORT_ID)) {
+    return {};
+  }
+
+  FAVJoyState2::Configuration ret {.configID = header.configID};
+  for (uint32_t i = 0; i < header.deviceCount; ++i) {
+    CachedDeviceDefinition device;
+    if (!read(&device, sizeof(device))) {
+      return {};
+    }
+    const DeviceProfile profile {
+      .axisCount = device.axisCount,
+      .axisBits = device.axisBits,
+      .hatCount = device.hatCount,
+      .buttonCount = device.buttonCount,
+      .extraAxes = static_cast<ExtraAxes>(device.extraAxes),
+    };
+    std::string descriptor(device.descriptorSize, '\0');
+    if (!(profile.IsValid() && read(descriptor.data(), descriptor.size()))) {
+      return {};
+    }
+    ret.profiles.push_back(profile);
+    ret.descriptors.push_back(std::move(descriptor));
+  }
+
+  if (!remaining.empty()) {
+    return {};
+  }
+
+  // Regenerating the descriptors is cheap compared to parsing; don't push
+  // stale descriptors if the file was damaged, or was written by a version
+  // of this library that generates different descriptors
+  auto expected = FAVJoyState2::GetConfiguration(ret.profiles);
+  if (
+    expected.descriptors != ret.descriptors
+    || expected.configID != ret.configID) {
+    return {};
+  }
+  return expected;
+}
+
+void WriteCache(
+  const std::filesystem::path& path,
+  uint64_t textHash,
+  const FAVJoyState2::Configuration& config) {
+  DeviceDefinitionCacheHeader header {
+    .version = DeviceDefinitionCacheHeader::CURRENT_VERSION,
+    .textHash = textHash,
+    .configID = config.configID,
+    .deviceCount = static_cast<uint32_t>(config.profiles.size()),
+  };
+  memcpy(header.magic, header.MAGIC, sizeof(header.magic));
+
+  std::string buffer {reinterpret_cast<const char*>(&header), sizeof(header)};
+  for (size_t i = 0; i < config.profiles.size(); ++i) {
+    const auto& profile = config.profiles.at(i);
+    const auto& descriptor = config.descriptors.at(i);
+    const CachedDeviceDefinition device {
+      .axisCount = profile.axisCount,
+      .axisBits = profile.axisBits,
+      .hatCount = profile.hatCount,
+      .buttonCount = profile.buttonCount,
+      .extraAxes = static_cast<uint8_t>(profile.extraAxes),
+      .descriptorSize = static_cast<uint16_t>(descriptor.size()),
+    };
+    buffer.append(reinterpret_cast<const char*>(&device), sizeof(device));
+    buffer.append(descriptor);
+  }
+
+  // Write then rename, so that a concurrent reader never sees a partial
+  // file; the temporary name is unique so that concurrent writers don't
+  // write to the same file
+  std::error_code ec;
+  std::filesystem::create_directories(path.parent_path(), ec);
+  std::random_device random;
+  auto temporary = path;
+  temporary += std::format(".{:08x}{:08x}.tmp", random(), random());
+  {
+    std::ofstream f {temporary, std::ios::binary | std::ios::trunc};
+    if (!(f && f.write(buffer.data(), buffer.size()) && f.flush())) {
+      f.close();
+      std::filesystem::remove(temporary, ec);
+      return;
+    }
+  }
+  std::filesystem::rename(temporary, path, ec);
+  if (ec) {
+    std::filesystem::remove(temporary, ec);
+  }
+}
+
+}// namespace
+
+std::vector<DeviceProfile> ParseDeviceDefinitions(std::string_view text) {
+  std::vector<DeviceProfile> ret;
+  size_t line = 0;
+  while (!text.empty()) {
+    ++line;
+    const auto end = std::min(text.find('\n'), text.size());
+    auto it = text.substr(0, end);
+    text.remove_prefix(std::min(end + 1, text.size()));
+
+    it = it.substr(0, it.find('#'));
+    it.remove_prefix(std::min(it.find_first_not_of(WHITESPACE), it.size()));
+    it = it.substr(0, it.find_last_not_of(WHITESPACE) + 1);
+    if (it.empty()) {
+      continue;
+    }
+    ret.push_back(ParseDevice(line, it));
+  }
+
+  if (ret.empty()) {
+    throw std::runtime_error("No devices are defined");
+  }
+  if (ret.size() > (0x100 - FIRST_AVAILABLE_REPORT_ID)) {
+    throw std::runtime_error("Too many devices for the available report IDs");
+  }
+  return ret;
+}
+
+FAVJoyState2::Configuration CompileDeviceDefinitions(std::string_view text) {
+  return FAVJoyState2::GetConfiguration(ParseDeviceDefinitions(text));
+}
+
+FAVJoyState2::Configuration CompileDeviceDefinitions(
+  std::string_view text,
+  const std::filesystem::path& cacheDirectory) {
+  const auto hash = HashText(text);
+  const auto path = GetCachePath(cacheDirectory, hash);
+  if (auto cached = ReadCache(path, hash)) {
+    return std::move(*cached);
+  }
+
+  auto ret = CompileDeviceDefinitions(text);
+  WriteCache(path, hash, ret);
+  return ret;
+}
+
+}// namespace FAVHID
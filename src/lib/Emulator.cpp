@@ -0,0 +1,654 @@
+// Copyright 2023 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: ISC
+
+#include "favhid/Emulator.hpp"
+
+#include "favhid/descriptors.hpp"
+
+#include <Windows.h>
+
+#include <winrt/base.h>
+
+#include <chrono>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+
+namespace FAVHID {
+
+namespace {
+
+constexpr std::string_view MSG_HELLO {"FAVHID" FAVHID_PROTO_VERSION};
+constexpr std::string_view MSG_HELLO_ACK {"ACKVER" FAVHID_PROTO_VERSION};
+
+// Message types that always have data, so a zero short length means that a
+// long header is being used
+constexpr bool HasRequiredData(MessageType type) {
+  switch (type) {
+    case MessageType::PushDescriptor:
+    case MessageType::Report:
+    case MessageType::MultiReport:
+    case MessageType::DeltaReport:
+    case MessageType::MultiDeltaReport:
+    case MessageType::UnacknowledgedReport:
+    case MessageType::TimestampedReport:
+      return true;
+    default:
+      return false;
+  }
+}
+
+/* Free-running microsecond clock, like the firmware's `micros()`.
+ *
+ * It's offset from the host clock by half its range, so that clients can't
+ * get away with assuming that the clocks are aligned, or that differences
+ * don't wrap.
+ */
+uint32_t GetDeviceTimeUS() {
+  const auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch())
+                    .count();
+  return static_cast<uint32_t>(us) + 0x8000'0000;
+}
+
+void AppendResponse(
+  std::string& output,
+  MessageType type,
+  const void* data = nullptr,
+  size_t size = 0) {
+  if (size > 0xff) {
+    throw std::logic_error("Response is too large");
+  }
+  const ShortMessageHeader header {type, static_cast<uint8_t>(size)};
+  output.append(reinterpret_cast<const char*>(&header), sizeof(header));
+  if (size) {
+    output.append(static_cast<const char*>(data), size);
+  }
+}
+
+/* Wait for an overlapped operation on the pipe.
+ *
+ * Returns false if the operation failed, or if `stopEvent` was signalled
+ * first.
+ */
+bool WaitForPipe(
+  HANDLE pipe,
+  OVERLAPPED& overlapped,
+  HANDLE stopEvent,
+  DWORD* bytesTransferred) {
+  const HANDLE handles[] {overlapped.hEvent, stopEvent};
+  const auto result = WaitForMultipleObjects(2, handles, FALSE, INFINITE);
+  if (result != WAIT_OBJECT_0) {
+    CancelIoEx(pipe, &overlapped);
+    GetOverlappedResult(pipe, &overlapped, bytesTransferred, TRUE);
+    return false;
+  }
+  return GetOverlappedResult(pipe, &overlapped, bytesTransferred, FALSE);
+}
+
+}// namespace
+
+Emulator::Emulator() : Emulator(OpaqueID::Random()) {
+}
+
+Emulator::Emulator(const OpaqueID& serial)
+  : mSerialNumber(serial),
+    mCapabilities(Capabilities {
+      .flags = Capability::MultiReport | Capability::DeltaReport
+        | Capability::UnacknowledgedReport | Capability::TimestampedReport
+        | Capability::DeviceEvents | Capability::PacketPadding
+        | Capability::MultiDeltaReport,
+      // Several small responses must fit in the pipe's buffer, or `Serve()`
+      // would block writing them while the client is still writing
+      .maxInFlightRequests = 8,
+      .maxDataLength = std::numeric_limits<uint16_t>::max(),
+    }) {
+}
+
+void Emulator::SetCapabilities(const std::optional<Capabilities>& value) {
+  std::unique_lock lock(mMutex);
+  mCapabilities = value;
+}
+
+std::string Emulator::Process(std::string_view input) {
+  std::unique_lock lock(mMutex);
+  mInput.append(input);
+
+  // Events are never inside a response, so they can go first
+  std::string output = std::exchange(mPendingEvents, {});
+  while (!mInput.empty()) {
+    if (!mHelloReceived) {
+      if (mInput.size() < MSG_HELLO.size()) {
+        break;
+      }
+      if (!std::string_view {mInput}.starts_with(MSG_HELLO)) {
+        // Like the firmware, don't respond to an incompatible hello
+        mInput.clear();
+        break;
+      }
+      mInput.erase(0, MSG_HELLO.size());
+      mHelloReceived = true;
+      mUnacknowledgedStatus = {};
+      mDeviceEventsEnabled = false;
+      output.append(MSG_HELLO_ACK);
+      continue;
+    }
+
+    const auto consumed = ProcessMessage(mInput, output);
+    if (consumed == 0) {
+      break;
+    }
+    mInput.erase(0, consumed);
+
+    if (mDisconnectRequested) {
+      mInput.clear();
+      break;
+    }
+  }
+  return output;
+}
+
+size_t Emulator::ProcessMessage(std::string_view input, std::string& output) {
+  if (
+    !input.empty() && input[0] == 0
+    && HasCapability(Capability::PacketPadding)) {
+    return 1;
+  }
+  if (input.size() < sizeof(ShortMessageHeader)) {
+    return 0;
+  }
+
+  const auto header
+    = *reinterpret_cast<const ShortMessageHeader*>(input.data());
+  size_t headerSize = sizeof(ShortMessageHeader);
+  size_t dataSize = header.dataLength;
+  if (dataSize == 0 && HasRequiredData(header.type)) {
+    if (input.size() < sizeof(LongMessageHeader)) {
+      return 0;
+    }
+    headerSize = sizeof(LongMessageHeader);
+    dataSize
+      = reinterpret_cast<const LongMessageHeader*>(input.data())->dataLength;
+  }
+
+  if (input.size() < headerSize + dataSize) {
+    return 0;
+  }
+  const auto data = input.data() + headerSize;
+  const auto consumed = headerSize + dataSize;
+  const auto receivedUS = GetDeviceTimeUS();
+
+  if (
+    mCapabilities && mCapabilities->maxDataLength
+    && dataSize > mCapabilities->maxDataLength) {
+    AppendResponse(output, MessageType::Response_IncorrectLength);
+    return consumed;
+  }
+
+  switch (header.type) {
+    case MessageType::PushDescriptor:
+      mDescriptors.emplace_back(data, dataSize);
+      mVolatileConfigID = {};
+      AppendResponse(output, MessageType::Response_OK);
+      return consumed;
+    case MessageType::Report:
+      if (dataSize < 1) {
+        AppendResponse(output, MessageType::Response_IncorrectLength);
+        return consumed;
+      }
+      AppendResponse(
+        output,
+        WriteReport(static_cast<uint8_t>(data[0]), data + 1, dataSize - 1));
+      return consumed;
+    case MessageType::MultiReport:
+    case MessageType::MultiDeltaReport: {
+      const bool deltas = (header.type == MessageType::MultiDeltaReport);
+      if (!HasCapability(
+            deltas ? Capability::MultiDeltaReport : Capability::MultiReport)) {
+        AppendResponse(output, MessageType::Response_UnhandledRequest);
+        return consumed;
+      }
+      if (dataSize < 1) {
+        AppendResponse(output, MessageType::Response_IncorrectLength);
+        return consumed;
+      }
+      const auto entryHeaderSize = deltas ? sizeof(MultiDeltaReportEntryHeader)
+                                          : sizeof(MultiReportEntryHeader);
+      const auto count = static_cast<uint8_t>(data[0]);
+      std::string statuses(count, '\0');
+      bool allOK = true;
+      size_t offset = 1;
+      for (uint8_t i = 0; i < count; ++i) {
+        if (offset + entryHeaderSize > dataSize) {
+          AppendResponse(output, MessageType::Response_IncorrectLength);
+          return consumed;
+        }
+        // `MultiReportEntryHeader` is a prefix of the delta header
+        const auto entry
+          = *reinterpret_cast<const MultiReportEntryHeader*>(data + offset);
+        const bool isDelta = deltas
+          && reinterpret_cast<const MultiDeltaReportEntryHeader*>(data + offset)
+               ->isDelta;
+        offset += entryHeaderSize;
+        if (offset + entry.reportSize > dataSize) {
+          AppendResponse(output, MessageType::Response_IncorrectLength);
+          return consumed;
+        }
+
+        const auto status = isDelta
+          ? WriteDeltaReport(entry.reportID, data + offset, entry.reportSize)
+          : WriteReport(entry.reportID, data + offset, entry.reportSize);
+        offset += entry.reportSize;
+        statuses[i] = static_cast<char>(status);
+        allOK = allOK && (status == MessageType::Response_OK);
+      }
+
+      if (allOK) {
+        AppendResponse(output, MessageType::Response_OK);
+      } else {
+        AppendResponse(
+          output,
+          MessageType::Response_MultiReportFailed,
+          statuses.data(),
+          statuses.size());
+      }
+      return consumed;
+    }
+    case MessageType::DeltaReport:
+      if (!HasCapability(Capability::DeltaReport)) {
+        AppendResponse(output, MessageType::Response_UnhandledRequest);
+        return consumed;
+      }
+      if (dataSize < 1) {
+        AppendResponse(output, MessageType::Response_IncorrectLength);
+        return consumed;
+      }
+      AppendResponse(
+        output,
+        WriteDeltaReport(
+          static_cast<uint8_t>(data[0]), data + 1, dataSize - 1));
+      return consumed;
+    case MessageType::UnacknowledgedReport: {
+      // No response, even on failure
+      if (!HasCapability(Capability::UnacknowledgedReport)) {
+        return consumed;
+      }
+      auto& status = mUnacknowledgedStatus;
+      ++status.receivedCount;
+      const auto result = (dataSize < 2)
+        ? MessageType::Response_IncorrectLength
+        : WriteReport(static_cast<uint8_t>(data[1]), data + 2, dataSize - 2);
+      if (dataSize >= 1) {
+        const auto sequence = static_cast<uint8_t>(data[0]);
+        if (
+          status.receivedCount > 1
+          && sequence != static_cast<uint8_t>(status.lastSequence + 1)) {
+          ++status.outOfSequenceCount;
+        }
+        status.lastSequence = sequence;
+      }
+      if (result != MessageType::Response_OK) {
+        ++status.failedCount;
+        status.lastFailure = result;
+      }
+      return consumed;
+    }
+    case MessageType::GetUnacknowledgedReportStatus:
+      if (!HasCapability(Capability::UnacknowledgedReport)) {
+        AppendResponse(output, MessageType::Response_UnhandledRequest);
+        return consumed;
+      }
+      AppendResponse(
+        output,
+        MessageType::Response_OK,
+        &mUnacknowledgedStatus,
+        sizeof(mUnacknowledgedStatus));
+      return consumed;
+    case MessageType::TimestampedReport: {
+      if (!HasCapability(Capability::TimestampedReport)) {
+        AppendResponse(output, MessageType::Response_UnhandledRequest);
+        return consumed;
+      }
+      if (dataSize < 1) {
+        AppendResponse(output, MessageType::Response_IncorrectLength);
+        return consumed;
+      }
+      const auto result
+        = WriteReport(static_cast<uint8_t>(data[0]), data + 1, dataSize - 1);
+      if (result != MessageType::Response_OK) {
+        AppendResponse(output, result);
+        return consumed;
+      }
+      const ReportTimestamps timestamps {
+        .receivedUS = receivedUS,
+        .dispatchedUS = GetDeviceTimeUS(),
+      };
+      AppendResponse(output, result, &timestamps, sizeof(timestamps));
+      return consumed;
+    }
+    case MessageType::SetDeviceEvents:
+      if (!HasCapability(Capability::DeviceEvents)) {
+        AppendResponse(output, MessageType::Response_UnhandledRequest);
+        return consumed;
+      }
+      if (dataSize != 1) {
+        AppendResponse(output, MessageType::Response_IncorrectLength);
+        return consumed;
+      }
+      mDeviceEventsEnabled = (data[0] != 0);
+      if (!mDeviceEventsEnabled) {
+        mPendingEvents.clear();
+      }
+      AppendResponse(output, MessageType::Response_OK);
+      return consumed;
+    case MessageType::GetCapabilities:
+      if (!mCapabilities) {
+        AppendResponse(output, MessageType::Response_UnhandledRequest);
+        return consumed;
+      }
+      AppendResponse(
+        output,
+        MessageType::Response_OK,
+        &*mCapabilities,
+        sizeof(Capabilities));
+      return consumed;
+    case MessageType::GetSerialNumber:
+      AppendResponse(
+        output, MessageType::Response_OK, &mSerialNumber, sizeof(OpaqueID));
+      return consumed;
+    case MessageType::SetSerialNumber:
+      if (dataSize != sizeof(OpaqueID)) {
+        AppendResponse(output, MessageType::Response_IncorrectLength);
+        return consumed;
+      }
+      memcpy(&mSerialNumber, data, sizeof(OpaqueID));
+      AppendResponse(output, MessageType::Response_OK);
+      return consumed;
+    case MessageType::GetVolatileConfigID:
+      AppendResponse(
+        output,
+        MessageType::Response_OK,
+        &mVolatileConfigID,
+        sizeof(OpaqueID));
+      return consumed;
+    case MessageType::SetVolatileConfigID:
+      if (dataSize != sizeof(OpaqueID)) {
+        AppendResponse(output, MessageType::Response_IncorrectLength);
+        return consumed;
+      }
+      memcpy(&mVolatileConfigID, data, sizeof(OpaqueID));
+      AppendResponse(output, MessageType::Response_OK);
+      return consumed;
+    case MessageType::ResetUSB:
+      // RAM is retained; the client does not wait for a response
+      this->Disconnect();
+      return consumed;
+    case MessageType::HardReset:
+      mVolatileConfigID = {};
+      mDescriptors.clear();
+      mReports.clear();
+      this->Disconnect();
+      return consumed;
+    default:
+      AppendResponse(output, MessageType::Response_UnhandledRequest);
+      return consumed;
+  }
+}
+
+MessageType
+Emulator::WriteReport(uint8_t reportID, const char* report, size_t size) {
+  // The firmware can't write reports that aren't in a descriptor
+  if (!HasReportID(reportID)) {
+    return MessageType::Response_HIDWriteFailed;
+  }
+  mReports[reportID] = std::string {report, size};
+  return MessageType::Response_OK;
+}
+
+MessageType
+Emulator::WriteDeltaReport(uint8_t reportID, const char* delta, size_t size) {
+  const auto it = mReports.find(reportID);
+  if (it == mReports.end()) {
+    return MessageType::Response_NoDeltaBase;
+  }
+
+  auto report = it->second;
+  const auto bitmapSize = (report.size() + 7) / 8;
+  if (size < bitmapSize) {
+    return MessageType::Response_IncorrectLength;
+  }
+  const auto bitmap = reinterpret_cast<const uint8_t*>(delta);
+  const auto changed = delta + bitmapSize;
+  const auto changedCount = size - bitmapSize;
+
+  size_t next = 0;
+  for (size_t i = 0; i < report.size(); ++i) {
+    if (!(bitmap[i / 8] & (1 << (i % 8)))) {
+      continue;
+    }
+    if (next >= changedCount) {
+      return MessageType::Response_IncorrectLength;
+    }
+    report[i] = changed[next++];
+  }
+  if (next != changedCount) {
+    return MessageType::Response_IncorrectLength;
+  }
+
+  return WriteReport(reportID, report.data(), report.size());
+}
+
+bool Emulator::HasReportID(uint8_t reportID) const {
+  for (const auto& descriptor: mDescriptors) {
+    const auto bytes = reinterpret_cast<const uint8_t*>(descriptor.data());
+    bool found = false;
+    Descriptors::ForEachItem(
+      bytes,
+      descriptor.size(),
+      [&](size_t prefixOffset, size_t dataOffset, size_t) {
+        if (
+          bytes[prefixOffset] == Descriptors::REPORT_ID_ITEM_PREFIX
+          && dataOffset < descriptor.size() && bytes[dataOffset] == reportID) {
+          found = true;
+        }
+      });
+    if (found) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool Emulator::HasCapability(Capability::Flags flag) const {
+  // Firmware without `GetCapabilities` has no optional features
+  const auto capabilities = mCapabilities.value_or(Capabilities {});
+  return (capabilities.flags & flag) == flag;
+}
+
+void Emulator::SendDeviceEvent(
+  DeviceEventType type,
+  uint8_t reportID,
+  std::string_view report) {
+  std::unique_lock lock(mMutex);
+  if (!(mHelloReceived && mDeviceEventsEnabled)) {
+    return;
+  }
+
+  const DeviceEventHeader header {type, reportID};
+  std::string data {reinterpret_cast<const char*>(&header), sizeof(header)};
+  data.append(report);
+  AppendResponse(
+    mPendingEvents, MessageType::DeviceEvent, data.data(), data.size());
+  if (mOnPendingEvent) {
+    mOnPendingEvent();
+  }
+}
+
+void Emulator::Disconnect() {
+  mHelloReceived = false;
+  mDeviceEventsEnabled = false;
+  mPendingEvents.clear();
+  mDisconnectRequested = true;
+}
+
+bool Emulator::TakeDisconnectRequest() {
+  std::unique_lock lock(mMutex);
+  return std::exchange(mDisconnectRequested, false);
+}
+
+void Emulator::Serve(std::wstring_view pipeName, std::stop_token stopToken) {
+  const std::wstring name {pipeName};
+  winrt::handle stopEvent {CreateEventW(nullptr, TRUE, FALSE, nullptr)};
+  winrt::handle ioEvent {CreateEventW(nullptr, TRUE, FALSE, nullptr)};
+  winrt::handle writeEvent {CreateEventW(nullptr, TRUE, FALSE, nullptr)};
+  // Auto-reset, as it's only waited for here
+  winrt::handle pendingEvent {CreateEventW(nullptr, FALSE, FALSE, nullptr)};
+  std::stop_callback onStop(
+    stopToken, [event = stopEvent.get()]() { SetEvent(event); });
+
+  // Cleared when `Serve()` returns, including by throwing, as it refers to
+  // `pendingEvent`
+  struct OnPendingEventScope {
+    Emulator* mEmulator;
+    ~OnPendingEventScope() {
+      std::unique_lock lock(mEmulator->mMutex);
+      mEmulator->mOnPendingEvent = {};
+    }
+  };
+  {
+    std::unique_lock lock(mMutex);
+    mOnPendingEvent = [event = pendingEvent.get()]() { SetEvent(event); };
+  }
+  const OnPendingEventScope onPendingEventScope {this};
+
+  while (!stopToken.stop_requested()) {
+    winrt::file_handle pipe {CreateNamedPipeW(
+      name.c_str(),
+      PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED,
+      PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT
+        | PIPE_REJECT_REMOTE_CLIENTS,
+      1,
+      4096,
+      4096,
+      0,
+      nullptr)};
+    if (!pipe) {
+      winrt::throw_last_error();
+    }
+
+    OVERLAPPED overlapped {.hEvent = ioEvent.get()};
+    DWORD bytes {};
+    if (!ConnectNamedPipe(pipe.get(), &overlapped)) {
+      const auto error = GetLastError();
+      if (
+        error == ERROR_IO_PENDING
+        && !WaitForPipe(pipe.get(), overlapped, stopEvent.get(), &bytes)) {
+        continue;
+      }
+      if (error != ERROR_IO_PENDING && error != ERROR_PIPE_CONNECTED) {
+        continue;
+      }
+    }
+
+    {
+      // A new connection must start with a hello
+      std::unique_lock lock(mMutex);
+      mInput.clear();
+      mPendingEvents.clear();
+      mDeviceEventsEnabled = false;
+      mHelloReceived = false;
+      mDisconnectRequested = false;
+    }
+
+    /* Keep a read pending, so that device events can be written while
+     * waiting for the client.
+     *
+     * The read and writes use separate `OVERLAPPED`s and events, as they
+     * can be in progress at the same time.
+     */
+    char buf[4096];
+    bool reading = false;
+    while (!stopToken.stop_requested()) {
+      if (!reading) {
+        overlapped = {.hEvent = ioEvent.get()};
+        if (
+          !ReadFile(pipe.get(), buf, sizeof(buf), nullptr, &overlapped)
+          && GetLastError() != ERROR_IO_PENDING) {
+          break;
+        }
+        reading = true;
+      }
+
+      const HANDLE handles[] {
+        ioEvent.get(), pendingEvent.get(), stopEvent.get()};
+      const auto wait = WaitForMultipleObjects(
+        static_cast<DWORD>(std::size(handles)), handles, FALSE, INFINITE);
+      std::string_view input;
+      if (wait == WAIT_OBJECT_0) {
+        reading = false;
+        if (!GetOverlappedResult(pipe.get(), &overlapped, &bytes, FALSE)) {
+          break;
+        }
+        input = {buf, bytes};
+      } else if (wait != WAIT_OBJECT_0 + 1) {
+        break;
+      }
+
+      // With no input, this returns just the pending events
+      const auto response = this->Process(input);
+      if (!response.empty()) {
+        OVERLAPPED writeOverlapped {.hEvent = writeEvent.get()};
+        if (
+          !WriteFile(
+            pipe.get(),
+            response.data(),
+            static_cast<DWORD>(response.size()),
+            nullptr,
+            &writeOverlapped)
+          && GetLastError() != ERROR_IO_PENDING) {
+          break;
+        }
+        if (!WaitForPipe(
+              pipe.get(), writeOverlapped, stopEvent.get(), &bytes)) {
+          break;
+        }
+      }
+
+      if (this->TakeDisconnectRequest()) {
+        break;
+      }
+    }
+
+    if (reading) {
+      CancelIoEx(pipe.get(), &overlapped);
+      GetOverlappedResult(pipe.get(), &overlapped, &bytes, TRUE);
+    }
+    DisconnectNamedPipe(pipe.get());
+  }
+}
+
+OpaqueID Emulator::GetSerialNumber() const {
+  std::unique_lock lock(mMutex);
+  return mSerialNumber;
+}
+
+OpaqueID Emulator::GetVolatileConfigID() const {
+  std::unique_lock lock(mMutex);
+  return mVolatileConfigID;
+}
+
+std::vector<std::string> Emulator::GetDescriptors() const {
+  std::unique_lock lock(mMutex);
+  return mDescriptors;
+}
+
+std::optional<std::string> Emulator::GetLastReport(uint8_t reportID) const {
+  std::unique_lock lock(mMutex);
+  const auto it = mReports.find(reportID);
+  if (it == mReports.end()) {
+    return {};
+  }
+  return it->second;
+}
+
+}// namespace FAVHID
@@ -0,0 +1,380 @@
+// Copyright 2023 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: ISC
+
+#include "favhid/Evdev.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <utility>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <linux/input.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <system_error>
+#endif
+
+namespace FAVHID {
+
+namespace {
+
+int16_t ScaleAxis(int32_t value, int32_t minimum, int32_t maximum) {
+  if (maximum <= minimum) {
+    return 0;
+  }
+  const auto clamped = std::clamp(value, minimum, maximum);
+  const auto scaled = (static_cast<int64_t>(clamped) - minimum)
+      * std::numeric_limits<uint16_t>::max()
+      / (static_cast<int64_t>(maximum) - minimum)
+    + std::numeric_limits<int16_t>::min();
+  return static_cast<int16_t>(scaled);
+}
+
+}// namespace
+
+EvdevTranslator::EvdevTranslator() {
+  mHats.fill(UNMAPPED);
+  mButtons.fill(UNMAPPED);
+  mPending.SetPOVs(0xffff);
+  mReport.SetPOVs(0xffff);
+}
+
+EvdevTranslator EvdevTranslator::CreateDefault(
+  std::span<const AxisInfo> axes) {
+  EvdevTranslator ret;
+
+  for (const auto& axis: axes) {
+    if (axis.code <= Evdev::AbsRudder) {
+      ret.MapAxis(axis, static_cast<uint8_t>(axis.code - Evdev::AbsX));
+    }
+  }
+
+  for (uint8_t i = 0; i < 4; ++i) {
+    ret.MapHat(i, i);
+  }
+
+  uint8_t button = 0;
+  // BTN_JOYSTICK (0x120-0x12f) and BTN_GAMEPAD (0x130-0x13f)
+  for (uint16_t code = Evdev::ButtonJoystick; code < 0x140; ++code) {
+    ret.MapButton(code, button++);
+  }
+  for (uint16_t code = Evdev::ButtonTriggerHappy; code < 0x2e8; ++code) {
+    ret.MapButton(code, button++);
+  }
+  for (uint16_t code = Evdev::ButtonMisc; code < 0x10a; ++code) {
+    ret.MapButton(code, button++);
+  }
+
+  return ret;
+}
+
+void EvdevTranslator::MapAxis(const AxisInfo& axis, uint8_t axisIndex) {
+  if (axis.code >= mAxes.size() || axisIndex >= mAxisValues.size()) {
+    throw std::logic_error("axis out of range");
+  }
+  mAxes[axis.code] = {axisIndex, axis.minimum, axis.maximum};
+}
+
+void EvdevTranslator::MapButton(uint16_t code, uint8_t buttonIndex) {
+  if (code >= mButtons.size() || buttonIndex >= 128) {
+    throw std::logic_error("button out of range");
+  }
+  mButtons[code] = buttonIndex;
+}
+
+void EvdevTranslator::MapHat(uint8_t evdevHat, uint8_t hatIndex) {
+  if (evdevHat >= mHats.size() || hatIndex >= 4) {
+    throw std::logic_error("hat out of range");
+  }
+  mHats[evdevHat] = hatIndex;
+}
+
+bool EvdevTranslator::Process(const EvdevEvent& event) {
+  if (event.type == Evdev::EventSync) {
+    if (event.code == Evdev::SyncDropped) {
+      mDropping = true;
+      return false;
+    }
+    if (event.code != Evdev::SyncReport) {
+      return false;
+    }
+    if (std::exchange(mDropping, false)) {
+      // The events we dropped may have been important
+      mResyncNeeded = true;
+      return false;
+    }
+    mResyncNeeded = false;
+    if (!std::exchange(mPendingChanged, false)) {
+      return false;
+    }
+    mReport = mPending;
+    return true;
+  }
+
+  if (mDropping) {
+    return false;
+  }
+
+  if (event.type == Evdev::EventKey) {
+    if (event.code >= mButtons.size() || mButtons[event.code] == UNMAPPED) {
+      return false;
+    }
+    // 2 is auto-repeat
+    mPending.SetButton(mButtons[event.code], event.value != 0);
+    mPendingChanged = true;
+    return false;
+  }
+
+  if (event.type != Evdev::EventAbsolute || event.code >= mAxes.size()) {
+    return false;
+  }
+
+  const auto& axis = mAxes[event.code];
+  if (axis.axisIndex != UNMAPPED) {
+    mAxisValues[axis.axisIndex]
+      = ScaleAxis(event.value, axis.minimum, axis.maximum);
+    mPending.SetAxes(mAxisValues);
+    mPendingChanged = true;
+    return false;
+  }
+
+  if (
+    event.code < Evdev::AbsHat0X
+    || event.code >= Evdev::AbsHat0X + (2 * mHats.size())) {
+    return false;
+  }
+  const auto hatCode = event.code - Evdev::AbsHat0X;
+  const auto hat = mHats[hatCode / 2];
+  if (hat == UNMAPPED) {
+    return false;
+  }
+  mHatValues[hatCode] = static_cast<int8_t>(std::clamp(event.value, -1, 1));
+  const auto x = mHatValues[hatCode & ~1];
+  const auto y = mHatValues[hatCode | 1];
+  mPending.SetPOV(hat, FAVJoyState2Report::GetPOVValue(x, y));
+  mPendingChanged = true;
+  return false;
+}
+
+bool EvdevTranslator::Process(std::span<const EvdevEvent> events) {
+  bool changed = false;
+  for (const auto& event: events) {
+    changed = Process(event) || changed;
+  }
+  return changed;
+}
+
+bool EvdevTranslator::IsResyncNeeded() const {
+  return mResyncNeeded;
+}
+
+const FAVJoyState2Report& EvdevTranslator::GetReport() const {
+  return mReport;
+}
+
+#ifdef __linux__
+
+struct EvdevSource::Source {
+  int fd {-1};
+  bool isDevice {false};
+  uint8_t deviceIndex {};
+  EvdevTranslator translator;
+  // ABS_* codes the device has; `EVIOCGABS` returns a zeroed range for
+  // the others
+  std::vector<uint16_t> absCodes;
+  // Pipes can return partial `input_event`s
+  std::vector<char> partial;
+};
+
+namespace {
+
+std::vector<uint16_t> GetAbsCodes(int fd) {
+  uint8_t bits[Evdev::AbsCount / 8] {};
+  if (ioctl(fd, EVIOCGBIT(EV_ABS, sizeof(bits)), bits) < 0) {
+    return {};
+  }
+
+  std::vector<uint16_t> ret;
+  for (uint16_t code = 0; code < Evdev::AbsCount; ++code) {
+    if (bits[code / 8] & (1 << (code % 8))) {
+      ret.push_back(code);
+    }
+  }
+  return ret;
+}
+
+}// namespace
+
+EvdevSource::EvdevSource() {
+  mEpoll = epoll_create1(EPOLL_CLOEXEC);
+  if (mEpoll < 0) {
+    throw std::system_error(errno, std::generic_category(), "epoll_create1");
+  }
+}
+
+EvdevSource::~EvdevSource() {
+  for (const auto& source: mSources) {
+    if (source->isDevice) {
+      close(source->fd);
+    }
+  }
+  close(mEpoll);
+}
+
+void EvdevSource::AddDevice(
+  const std::filesystem::path& path,
+  uint8_t deviceIndex) {
+  const auto fd = open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+  if (fd < 0) {
+    throw std::system_error(errno, std::generic_category(), path.string());
+  }
+
+  auto source = std::make_unique<Source>();
+  source->fd = fd;
+  source->isDevice = true;
+  source->deviceIndex = deviceIndex;
+  source->absCodes = GetAbsCodes(fd);
+
+  std::vector<EvdevTranslator::AxisInfo> axes;
+  for (const auto code: source->absCodes) {
+    input_absinfo info {};
+    if (ioctl(fd, EVIOCGABS(code), &info) == 0) {
+      axes.push_back({code, info.minimum, info.maximum});
+    }
+  }
+  source->translator = EvdevTranslator::CreateDefault(axes);
+
+  // Start with the current state, rather than waiting for every input to
+  // change
+  Resync(*source);
+  Add(std::move(source));
+}
+
+void EvdevSource::AddFD(
+  int fd,
+  uint8_t deviceIndex,
+  EvdevTranslator translator) {
+  auto source = std::make_unique<Source>();
+  source->fd = fd;
+  source->deviceIndex = deviceIndex;
+  source->translator = std::move(translator);
+  Add(std::move(source));
+}
+
+void EvdevSource::Add(std::unique_ptr<Source> source) {
+  epoll_event event {
+    .events = EPOLLIN,
+    .data = {.ptr = source.get()},
+  };
+  if (epoll_ctl(mEpoll, EPOLL_CTL_ADD, source->fd, &event) != 0) {
+    const auto error = errno;
+    if (source->isDevice) {
+      close(source->fd);
+    }
+    throw std::system_error(error, std::generic_category(), "epoll_ctl");
+  }
+  mSources.push_back(std::move(source));
+  ++mOpenSources;
+}
+
+bool EvdevSource::Read(Source& source, bool* changed) {
+  input_event events[64];
+  auto buf = reinterpret_cast<char*>(events);
+
+  const auto partialSize = source.partial.size();
+  memcpy(buf, source.partial.data(), partialSize);
+  const auto bytesRead
+    = read(source.fd, buf + partialSize, sizeof(events) - partialSize);
+  if (bytesRead < 0) {
+    // ENODEV: unplugged
+    return errno == EAGAIN || errno == EINTR;
+  }
+  if (bytesRead == 0) {
+    return false;
+  }
+
+  const auto available = partialSize + bytesRead;
+  const auto count = available / sizeof(input_event);
+  source.partial.assign(
+    buf + (count * sizeof(input_event)), buf + available);
+
+  for (size_t i = 0; i < count; ++i) {
+    const EvdevEvent event {events[i].type, events[i].code, events[i].value};
+    *changed = source.translator.Process(event) || *changed;
+  }
+
+  if (source.isDevice && source.translator.IsResyncNeeded()) {
+    Resync(source);
+    *changed = true;
+  }
+  return true;
+}
+
+void EvdevSource::Resync(Source& source) {
+  auto& translator = source.translator;
+
+  for (const auto code: source.absCodes) {
+    input_absinfo info {};
+    if (ioctl(source.fd, EVIOCGABS(code), &info) == 0) {
+      translator.Process({Evdev::EventAbsolute, code, info.value});
+    }
+  }
+
+  uint8_t keys[Evdev::KeyCount / 8] {};
+  if (ioctl(source.fd, EVIOCGKEY(sizeof(keys)), keys) >= 0) {
+    for (uint16_t code = 0; code < Evdev::KeyCount; ++code) {
+      const bool pressed = keys[code / 8] & (1 << (code % 8));
+      translator.Process({Evdev::EventKey, code, pressed ? 1 : 0});
+    }
+  }
+
+  translator.Process({Evdev::EventSync, Evdev::SyncReport, 0});
+}
+
+bool EvdevSource::Poll(
+  std::chrono::milliseconds timeout,
+  const Callback& callback) {
+  if (mOpenSources == 0) {
+    return false;
+  }
+
+  epoll_event events[16];
+  const auto count = epoll_wait(
+    mEpoll, events, std::size(events), static_cast<int>(timeout.count()));
+  if (count < 0) {
+    if (errno == EINTR) {
+      return true;
+    }
+    throw std::system_error(errno, std::generic_category(), "epoll_wait");
+  }
+
+  for (int i = 0; i < count; ++i) {
+    auto& source = *static_cast<Source*>(events[i].data.ptr);
+    bool changed = false;
+    if (!Read(source, &changed)) {
+      epoll_ctl(mEpoll, EPOLL_CTL_DEL, source.fd, nullptr);
+      --mOpenSources;
+    }
+    if (changed) {
+      callback(source.deviceIndex, source.translator.GetReport());
+    }
+  }
+
+  return mOpenSources > 0;
+}
+
+void EvdevSource::Run(std::stop_token stopToken, const Callback& callback) {
+  // Wake periodically so that stop requests are noticed
+  constexpr std::chrono::milliseconds timeout {100};
+  while (!stopToken.stop_requested() && Poll(timeout, callback)) {
+  }
+}
+
+#endif
+
+}// namespace FAVHID
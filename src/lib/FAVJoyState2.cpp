@@ -5,13 +5,21 @@
 
 #include "favhid/descriptors.hpp"
 
+#include <algorithm>
 #include <stdexcept>
 
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define FAVHID_USE_SSE2
+#include <emmintrin.h>
+#elif defined(_M_ARM64) || defined(__aarch64__)
+#define FAVHID_USE_NEON
+#include <arm_neon.h>
+#endif
+
 namespace FAVHID {
 
 namespace {
 
-template <uint8_t reportID>
 constexpr auto MakeDescriptor() {
   using namespace FAVHID::Descriptors;
 
@@ -20,7 +28,8 @@ constexpr auto MakeDescriptor() {
     Usage::Joystick,
     Collection::Application {
       Collection::Physical {
-        ReportID {reportID},
+        // Placeholder; patched by `DESCRIPTOR_TEMPLATE.Stamp()`
+        ReportID {FIRST_AVAILABLE_REPORT_ID},
         UsagePage::GenericDesktop,
         Usage::X,
         Usage::Y,
@@ -66,28 +75,13 @@ constexpr auto MakeDescriptor() {
   };
 }
 
-constexpr uint8_t REPORT_IDS[FAVJoyState2::MAX_DEVICES] {
-  FIRST_AVAILABLE_REPORT_ID,
-  FIRST_AVAILABLE_REPORT_ID + 1,
-  FIRST_AVAILABLE_REPORT_ID + 2,
-  FIRST_AVAILABLE_REPORT_ID + 3,
-  FIRST_AVAILABLE_REPORT_ID + 4,
-  FIRST_AVAILABLE_REPORT_ID + 5,
-  FIRST_AVAILABLE_REPORT_ID + 6,
-  FIRST_AVAILABLE_REPORT_ID + 7,
-};
+// All devices share a single descriptor, other than the report ID
+constexpr auto DESCRIPTOR_TEMPLATE
+  = Descriptors::CompileTemplate([] { return MakeDescriptor(); });
 
-using Descriptor = decltype(MakeDescriptor<REPORT_IDS[0]>());
-constexpr Descriptor DESCRIPTORS[FAVJoyState2::MAX_DEVICES] {
-  MakeDescriptor<REPORT_IDS[0]>(),
-  MakeDescriptor<REPORT_IDS[1]>(),
-  MakeDescriptor<REPORT_IDS[2]>(),
-  MakeDescriptor<REPORT_IDS[3]>(),
-  MakeDescriptor<REPORT_IDS[4]>(),
-  MakeDescriptor<REPORT_IDS[5]>(),
-  MakeDescriptor<REPORT_IDS[6]>(),
-  MakeDescriptor<REPORT_IDS[7]>(),
-};
+constexpr uint8_t GetReportID(uint8_t deviceIndex) {
+  return FIRST_AVAILABLE_REPORT_ID + deviceIndex;
+}
 
 // Varies depending on how many devices we're attaching
 constexpr OpaqueID CONFIG_IDS[FAVJoyState2::MAX_DEVICES] {
@@ -148,49 +142,211 @@ constexpr OpaqueID CONFIG_IDS[FAVJoyState2::MAX_DEVICES] {
   },
 };
 
+/* Pack the high bit of each of DIJOYSTATE2's 128 button bytes into a
+ * 128-bit mask, with button N at bit N.
+ *
+ * This matches SSE2's `movemask` ordering, so each 16-byte load becomes two
+ * bytes of the mask.
+ */
+void PackButtons(const BYTE (&in)[128], uint8_t (&out)[128 / 8]) noexcept {
+#if defined(FAVHID_USE_SSE2)
+  for (size_t i = 0; i < 128; i += 16) {
+    const auto bytes
+      = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+    const auto bits = static_cast<uint16_t>(_mm_movemask_epi8(bytes));
+    memcpy(out + (i / 8), &bits, sizeof(bits));
+  }
+#elif defined(FAVHID_USE_NEON)
+  // Move the high bit to the bottom, then shift each lane to its bit position
+  // within its half, and add across each half
+  constexpr int8_t shiftValues[16] {
+    0, 1, 2, 3, 4, 5, 6, 7, 0, 1, 2, 3, 4, 5, 6, 7};
+  const auto shifts = vld1q_s8(shiftValues);
+  for (size_t i = 0; i < 128; i += 16) {
+    const auto bits = vshlq_u8(vshrq_n_u8(vld1q_u8(in + i), 7), shifts);
+    out[i / 8] = vaddv_u8(vget_low_u8(bits));
+    out[(i / 8) + 1] = vaddv_u8(vget_high_u8(bits));
+  }
+#else
+  // Multiply the isolated high bits of 8 bytes so they all land in the top
+  // byte, in order
+  for (size_t i = 0; i < 128; i += 8) {
+    uint64_t bytes;
+    memcpy(&bytes, in + i, sizeof(bytes));
+    const auto bits = (bytes & 0x8080808080808080ull) >> 7;
+    out[i / 8] = static_cast<uint8_t>((bits * 0x0102040810204080ull) >> 56);
+  }
+#endif
+}
+
+constexpr DeviceProfile DEFAULT_PROFILE {};
+static_assert(DEFAULT_PROFILE.GetReportSize() == sizeof(FAVJoyState2::Report));
+
+std::string GetProfileDescriptor(
+  const DeviceProfile& profile,
+  uint8_t device) {
+  if (profile == DEFAULT_PROFILE) {
+    return FAVJoyState2::GetDescriptor(device);
+  }
+  return profile.GetDescriptor(GetReportID(device));
+}
+
+/* Content-derived config ID for custom profiles.
+ *
+ * Two 64-bit FNV-1a hashes with different offset bases; this isn't
+ * cryptographic, it just needs to change when the descriptors change.
+ */
+OpaqueID HashDescriptors(std::span<const std::string> descriptors) {
+  uint64_t hashes[2] {0xcbf29ce484222325ull, 0x84222325cbf29ce4ull};
+  auto hash = [&hashes](const void* data, size_t size) {
+    const auto bytes = static_cast<const uint8_t*>(data);
+    for (auto& h: hashes) {
+      for (size_t i = 0; i < size; ++i) {
+        h = (h ^ bytes[i]) * 0x100000001b3ull;
+      }
+    }
+  };
+
+  for (const auto& descriptor: descriptors) {
+    const auto size = descriptor.size();
+    hash(&size, sizeof(size));
+    hash(descriptor.data(), descriptor.size());
+  }
+
+  static_assert(sizeof(hashes) == sizeof(OpaqueID));
+  return *reinterpret_cast<const OpaqueID*>(hashes);
+}
+
 }// namespace
 
-std::string_view FAVJoyState2::GetDescriptor(uint8_t device) {
-  const auto& descriptor = DESCRIPTORS[device];
-  return { reinterpret_cast<const char*>(descriptor.data()), descriptor.size() };
+std::string FAVJoyState2::GetDescriptor(uint8_t device) {
+  if (device > 0xff - FIRST_AVAILABLE_REPORT_ID) {
+    throw std::logic_error("Device index does not fit in a report ID");
+  }
+
+  std::string ret(DESCRIPTOR_TEMPLATE.Size, '\0');
+  DESCRIPTOR_TEMPLATE.Stamp(
+    GetReportID(device), reinterpret_cast<uint8_t*>(ret.data()));
+  return ret;
+}
+
+uint8_t FAVJoyState2::GetDeviceCount() const {
+  return mCount;
+}
+
+bool FAVJoyState2::IsDefaultProfile(uint8_t deviceIndex) const {
+  if (deviceIndex >= mCount) {
+    throw std::logic_error("Device index is >= device count");
+  }
+  return mProfiles[deviceIndex] == DEFAULT_PROFILE;
 }
 
-FAVJoyState2::FAVJoyState2(uint8_t deviceCount, Arduino&& a)
+FAVJoyState2::Configuration FAVJoyState2::GetConfiguration(
+  std::span<const DeviceProfile> profiles) {
+  if (profiles.empty()) {
+    throw std::logic_error("At least one device is required");
+  }
+  if (profiles.size() > (0x100 - FIRST_AVAILABLE_REPORT_ID)) {
+    throw std::logic_error("Too many devices for the available report IDs");
+  }
+
+  Configuration ret {
+    .profiles = {profiles.begin(), profiles.end()},
+  };
+  for (uint8_t i = 0; i < profiles.size(); ++i) {
+    ret.descriptors.push_back(GetProfileDescriptor(profiles[i], i));
+  }
+  ret.configID = GetConfigID(ret.profiles, ret.descriptors);
+  return ret;
+}
+
+OpaqueID FAVJoyState2::GetConfigID(
+  std::span<const DeviceProfile> profiles,
+  std::span<const std::string> descriptors) {
+  // Keep the fixed IDs for the default profile so that existing devices
+  // aren't needlessly reconfigured
+  const bool allDefault = std::ranges::all_of(
+    profiles, [](const auto& it) { return it == DEFAULT_PROFILE; });
+  if (allDefault && !profiles.empty() && profiles.size() <= MAX_DEVICES) {
+    return CONFIG_IDS[profiles.size() - 1];
+  }
+  return HashDescriptors(descriptors);
+}
+
+FAVJoyState2::FAVJoyState2(const Configuration& config, Arduino&& a)
   : mDevice(std::move(a)),
-    mCount(deviceCount),
-    mConfigID(CONFIG_IDS[deviceCount - 1]) {
-  const auto oldID = mDevice.GetVolatileConfigID();
-  if (oldID == mConfigID) {
-    return;
+    mCount(static_cast<uint8_t>(config.profiles.size())),
+    mProfiles(config.profiles),
+    mConfigID(config.configID) {
+  Configure(mDevice, config, {}, {});
+}
+
+bool FAVJoyState2::Configure(
+  Arduino& device,
+  const Configuration& config,
+  const OpenProgressCallback& progress,
+  std::stop_token stopToken) {
+  if (config.profiles.empty()) {
+    throw std::logic_error("At least one device is required");
+  }
+  if (config.profiles.size() > (0x100 - FIRST_AVAILABLE_REPORT_ID)) {
+    throw std::logic_error("Too many devices for the available report IDs");
+  }
+  if (config.descriptors.size() != config.profiles.size()) {
+    throw std::logic_error("Configuration needs one descriptor per profile");
+  }
+
+  const auto oldID = device.GetVolatileConfigID();
+  if (oldID == config.configID) {
+    return true;
   }
 
+  const auto enter = [&](OpenPhase phase) {
+    if (progress) {
+      progress(phase);
+    }
+  };
+
   if (!oldID.IsZero()) {
-    if (!mDevice.HardReset()) {
+    if (stopToken.stop_requested()) {
+      return false;
+    }
+    enter(OpenPhase::Resetting);
+    if (!device.HardReset(stopToken)) {
+      if (stopToken.stop_requested()) {
+        return false;
+      }
       throw std::runtime_error("Arduino did not come back after hard reset");
     }
   }
 
-  for (int i = 0; i < deviceCount; ++i) {
-    const auto& descriptor = DESCRIPTORS[i];
-    mDevice.PushDescriptor(descriptor.data(), descriptor.size());
+  if (stopToken.stop_requested()) {
+    return false;
+  }
+  enter(OpenPhase::PushingDescriptors);
+  for (const auto& descriptor: config.descriptors) {
+    device.PushDescriptor(descriptor.data(), descriptor.size());
   }
-  mDevice.SetVolatileConfigID(mConfigID);
+  device.SetVolatileConfigID(config.configID);
 
-  if (!mDevice.ResetUSB()) {
+  // The reset request is sent even if we stop waiting, so the OS still sees
+  // the new descriptors
+  enter(OpenPhase::Reenumerating);
+  if (!device.ResetUSB(stopToken)) {
+    if (stopToken.stop_requested()) {
+      return false;
+    }
     throw std::runtime_error("Arduino did not come back after USB reset");
   }
 
-  if (mDevice.GetVolatileConfigID() != mConfigID) {
+  if (device.GetVolatileConfigID() != config.configID) {
     throw std::runtime_error(
       "Arduino came back with a different volatile config ID");
   }
+  return true;
 }
 
-void FAVJoyState2::WriteReport(const DIJOYSTATE2& di, uint8_t deviceIndex) {
-  if (deviceIndex >= mCount) {
-    throw std::logic_error("Device index is >= device count");
-  }
-
+FAVJoyState2::Report FAVJoyState2::ToReport(const DIJOYSTATE2& di) noexcept {
   Report report {
     .x = static_cast<int16_t>(di.lX),
     .y = static_cast<int16_t>(di.lY),
@@ -204,49 +360,136 @@ void FAVJoyState2::WriteReport(const DIJOYSTATE2& di, uint8_t deviceIndex) {
     },
   };
 
-  // Convert POVs from centidegrees
+  // Convert POVs from centidegrees; the division by a constant is compiled
+  // to a multiply
+  uint16_t povs {};
   for (uint8_t i = 0; i < 4; ++i) {
     const auto diValue = di.rgdwPOV[i];
     const auto centered = (LOWORD(diValue) == 0xFFFF);
-    const uint8_t value = centered ? 0b1111 : static_cast<uint8_t>(diValue / 4500);
-    report.SetPOV(i, value);
+    const uint16_t value = centered ? 0b1111 : ((diValue / 4500) & 0b0111);
+    povs |= value << (4 * i);
   }
+  report.SetPOVs(povs);
 
   // Convert buttons from byte with high-bit to just a bit mask
-  constexpr uint8_t BUTTON_ON_BIT = (1 << 7);
-  for (uint8_t i = 0; i < 128; ++i) {
-    if (!(di.rgbButtons[i] & BUTTON_ON_BIT)) {
-      continue;
-    }
-    report.SetButton(i);
+  PackButtons(di.rgbButtons, report.buttons);
+
+  return report;
+}
+
+void FAVJoyState2::WriteReport(const DIJOYSTATE2& di, uint8_t deviceIndex) {
+  if (deviceIndex >= mCount) {
+    throw std::logic_error("Device index is >= device count");
   }
 
-  this->WriteReport(report, deviceIndex);
+  this->WriteReport(ToReport(di), deviceIndex);
+}
+
+void FAVJoyState2::WriteReports(std::span<const DIJOYSTATE2> states) {
+  if (states.size() > mCount) {
+    throw std::logic_error("More states than devices");
+  }
+
+  std::vector<Report> reports(states.size());
+  for (size_t i = 0; i < states.size(); ++i) {
+    reports[i] = ToReport(states[i]);
+  }
+  this->WriteReports(reports);
 }
 
 void FAVJoyState2::WriteReport(const Report& report, uint8_t deviceIndex) {
+  this->WriteReport(DEFAULT_PROFILE, &report, sizeof(report), deviceIndex);
+}
+
+void FAVJoyState2::WriteReports(std::span<const Report> reports) {
+  if (reports.size() > mCount) {
+    throw std::logic_error("More reports than devices");
+  }
+
+  std::vector<Arduino::ReportEntry> entries(reports.size());
+  for (uint8_t i = 0; i < reports.size(); ++i) {
+    if (mProfiles[i] != DEFAULT_PROFILE) {
+      throw std::logic_error("Report is for a different device profile");
+    }
+    entries[i] = {GetReportID(i), &reports[i], sizeof(Report)};
+  }
+  mDevice.WriteReports(entries);
+}
+
+void FAVJoyState2::WriteReport(
+  const DeviceProfile& profile,
+  const void* report,
+  size_t size,
+  uint8_t deviceIndex) {
   if (deviceIndex >= mCount) {
     throw std::logic_error("Device index is >= device count");
   }
-  mDevice.WriteReport(REPORT_IDS[deviceIndex], &report, sizeof(report));
+  if (mProfiles[deviceIndex] != profile) {
+    throw std::logic_error("Report is for a different device profile");
+  }
+  if (size != profile.GetReportSize()) {
+    throw std::logic_error("Report size does not match the device profile");
+  }
+  mDevice.WriteReport(GetReportID(deviceIndex), report, size);
 }
 
 std::optional<FAVJoyState2> FAVJoyState2::Open(uint8_t deviceCount) {
+  if (deviceCount == 0 || deviceCount > MAX_DEVICES) {
+    throw std::logic_error("Device count must be between 1 and MAX_DEVICES");
+  }
+  const std::vector<DeviceProfile> profiles(deviceCount, DEFAULT_PROFILE);
+  return Open(profiles);
+}
+
+std::optional<FAVJoyState2> FAVJoyState2::Open(
+  const OpaqueID& serial,
+  uint8_t deviceCount) {
+  if (deviceCount == 0 || deviceCount > MAX_DEVICES) {
+    throw std::logic_error("Device count must be between 1 and MAX_DEVICES");
+  }
+  const std::vector<DeviceProfile> profiles(deviceCount, DEFAULT_PROFILE);
+  return Open(serial, profiles);
+}
+
+std::optional<FAVJoyState2> FAVJoyState2::Open(
+  std::span<const DeviceProfile> profiles) {
+  return Open(GetConfiguration(profiles));
+}
+
+std::optional<FAVJoyState2> FAVJoyState2::Open(
+  const OpaqueID& serial,
+  std::span<const DeviceProfile> profiles) {
+  return Open(serial, GetConfiguration(profiles));
+}
+
+FAVJoyState2 FAVJoyState2::Open(
+  Arduino&& arduino,
+  std::span<const DeviceProfile> profiles) {
+  return FAVJoyState2 {GetConfiguration(profiles), std::move(arduino)};
+}
+
+std::optional<FAVJoyState2> FAVJoyState2::Open(const Configuration& config) {
   auto a = Arduino::Open();
   if (!a) {
     return {};
   }
-  return FAVJoyState2 {deviceCount, std::move(*a)};
+  return FAVJoyState2 {config, std::move(*a)};
 }
 
 std::optional<FAVJoyState2> FAVJoyState2::Open(
   const OpaqueID& serial,
-  uint8_t deviceCount) {
+  const Configuration& config) {
   auto a = Arduino::Open(serial);
   if (!a) {
     return {};
   }
-  return FAVJoyState2 {deviceCount, std::move(*a)};
+  return FAVJoyState2 {config, std::move(*a)};
+}
+
+FAVJoyState2 FAVJoyState2::Open(
+  Arduino&& arduino,
+  const Configuration& config) {
+  return FAVJoyState2 {config, std::move(arduino)};
 }
 
 }// namespace FAVHID
\ No newline at end of file
@@ -0,0 +1,122 @@
+// Copyright 2023 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: ISC
+
+#include "favhid/Latency.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <stdexcept>
+
+namespace FAVHID {
+
+void LatencyHistogram::Add(std::chrono::microseconds latency) {
+  const auto us = static_cast<uint32_t>(
+    std::clamp<int64_t>(latency.count(), 0, UINT32_MAX));
+
+  const auto bucket = (us < 2) ? 0 : (std::bit_width(us) - 1);
+  ++mBuckets[std::min<size_t>(bucket, BUCKET_COUNT - 1)];
+
+  mMin = mCount ? std::min(mMin, us) : us;
+  mMax = mCount ? std::max(mMax, us) : us;
+  mTotal += us;
+  ++mCount;
+}
+
+void LatencyHistogram::Clear() {
+  *this = {};
+}
+
+uint64_t LatencyHistogram::GetCount() const {
+  return mCount;
+}
+
+std::chrono::microseconds LatencyHistogram::GetMin() const {
+  return std::chrono::microseconds {mMin};
+}
+
+std::chrono::microseconds LatencyHistogram::GetMax() const {
+  return std::chrono::microseconds {mMax};
+}
+
+std::chrono::microseconds LatencyHistogram::GetMean() const {
+  if (mCount == 0) {
+    return {};
+  }
+  return std::chrono::microseconds {mTotal / mCount};
+}
+
+std::chrono::microseconds LatencyHistogram::GetPercentile(
+  double percentile) const {
+  if (mCount == 0) {
+    return {};
+  }
+
+  const auto target = std::max<uint64_t>(
+    1, static_cast<uint64_t>(std::clamp(percentile, 0.0, 1.0) * mCount));
+  uint64_t seen = 0;
+  for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+    seen += mBuckets[i];
+    if (seen >= target) {
+      // Nothing in the bucket exceeds the overall maximum
+      return std::min(
+        std::chrono::microseconds {(uint64_t {2} << i) - 1}, GetMax());
+    }
+  }
+  return GetMax();
+}
+
+const LatencyHistogram::Buckets& LatencyHistogram::GetBuckets() const {
+  return mBuckets;
+}
+
+void ClockOffsetEstimator::AddSample(
+  uint32_t hostSent,
+  uint32_t deviceReceived,
+  uint32_t deviceSent,
+  uint32_t hostReceived) {
+  // All unsigned, so this is correct even if either clock wraps
+  const uint32_t hostElapsed = hostReceived - hostSent;
+  const uint32_t deviceElapsed = deviceSent - deviceReceived;
+  const uint32_t outbound = deviceReceived - hostSent;
+  const uint32_t inbound = deviceSent - hostReceived;
+
+  // Average `outbound` and `inbound` without overflowing, as both are offsets
+  // plus or minus half the round trip
+  const auto offset = outbound
+    + static_cast<uint32_t>(static_cast<int32_t>(inbound - outbound) / 2);
+
+  mSamples[mNextSample] = {
+    .offset = offset,
+    .roundTrip = (hostElapsed > deviceElapsed) ? hostElapsed - deviceElapsed
+                                               : 0,
+  };
+  mNextSample = (mNextSample + 1) % WINDOW_SIZE;
+  mSampleCount = std::min(mSampleCount + 1, WINDOW_SIZE);
+}
+
+void ClockOffsetEstimator::Clear() {
+  *this = {};
+}
+
+std::optional<uint32_t> ClockOffsetEstimator::GetOffset() const {
+  if (mSampleCount == 0) {
+    return {};
+  }
+  const auto begin = mSamples.begin();
+  return std::ranges::min_element(
+           begin,
+           begin + mSampleCount,
+           {},
+           &Sample::roundTrip)
+    ->offset;
+}
+
+uint32_t ClockOffsetEstimator::ToHostTime(uint32_t deviceTime) const {
+  const auto offset = GetOffset();
+  if (!offset) {
+    throw std::logic_error("No clock samples");
+  }
+  return deviceTime - *offset;
+}
+
+}// namespace FAVHID
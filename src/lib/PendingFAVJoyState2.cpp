@@ -0,0 +1,96 @@
+// Copyright 2023 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: ISC
+
+#include "favhid/PendingFAVJoyState2.hpp"
+
+#include <stdexcept>
+#include <utility>
+
+namespace FAVHID {
+
+PendingFAVJoyState2::PendingFAVJoyState2(
+  FAVJoyState2::Configuration config,
+  ProgressCallback progress)
+  : PendingFAVJoyState2(
+    std::move(config),
+    []() { return Arduino::Open(); },
+    std::move(progress)) {
+}
+
+PendingFAVJoyState2::PendingFAVJoyState2(
+  const OpaqueID& serial,
+  FAVJoyState2::Configuration config,
+  ProgressCallback progress)
+  : PendingFAVJoyState2(
+    std::move(config),
+    [serial]() { return Arduino::Open(serial); },
+    std::move(progress)) {
+}
+
+PendingFAVJoyState2::PendingFAVJoyState2(
+  FAVJoyState2::Configuration config,
+  OpenFunction open,
+  ProgressCallback progress)
+  : mConfiguration(std::move(config)),
+    mOpen(std::move(open)),
+    mProgress(std::move(progress)) {
+  std::packaged_task<std::optional<FAVJoyState2>(std::stop_token)> task {
+    [this](std::stop_token stop) { return Run(stop); }};
+  mResult = task.get_future();
+  mThread = std::jthread {std::move(task)};
+}
+
+PendingFAVJoyState2::~PendingFAVJoyState2() = default;
+
+PendingFAVJoyState2::Phase PendingFAVJoyState2::GetPhase() const {
+  return mPhase;
+}
+
+void PendingFAVJoyState2::Cancel() {
+  mThread.request_stop();
+}
+
+bool PendingFAVJoyState2::WaitFor(std::chrono::milliseconds timeout) const {
+  if (!mResult.valid()) {
+    throw std::logic_error("The device has already been taken");
+  }
+  return mResult.wait_for(timeout) == std::future_status::ready;
+}
+
+std::optional<FAVJoyState2> PendingFAVJoyState2::Get() {
+  if (!mResult.valid()) {
+    throw std::logic_error("The device has already been taken");
+  }
+  return mResult.get();
+}
+
+std::optional<FAVJoyState2> PendingFAVJoyState2::Run(
+  std::stop_token stopToken) {
+  Enter(Phase::Discovering);
+  auto arduino = mOpen();
+  if (!arduino || stopToken.stop_requested()) {
+    return {};
+  }
+
+  if (!FAVJoyState2::Configure(
+        *arduino,
+        mConfiguration,
+        [this](Phase phase) { Enter(phase); },
+        stopToken)) {
+    return {};
+  }
+
+  // Already configured, so this only checks the config ID
+  FAVJoyState2 ret {mConfiguration, std::move(*arduino)};
+  Enter(Phase::Ready);
+  return ret;
+}
+
+void PendingFAVJoyState2::Enter(Phase phase) {
+  mPhase = phase;
+  if (mProgress) {
+    mProgress(phase);
+  }
+}
+
+}// namespace FAVHID
@@ -0,0 +1,175 @@
+// Copyright 2023 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: ISC
+
+#include "favhid/Profile.hpp"
+
+#include "favhid/descriptors.hpp"
+
+namespace FAVHID {
+
+namespace {
+
+using namespace FAVHID::Descriptors;
+
+constexpr uint8_t STANDARD_AXIS_USAGES[DeviceProfile::MAX_STANDARD_AXES] {
+  0x30,// X
+  0x31,// Y
+  0x32,// Z
+  0x33,// Rx
+  0x34,// Ry
+  0x35,// Rz
+  0x36,// Slider
+  0x36,// Slider
+};
+
+constexpr uint8_t VELOCITY_AXIS_USAGES[DeviceProfile::EXTRA_AXES_PER_GROUP] {
+  0x40,// Vx
+  0x41,// Vy
+  0x42,// Vz
+  0x43,// Vbrx
+  0x44,// Vbry
+  0x45,// Vbrz
+};
+
+// Acceleration and force axes are X, Y, Z or Rx, Ry, Rz with units
+constexpr uint8_t LINEAR_AXIS_USAGE = 0x30;
+constexpr uint8_t ANGULAR_AXIS_USAGE = 0x33;
+
+// SI linear, length^1, time^-2: m/s^2
+constexpr uint16_t LINEAR_ACCELERATION_UNIT = 0xe011;
+// SI rotation, length (radians)^1, time^-2: rad/s^2
+constexpr uint16_t ANGULAR_ACCELERATION_UNIT = 0xe012;
+// SI linear, length^1, mass^1, time^-2: N
+constexpr uint16_t FORCE_UNIT = 0xe111;
+// SI linear, length^2, mass^1, time^-2: N*m
+constexpr uint16_t TORQUE_UNIT = 0xe121;
+
+void AppendAxisRange(Dynamic::Collection::Physical& c, const DeviceProfile& p) {
+  if (p.axisBits == 8) {
+    c.append(LogicalMinimum<int8_t> {}, LogicalMaximum<int8_t> {});
+  } else {
+    c.append(LogicalMinimum<int16_t> {}, LogicalMaximum<int16_t> {});
+  }
+}
+
+// 3 axes starting at `firstUsage`, in their own main item so they can have
+// a unit
+void AppendUnitAxes(
+  Dynamic::Collection::Physical& c,
+  const DeviceProfile& p,
+  uint8_t firstUsage,
+  uint16_t unit) {
+  c.append(Unit {unit});
+  for (uint8_t i = 0; i < 3; ++i) {
+    c.append(Usage::Usage {static_cast<uint8_t>(firstUsage + i)});
+  }
+  c.append(ReportSize {p.axisBits}, ReportCount {uint8_t {3}});
+  AppendAxisRange(c, p);
+  c.append(Input::DataVariableAbsolute);
+}
+
+void AppendAxes(Dynamic::Collection::Physical& c, const DeviceProfile& p) {
+  if (p.GetTotalAxisCount() == 0) {
+    return;
+  }
+
+  c.append(UsagePage::GenericDesktop);
+
+  const bool hasVelocity = p.HasExtraAxes(ExtraAxes::Velocity);
+  const uint8_t unitlessCount
+    = p.axisCount + (hasVelocity ? DeviceProfile::EXTRA_AXES_PER_GROUP : 0);
+  if (unitlessCount) {
+    for (uint8_t i = 0; i < p.axisCount; ++i) {
+      c.append(Usage::Usage {STANDARD_AXIS_USAGES[i]});
+    }
+    if (hasVelocity) {
+      for (const auto usage: VELOCITY_AXIS_USAGES) {
+        c.append(Usage::Usage {usage});
+      }
+    }
+    c.append(ReportSize {p.axisBits}, ReportCount {unitlessCount});
+    AppendAxisRange(c, p);
+    c.append(Input::DataVariableAbsolute);
+  }
+
+  const bool hasAcceleration = p.HasExtraAxes(ExtraAxes::Acceleration);
+  if (hasAcceleration) {
+    AppendUnitAxes(c, p, LINEAR_AXIS_USAGE, LINEAR_ACCELERATION_UNIT);
+    AppendUnitAxes(c, p, ANGULAR_AXIS_USAGE, ANGULAR_ACCELERATION_UNIT);
+  }
+  const bool hasForce = p.HasExtraAxes(ExtraAxes::Force);
+  if (hasForce) {
+    AppendUnitAxes(c, p, LINEAR_AXIS_USAGE, FORCE_UNIT);
+    AppendUnitAxes(c, p, ANGULAR_AXIS_USAGE, TORQUE_UNIT);
+  }
+  // Units are global, so would otherwise apply to the hats
+  if (hasAcceleration || hasForce) {
+    c.append(Unit {uint8_t {0}});
+  }
+}
+
+void AppendHats(Dynamic::Collection::Physical& c, const DeviceProfile& p) {
+  if (p.hatCount == 0) {
+    return;
+  }
+
+  if (p.GetTotalAxisCount() == 0) {
+    c.append(UsagePage::GenericDesktop);
+  }
+  for (uint8_t i = 0; i < p.hatCount; ++i) {
+    c.append(Usage::HatSwitch);
+  }
+  c.append(
+    LogicalMinimum {0},
+    LogicalMaximum {7},
+    ReportSize {4},
+    ReportCount {p.hatCount},
+    Input::DataVariableAbsoluteNullState);
+
+  if (p.hatCount % 2) {
+    c.append(ReportSize {4}, ReportCount {1}, Input::Padding);
+  }
+}
+
+void AppendButtons(Dynamic::Collection::Physical& c, const DeviceProfile& p) {
+  if (p.buttonCount == 0) {
+    return;
+  }
+
+  c.append(
+    UsagePage::Button,
+    UsageMinimum {1},
+    UsageMaximum {p.buttonCount},
+    LogicalMinimum {0},
+    LogicalMaximum {1},
+    ReportSize {1},
+    ReportCount {p.buttonCount},
+    Input::DataVariableAbsolute);
+
+  const uint8_t padding = (8 - (p.buttonCount % 8)) % 8;
+  if (padding) {
+    c.append(ReportSize {1}, ReportCount {padding}, Input::Padding);
+  }
+}
+
+}// namespace
+
+std::string DeviceProfile::GetDescriptor(uint8_t reportID) const {
+  if (!IsValid()) {
+    throw std::logic_error("Invalid device profile");
+  }
+
+  Dynamic::Collection::Physical physical {ReportID {reportID}};
+  AppendAxes(physical, *this);
+  AppendHats(physical, *this);
+  AppendButtons(physical, *this);
+
+  const Dynamic::Descriptor descriptor {
+    UsagePage::GenericDesktop,
+    Usage::Joystick,
+    Dynamic::Collection::Application {physical},
+  };
+  return {reinterpret_cast<const char*>(descriptor.data()), descriptor.size()};
+}
+
+}// namespace FAVHID
@@ -0,0 +1,206 @@
+// Copyright 2023 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: ISC
+
+#include "favhid/Recording.hpp"
+
+#include "favhid/Arduino.hpp"
+
+#include <limits>
+#include <stdexcept>
+#include <thread>
+
+namespace FAVHID {
+
+Recorder::Recorder(std::wstring_view path, size_t bufferSize)
+  : mBufferSize(bufferSize), mStartTime(std::chrono::steady_clock::now()) {
+  const std::wstring pathString {path};
+  mFile.attach(CreateFileW(
+    pathString.c_str(),
+    GENERIC_WRITE,
+    FILE_SHARE_READ,
+    nullptr,
+    CREATE_ALWAYS,
+    FILE_ATTRIBUTE_NORMAL,
+    NULL));
+  if (!mFile) {
+    winrt::throw_last_error();
+  }
+
+  mBuffer.reserve(mBufferSize);
+
+  RecordingFileHeader header {.version = RecordingFileHeader::CURRENT_VERSION};
+  memcpy(header.magic, RecordingFileHeader::MAGIC, sizeof(header.magic));
+  mBuffer.append(reinterpret_cast<const char*>(&header), sizeof(header));
+}
+
+Recorder::~Recorder() {
+  try {
+    Flush();
+  } catch (...) {
+  }
+}
+
+void Recorder::RecordDescriptor(const void* descriptor, size_t size) {
+  Append(MessageType::PushDescriptor, 0, descriptor, size);
+}
+
+void Recorder::RecordReport(uint8_t reportID, const void* report, size_t size) {
+  Append(MessageType::Report, reportID, report, size);
+}
+
+void Recorder::Append(
+  MessageType type,
+  uint8_t reportID,
+  const void* data,
+  size_t size) {
+  if (size > std::numeric_limits<uint16_t>::max()) {
+    throw std::logic_error("Frame is too large to record");
+  }
+
+  const RecordedFrameHeader header {
+    .timestampUS = static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - mStartTime)
+        .count()),
+    .type = type,
+    .reportID = reportID,
+    .size = static_cast<uint16_t>(size),
+  };
+
+  if (mBuffer.size() + sizeof(header) + size > mBufferSize) {
+    Flush();
+  }
+  mBuffer.append(reinterpret_cast<const char*>(&header), sizeof(header));
+  mBuffer.append(static_cast<const char*>(data), size);
+}
+
+void Recorder::Flush() {
+  if (mBuffer.empty()) {
+    return;
+  }
+  DWORD written {};
+  winrt::check_bool(WriteFile(
+    mFile.get(),
+    mBuffer.data(),
+    static_cast<DWORD>(mBuffer.size()),
+    &written,
+    nullptr));
+  mBuffer.clear();
+}
+
+Replayer::Replayer(std::wstring_view path) {
+  const std::wstring pathString {path};
+  mFile.attach(CreateFileW(
+    pathString.c_str(),
+    GENERIC_READ,
+    FILE_SHARE_READ | FILE_SHARE_WRITE,
+    nullptr,
+    OPEN_EXISTING,
+    FILE_ATTRIBUTE_NORMAL,
+    NULL));
+  if (!mFile) {
+    winrt::throw_last_error();
+  }
+
+  LARGE_INTEGER fileSize {};
+  winrt::check_bool(GetFileSizeEx(mFile.get(), &fileSize));
+  mSize = static_cast<size_t>(fileSize.QuadPart);
+  if (mSize < sizeof(RecordingFileHeader)) {
+    throw std::runtime_error("Recording is too small");
+  }
+
+  mMapping.attach(
+    CreateFileMappingW(mFile.get(), nullptr, PAGE_READONLY, 0, 0, nullptr));
+  if (!mMapping) {
+    winrt::throw_last_error();
+  }
+  mView = static_cast<const uint8_t*>(
+    MapViewOfFile(mMapping.get(), FILE_MAP_READ, 0, 0, 0));
+  if (!mView) {
+    winrt::throw_last_error();
+  }
+
+  const auto header = reinterpret_cast<const RecordingFileHeader*>(mView);
+  if (
+    memcmp(header->magic, RecordingFileHeader::MAGIC, sizeof(header->magic))
+      != 0
+    || header->version != RecordingFileHeader::CURRENT_VERSION) {
+    UnmapViewOfFile(mView);
+    throw std::runtime_error("Not a FAVHID recording, or unsupported version");
+  }
+}
+
+Replayer::~Replayer() {
+  if (mView) {
+    UnmapViewOfFile(mView);
+  }
+}
+
+void Replayer::ForEachFrame(
+  const std::function<void(const Frame&)>& callback) const {
+  size_t offset = sizeof(RecordingFileHeader);
+  while (offset + sizeof(RecordedFrameHeader) <= mSize) {
+    RecordedFrameHeader header;
+    memcpy(&header, mView + offset, sizeof(header));
+    offset += sizeof(header);
+    if (offset + header.size > mSize) {
+      return;
+    }
+
+    callback({
+      .timestamp = std::chrono::microseconds {header.timestampUS},
+      .type = header.type,
+      .reportID = header.reportID,
+      .data = {mView + offset, header.size},
+    });
+    offset += header.size;
+  }
+}
+
+Replayer::Result
+Replayer::Replay(Arduino& arduino, Timing timing, std::stop_token stopToken)
+  const {
+  Result result;
+  const auto start = std::chrono::steady_clock::now();
+  // Each recording session restarts timestamps at 0, so keep them
+  // monotonic across appended sessions
+  std::chrono::microseconds previous {};
+  std::chrono::microseconds base {};
+
+  ForEachFrame([&](const Frame& frame) {
+    if (stopToken.stop_requested()) {
+      return;
+    }
+
+    if (frame.timestamp < previous) {
+      base += previous;
+    }
+    previous = frame.timestamp;
+    if (timing == Timing::Original) {
+      std::this_thread::sleep_until(start + base + frame.timestamp);
+    }
+
+    Response response;
+    switch (frame.type) {
+      case MessageType::PushDescriptor:
+        response = arduino.PushDescriptor(frame.data.data(), frame.data.size());
+        break;
+      case MessageType::Report:
+        response = arduino.WriteReport(
+          frame.reportID, frame.data.data(), frame.data.size());
+        break;
+      default:
+        response = {MessageType::Response_UnhandledRequest};
+        break;
+    }
+
+    ++result.frameCount;
+    if (!response.IsOK()) {
+      ++result.failureCount;
+    }
+  });
+
+  return result;
+}
+
+}// namespace FAVHID
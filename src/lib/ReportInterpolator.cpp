@@ -0,0 +1,147 @@
+// Copyright 2023 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: ISC
+
+#include "favhid/ReportInterpolator.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+namespace FAVHID {
+
+namespace {
+
+static_assert(offsetof(FAVJoyState2Report, slider) == 6 * sizeof(int16_t));
+
+std::array<int16_t, 8> ReadAxes(const FAVJoyState2Report& report) {
+  std::array<int16_t, 8> ret;
+  memcpy(ret.data(), &report.x, sizeof(ret));
+  return ret;
+}
+
+}// namespace
+
+ReportInterpolator::ReportInterpolator(
+  uint8_t deviceCount,
+  Mode mode,
+  std::chrono::microseconds maxInterval,
+  std::chrono::microseconds maxExtrapolation)
+  : mMode(mode),
+    mMaxInterval(maxInterval),
+    mMaxExtrapolation(maxExtrapolation),
+    mDevices(deviceCount) {
+  if (deviceCount == 0) {
+    throw std::logic_error("At least one device is required");
+  }
+}
+
+size_t ReportInterpolator::GetDeviceCount() const {
+  return mDevices.size();
+}
+
+void ReportInterpolator::Submit(
+  const FAVJoyState2Report& report,
+  uint8_t deviceIndex,
+  Clock::time_point now) {
+  if (deviceIndex >= mDevices.size()) {
+    throw std::logic_error("Device index is >= device count");
+  }
+  std::unique_lock lock(mMutex);
+  auto& device = mDevices[deviceIndex];
+  const auto axes = ReadAxes(report);
+  const auto interval = now - device.latestAt;
+
+  if (
+    !device.hasLatest || interval <= Clock::duration::zero()
+    || interval > mMaxInterval) {
+    // Jump straight to the new axes
+    device.from = axes;
+    device.fromTime = now;
+    device.toTime = now;
+  } else if (mMode == Mode::Interpolate) {
+    // Start from wherever the output is now, so that it doesn't jump
+    device.from = GetAxes(device, now);
+    device.fromTime = now;
+    device.toTime = now + interval;
+  } else {
+    device.from = ReadAxes(device.latest);
+    device.fromTime = device.latestAt;
+    device.toTime = now;
+  }
+  device.to = axes;
+
+  device.latest = report;
+  device.latestAt = now;
+  device.hasLatest = true;
+}
+
+ReportInterpolator::Axes ReportInterpolator::GetAxes(
+  const Device& device,
+  Clock::time_point now) const {
+  const auto duration = device.toTime - device.fromTime;
+  if (duration <= Clock::duration::zero()) {
+    return device.to;
+  }
+
+  auto elapsed = std::clamp(now, device.fromTime, device.toTime)
+    - device.fromTime;
+  if (mMode == Mode::Extrapolate && now > device.toTime) {
+    // Overshoot for up to `mMaxExtrapolation`, then come back to `to` over
+    // the same time, instead of holding a value that was never reported
+    const auto maxExtrapolation
+      = std::chrono::duration_cast<Clock::duration>(mMaxExtrapolation);
+    const auto extrapolated = now - device.toTime;
+    elapsed += (extrapolated <= maxExtrapolation)
+      ? extrapolated
+      : std::max(
+        Clock::duration::zero(), (2 * maxExtrapolation) - extrapolated);
+  }
+  const auto fraction = static_cast<double>(elapsed.count())
+    / static_cast<double>(duration.count());
+
+  Axes ret;
+  for (size_t i = 0; i < AXIS_COUNT; ++i) {
+    const auto from = static_cast<double>(device.from[i]);
+    const auto value = from + ((device.to[i] - from) * fraction);
+    ret[i] = static_cast<int16_t>(std::clamp<double>(
+      std::round(value),
+      std::numeric_limits<int16_t>::min(),
+      std::numeric_limits<int16_t>::max()));
+  }
+  return ret;
+}
+
+FAVJoyState2Report ReportInterpolator::Sample(
+  uint8_t deviceIndex,
+  Clock::time_point now) const {
+  if (deviceIndex >= mDevices.size()) {
+    throw std::logic_error("Device index is >= device count");
+  }
+  std::unique_lock lock(mMutex);
+  return GetReport(mDevices[deviceIndex], now);
+}
+
+void ReportInterpolator::Sample(
+  std::span<FAVJoyState2Report> reports,
+  Clock::time_point now) const {
+  if (reports.size() > mDevices.size()) {
+    throw std::logic_error("More reports than devices");
+  }
+  std::unique_lock lock(mMutex);
+  for (uint8_t i = 0; i < reports.size(); ++i) {
+    reports[i] = GetReport(mDevices[i], now);
+  }
+}
+
+FAVJoyState2Report ReportInterpolator::GetReport(
+  const Device& device,
+  Clock::time_point now) const {
+  auto ret = device.latest;
+  ret.SetAxes(GetAxes(device, now));
+  return ret;
+}
+
+}// namespace FAVHID
@@ -0,0 +1,110 @@
+// Copyright 2023 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: ISC
+
+#include "favhid/ReportScheduler.hpp"
+
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+
+namespace FAVHID {
+
+namespace {
+
+constexpr auto AXES_SIZE = offsetof(FAVJoyState2Report, povs);
+
+bool EdgesDiffer(const FAVJoyState2Report& a, const FAVJoyState2Report& b) {
+  const auto aBytes = reinterpret_cast<const uint8_t*>(&a);
+  const auto bBytes = reinterpret_cast<const uint8_t*>(&b);
+  return memcmp(
+           aBytes + AXES_SIZE, bBytes + AXES_SIZE, sizeof(a) - AXES_SIZE)
+    != 0;
+}
+
+bool AxesDiffer(const FAVJoyState2Report& a, const FAVJoyState2Report& b) {
+  return memcmp(&a, &b, AXES_SIZE) != 0;
+}
+
+}// namespace
+
+ReportScheduler::ReportScheduler(
+  uint8_t deviceCount,
+  std::chrono::microseconds minimumPulseWidth)
+  : mMinimumPulseWidth(minimumPulseWidth), mDevices(deviceCount) {
+  if (deviceCount == 0) {
+    throw std::logic_error("At least one device is required");
+  }
+}
+
+void ReportScheduler::Submit(
+  const FAVJoyState2Report& report,
+  uint8_t deviceIndex) {
+  if (deviceIndex >= mDevices.size()) {
+    throw std::logic_error("Device index is >= device count");
+  }
+  std::unique_lock lock(mMutex);
+  auto& device = mDevices[deviceIndex];
+  device.submitted = report;
+  for (size_t i = 0; i < sizeof(device.latched); ++i) {
+    device.latched[i] |= report.buttons[i];
+  }
+}
+
+FAVJoyState2Report ReportScheduler::GetReportToSend(
+  const Device& device,
+  Clock::time_point now) const {
+  auto report = device.submitted;
+  for (size_t i = 0; i < sizeof(report.buttons); ++i) {
+    report.buttons[i] |= device.latched[i];
+
+    // Hold presses that haven't been sent for long enough
+    const uint8_t released = device.sent.buttons[i] & ~report.buttons[i];
+    if (released == 0 || mMinimumPulseWidth.count() == 0) {
+      continue;
+    }
+    for (uint8_t bit = 0; bit < 8; ++bit) {
+      const uint8_t mask = 1 << bit;
+      if (
+        (released & mask)
+        && now < device.pressSentAt[(i * 8) + bit] + mMinimumPulseWidth) {
+        report.buttons[i] |= mask;
+      }
+    }
+  }
+  return report;
+}
+
+std::optional<ReportScheduler::Pending> ReportScheduler::Next(
+  Clock::time_point now) {
+  std::unique_lock lock(mMutex);
+  for (const auto lane: {Lane::Edge, Lane::Axis}) {
+    auto& first = mNextDevice[static_cast<size_t>(lane)];
+    for (size_t offset = 0; offset < mDevices.size(); ++offset) {
+      const auto i = (first + offset) % mDevices.size();
+      auto& device = mDevices[i];
+      const auto report = GetReportToSend(device, now);
+      const auto changed = (lane == Lane::Edge)
+        ? EdgesDiffer(report, device.sent)
+        : AxesDiffer(report, device.sent);
+      if (!changed) {
+        continue;
+      }
+
+      first = i + 1;
+      for (size_t j = 0; j < sizeof(report.buttons); ++j) {
+        const uint8_t pressed = report.buttons[j] & ~device.sent.buttons[j];
+        for (uint8_t bit = 0; bit < 8; ++bit) {
+          if (pressed & (1 << bit)) {
+            device.pressSentAt[(j * 8) + bit] = now;
+          }
+        }
+      }
+      memset(device.latched, 0, sizeof(device.latched));
+      device.sent = report;
+      return Pending {static_cast<uint8_t>(i), lane, report};
+    }
+  }
+  return {};
+}
+
+}// namespace FAVHID
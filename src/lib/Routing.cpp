@@ -0,0 +1,207 @@
+// Copyright 2023 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: ISC
+
+#include "favhid/Routing.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+namespace FAVHID {
+
+namespace {
+
+constexpr uint8_t AXIS_COUNT = 8;
+constexpr uint8_t BUTTON_COUNT = 128;
+constexpr uint8_t HAT_COUNT = 4;
+
+void WriteAxis(uint8_t* out, int32_t value) {
+  const auto clamped = static_cast<int16_t>(std::clamp<int32_t>(
+    value,
+    std::numeric_limits<int16_t>::min(),
+    std::numeric_limits<int16_t>::max()));
+  memcpy(out, &clamped, sizeof(clamped));
+}
+
+// Map [0, INT16_MAX] to [-INT16_MAX, INT16_MAX]
+int32_t ExpandHalf(int32_t value) {
+  const auto half = std::clamp<int32_t>(value, 0, INT16_MAX);
+  return (half * 2) - INT16_MAX;
+}
+
+}// namespace
+
+size_t RoutingTable::GetDeviceCount() const {
+  return mDeviceCount;
+}
+
+void RoutingTable::Evaluate(
+  const RoutingInput& input,
+  std::span<FAVJoyState2Report> reports) const {
+  // Check once, so that instructions don't need to
+  if (
+    reports.size() < mDeviceCount || input.axes.size() < mMinAxes
+    || input.buttons.size() < mMinButtons || input.hats.size() < mMinHats) {
+    throw std::logic_error("Not enough inputs or reports for the routing");
+  }
+
+  for (auto& report: reports.first(mDeviceCount)) {
+    report = {};
+  }
+
+  const auto axes = input.axes.data();
+  const auto buttons = input.buttons.data();
+  const auto hats = input.hats.data();
+  const auto out = reinterpret_cast<uint8_t*>(reports.data());
+
+  for (const auto& it: mInstructions) {
+    const auto dest = out + it.offset;
+    switch (it.op) {
+      case Opcode::CopyAxis:
+        WriteAxis(dest, axes[it.sources[0]]);
+        break;
+      case Opcode::InvertAxis:
+        WriteAxis(dest, -static_cast<int32_t>(axes[it.sources[0]]));
+        break;
+      case Opcode::PositiveHalfAxis:
+        WriteAxis(dest, ExpandHalf(axes[it.sources[0]]));
+        break;
+      case Opcode::NegativeHalfAxis:
+        WriteAxis(dest, ExpandHalf(-static_cast<int32_t>(axes[it.sources[0]])));
+        break;
+      case Opcode::OrButton:
+        *dest |= buttons[it.sources[0]] ? it.bits : 0;
+        break;
+      case Opcode::CopyHat:
+        *dest = (*dest & ~(0b1111 << it.bits))
+          | ((hats[it.sources[0]] & 0b1111) << it.bits);
+        break;
+      case Opcode::HatFromButtons: {
+        const auto& [up, right, down, left] = it.sources;
+        const auto x = static_cast<int8_t>(
+          (buttons[right] ? 1 : 0) - (buttons[left] ? 1 : 0));
+        const auto y = static_cast<int8_t>(
+          (buttons[down] ? 1 : 0) - (buttons[up] ? 1 : 0));
+        *dest = (*dest & ~(0b1111 << it.bits))
+          | (FAVJoyState2Report::GetPOVValue(x, y) << it.bits);
+        break;
+      }
+    }
+  }
+}
+
+RoutingBuilder&
+RoutingBuilder::Axis(uint32_t inputAxis, Output output, bool invert) {
+  Add(
+    invert ? RoutingTable::Opcode::InvertAxis : RoutingTable::Opcode::CopyAxis,
+    output,
+    {inputAxis});
+  return *this;
+}
+
+RoutingBuilder&
+RoutingBuilder::Axis(uint32_t inputAxis, AxisHalf half, Output output) {
+  Add(
+    half == AxisHalf::Positive ? RoutingTable::Opcode::PositiveHalfAxis
+                               : RoutingTable::Opcode::NegativeHalfAxis,
+    output,
+    {inputAxis});
+  return *this;
+}
+
+RoutingBuilder& RoutingBuilder::Button(uint32_t inputButton, Output output) {
+  Add(RoutingTable::Opcode::OrButton, output, {inputButton});
+  return *this;
+}
+
+RoutingBuilder& RoutingBuilder::Hat(uint32_t inputHat, Output output) {
+  Add(RoutingTable::Opcode::CopyHat, output, {inputHat});
+  return *this;
+}
+
+RoutingBuilder& RoutingBuilder::HatFromButtons(
+  const HatButtons& inputs,
+  Output output) {
+  Add(
+    RoutingTable::Opcode::HatFromButtons,
+    output,
+    {inputs.up, inputs.right, inputs.down, inputs.left});
+  return *this;
+}
+
+void RoutingBuilder::Add(
+  RoutingTable::Opcode op,
+  Output output,
+  std::initializer_list<uint32_t> sources) {
+  using Opcode = RoutingTable::Opcode;
+  constexpr auto REPORT_SIZE = sizeof(FAVJoyState2Report);
+  static_assert(REPORT_SIZE * 0x100 <= std::numeric_limits<uint16_t>::max());
+
+  RoutingTable::Instruction it {.op = op};
+  std::ranges::copy(sources, it.sources);
+  const size_t reportOffset = output.device * REPORT_SIZE;
+  const auto maxSource = std::ranges::max(sources);
+
+  switch (op) {
+    case Opcode::CopyAxis:
+    case Opcode::InvertAxis:
+    case Opcode::PositiveHalfAxis:
+    case Opcode::NegativeHalfAxis:
+      if (output.index >= AXIS_COUNT) {
+        throw std::logic_error("axis index out of range");
+      }
+      it.offset = static_cast<uint16_t>(
+        reportOffset + offsetof(FAVJoyState2Report, x)
+        + (output.index * sizeof(int16_t)));
+      mMinAxes = std::max<size_t>(mMinAxes, maxSource + 1);
+      break;
+    case Opcode::OrButton:
+      if (output.index >= BUTTON_COUNT) {
+        throw std::logic_error("button index out of range");
+      }
+      it.offset = static_cast<uint16_t>(
+        reportOffset + offsetof(FAVJoyState2Report, buttons)
+        + (output.index / 8));
+      it.bits = static_cast<uint8_t>(1 << (output.index % 8));
+      mMinButtons = std::max<size_t>(mMinButtons, maxSource + 1);
+      break;
+    case Opcode::CopyHat:
+    case Opcode::HatFromButtons:
+      if (output.index >= HAT_COUNT) {
+        throw std::logic_error("hat index out of range");
+      }
+      // Same layout as `FAVJoyState2Report::SetPOV()`
+      it.offset = static_cast<uint16_t>(
+        reportOffset + offsetof(FAVJoyState2Report, povs) + 1
+        - (output.index / 2));
+      it.bits = static_cast<uint8_t>(4 - (4 * (output.index % 2)));
+      if (op == Opcode::CopyHat) {
+        mMinHats = std::max<size_t>(mMinHats, maxSource + 1);
+      } else {
+        mMinButtons = std::max<size_t>(mMinButtons, maxSource + 1);
+      }
+      break;
+  }
+
+  mDeviceCount = std::max<size_t>(mDeviceCount, output.device + 1);
+  mInstructions.push_back(it);
+}
+
+RoutingTable RoutingBuilder::Compile() const {
+  RoutingTable ret;
+  ret.mInstructions = mInstructions;
+  ret.mDeviceCount = mDeviceCount;
+  ret.mMinAxes = mMinAxes;
+  ret.mMinButtons = mMinButtons;
+  ret.mMinHats = mMinHats;
+
+  // Walk the output buffer in order; stable, so that later axis and hat
+  // mappings still replace earlier ones
+  std::ranges::stable_sort(
+    ret.mInstructions, {}, &RoutingTable::Instruction::offset);
+  return ret;
+}
+
+}// namespace FAVHID
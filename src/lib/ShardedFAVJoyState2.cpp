@@ -0,0 +1,193 @@
+// Copyright 2023 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: ISC
+
+#include "favhid/ShardedFAVJoyState2.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <future>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+namespace FAVHID {
+
+struct ShardedFAVJoyState2::Shared {
+  std::vector<FAVJoyState2> boards;
+  // The global index of each board's first device
+  std::vector<size_t> firstDevices;
+
+  std::mutex mutex;
+  std::condition_variable_any workCV;
+  std::condition_variable doneCV;
+  // Incremented for each `WriteReports()` call
+  uint64_t generation {};
+  size_t remaining {};
+  std::span<const Report> reports;
+  std::exception_ptr error;
+
+  // One per board except the first, which is written by the calling thread.
+  // Last, so that they're stopped before anything they use is destroyed.
+  std::vector<std::jthread> workers;
+
+  void WriteBoard(size_t board, std::span<const Report> all);
+  void RunWorker(size_t board, std::stop_token);
+};
+
+void ShardedFAVJoyState2::Shared::WriteBoard(
+  size_t board,
+  std::span<const Report> all) {
+  const auto first = firstDevices[board];
+  if (first >= all.size()) {
+    return;
+  }
+  const auto count = std::min<size_t>(
+    boards[board].GetDeviceCount(), all.size() - first);
+  boards[board].WriteReports(all.subspan(first, count));
+}
+
+void ShardedFAVJoyState2::Shared::RunWorker(
+  size_t board,
+  std::stop_token stopToken) {
+  uint64_t done = 0;
+  while (true) {
+    std::span<const Report> pending;
+    {
+      std::unique_lock lock(mutex);
+      if (!workCV.wait(
+            lock, stopToken, [&] { return generation != done; })) {
+        return;
+      }
+      done = generation;
+      pending = reports;
+    }
+
+    std::exception_ptr boardError;
+    try {
+      WriteBoard(board, pending);
+    } catch (...) {
+      boardError = std::current_exception();
+    }
+
+    std::unique_lock lock(mutex);
+    if (boardError && !error) {
+      error = boardError;
+    }
+    if (--remaining == 0) {
+      doneCV.notify_one();
+    }
+  }
+}
+
+std::optional<ShardedFAVJoyState2> ShardedFAVJoyState2::Open(
+  std::span<const OpaqueID> serials,
+  uint8_t devicesPerBoard) {
+  if (serials.empty()) {
+    throw std::logic_error("At least one board is required");
+  }
+
+  // Configuring a board waits for it to reset, so do them all at once
+  std::vector<std::future<std::optional<FAVJoyState2>>> pending;
+  for (const auto& serial: serials) {
+    pending.push_back(std::async(std::launch::async, [serial, devicesPerBoard]() {
+      return FAVJoyState2::Open(serial, devicesPerBoard);
+    }));
+  }
+
+  std::vector<FAVJoyState2> boards;
+  bool allOpened = true;
+  for (auto& it: pending) {
+    auto board = it.get();
+    if (board) {
+      boards.push_back(std::move(*board));
+    } else {
+      allOpened = false;
+    }
+  }
+  if (!allOpened) {
+    return {};
+  }
+  return ShardedFAVJoyState2 {std::move(boards)};
+}
+
+ShardedFAVJoyState2::ShardedFAVJoyState2(std::vector<FAVJoyState2>&& boards)
+  : mShared(std::make_unique<Shared>()) {
+  if (boards.empty()) {
+    throw std::logic_error("At least one board is required");
+  }
+
+  mShared->boards = std::move(boards);
+  for (size_t board = 0; board < mShared->boards.size(); ++board) {
+    mShared->firstDevices.push_back(mLocations.size());
+    const auto count = mShared->boards[board].GetDeviceCount();
+    for (uint8_t i = 0; i < count; ++i) {
+      mLocations.push_back({board, i});
+    }
+  }
+
+  for (size_t board = 1; board < mShared->boards.size(); ++board) {
+    mShared->workers.emplace_back(
+      [shared = mShared.get(), board](std::stop_token stopToken) {
+        shared->RunWorker(board, stopToken);
+      });
+  }
+}
+
+ShardedFAVJoyState2::~ShardedFAVJoyState2() = default;
+ShardedFAVJoyState2::ShardedFAVJoyState2(ShardedFAVJoyState2&&) noexcept
+  = default;
+ShardedFAVJoyState2& ShardedFAVJoyState2::operator=(
+  ShardedFAVJoyState2&&) noexcept
+  = default;
+
+size_t ShardedFAVJoyState2::GetDeviceCount() const {
+  return mLocations.size();
+}
+
+ShardedFAVJoyState2::Location ShardedFAVJoyState2::GetLocation(
+  size_t deviceIndex) const {
+  if (deviceIndex >= mLocations.size()) {
+    throw std::logic_error("Device index is >= device count");
+  }
+  return mLocations[deviceIndex];
+}
+
+void ShardedFAVJoyState2::WriteReport(const Report& report, size_t deviceIndex) {
+  const auto [board, localIndex] = GetLocation(deviceIndex);
+  mShared->boards[board].WriteReport(report, localIndex);
+}
+
+void ShardedFAVJoyState2::WriteReports(std::span<const Report> reports) {
+  if (reports.size() > mLocations.size()) {
+    throw std::logic_error("More reports than devices");
+  }
+
+  auto& shared = *mShared;
+  {
+    std::unique_lock lock(shared.mutex);
+    shared.reports = reports;
+    shared.error = {};
+    shared.remaining = shared.workers.size();
+    ++shared.generation;
+  }
+  shared.workCV.notify_all();
+
+  std::exception_ptr firstBoardError;
+  try {
+    shared.WriteBoard(0, reports);
+  } catch (...) {
+    firstBoardError = std::current_exception();
+  }
+
+  std::unique_lock lock(shared.mutex);
+  shared.doneCV.wait(lock, [&shared] { return shared.remaining == 0; });
+  if (firstBoardError) {
+    std::rethrow_exception(firstBoardError);
+  }
+  if (shared.error) {
+    std::rethrow_exception(shared.error);
+  }
+}
+
+}// namespace FAVHID
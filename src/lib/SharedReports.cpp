@@ -0,0 +1,269 @@
+// Copyright 2023 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: ISC
+
+#include "favhid/SharedReports.hpp"
+
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <thread>
+
+namespace FAVHID {
+
+SharedReportSlot::SharedReportSlot() : mSequence(0) {
+  StoreWords({});
+}
+
+void SharedReportSlot::StoreWords(const FAVJoyState2Report& report) {
+  uint32_t words[WORD_COUNT] {};
+  memcpy(words, &report, sizeof(report));
+  for (size_t i = 0; i < WORD_COUNT; ++i) {
+    mWords[i].store(words[i], std::memory_order_relaxed);
+  }
+}
+
+uint32_t SharedReportSlot::Claim() {
+  auto sequence = mSequence.load(std::memory_order_relaxed);
+  do {
+    while (sequence & 1) {
+      sequence = mSequence.load(std::memory_order_relaxed);
+    }
+  } while (!mSequence.compare_exchange_weak(
+    sequence,
+    sequence + 1,
+    std::memory_order_acquire,
+    std::memory_order_relaxed));
+  // Readers must not see the new words without the odd sequence
+  std::atomic_thread_fence(std::memory_order_release);
+  return sequence + 1;
+}
+
+void SharedReportSlot::Write(const FAVJoyState2Report& report) {
+  const auto sequence = Claim();
+  StoreWords(report);
+  mSequence.store(sequence + 1, std::memory_order_release);
+}
+
+std::optional<uint32_t> SharedReportSlot::Read(
+  FAVJoyState2Report* report,
+  size_t maxAttempts) const {
+  uint32_t words[WORD_COUNT];
+  for (size_t attempt = 0; attempt < maxAttempts; ++attempt) {
+    const auto before = mSequence.load(std::memory_order_acquire);
+    if (before & 1) {
+      continue;
+    }
+    for (size_t i = 0; i < WORD_COUNT; ++i) {
+      words[i] = mWords[i].load(std::memory_order_relaxed);
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (mSequence.load(std::memory_order_relaxed) == before) {
+      memcpy(report, words, sizeof(*report));
+      return before;
+    }
+  }
+  return std::nullopt;
+}
+
+uint32_t SharedReportSlot::GetSequence() const {
+  return mSequence.load(std::memory_order_acquire);
+}
+
+bool SharedReportSlot::Reclaim(
+  uint32_t abandonedSequence,
+  const FAVJoyState2Report& report) {
+  if (!(abandonedSequence & 1)) {
+    throw std::logic_error("Only odd sequences can be abandoned");
+  }
+  if (mSequence.load(std::memory_order_acquire) != abandonedSequence) {
+    return false;
+  }
+  // Other writers are spinning until the sequence is even, and readers
+  // discard anything they copy while it's odd
+  StoreWords(report);
+  return mSequence.compare_exchange_strong(
+    abandonedSequence,
+    abandonedSequence + 1,
+    std::memory_order_release,
+    std::memory_order_relaxed);
+}
+
+SharedReportServer::SharedReportServer(
+  FAVJoyState2&& device,
+  std::wstring_view name)
+  : mDevice(std::move(device)) {
+  const auto count = mDevice.GetDeviceCount();
+  for (uint8_t i = 0; i < count; ++i) {
+    if (!mDevice.IsDefaultProfile(i)) {
+      throw std::logic_error(
+        "Shared reports require the default device profile");
+    }
+  }
+
+  const auto size = sizeof(SharedReportsHeader)
+    + (count * sizeof(SharedReportSlot));
+  const std::wstring nameString {name};
+  mMapping.attach(CreateFileMappingW(
+    INVALID_HANDLE_VALUE,
+    nullptr,
+    PAGE_READWRITE,
+    0,
+    static_cast<DWORD>(size),
+    nameString.c_str()));
+  if (!mMapping) {
+    winrt::throw_last_error();
+  }
+  if (GetLastError() == ERROR_ALREADY_EXISTS) {
+    throw std::runtime_error("A shared report server is already running");
+  }
+
+  mView = MapViewOfFile(mMapping.get(), FILE_MAP_ALL_ACCESS, 0, 0, size);
+  if (!mView) {
+    winrt::throw_last_error();
+  }
+
+  // Every slot starts with a default report at sequence 0; this is sent
+  // along with other devices, but not on its own
+  const auto slots = reinterpret_cast<SharedReportSlot*>(
+    static_cast<SharedReportsHeader*>(mView) + 1);
+  for (uint8_t i = 0; i < count; ++i) {
+    new (slots + i) SharedReportSlot();
+  }
+  mSlots = {slots, count};
+  mSlotStates.resize(count);
+  mReports.resize(count);
+
+  // Last, so that clients don't use a partially-initialized region
+  auto header = new (mView) SharedReportsHeader {
+    .version = SharedReportsHeader::CURRENT_VERSION,
+    .slotCount = count,
+  };
+  std::atomic_thread_fence(std::memory_order_release);
+  memcpy(header->magic, SharedReportsHeader::MAGIC, sizeof(header->magic));
+}
+
+SharedReportServer::~SharedReportServer() {
+  if (mView) {
+    UnmapViewOfFile(mView);
+  }
+}
+
+size_t SharedReportServer::PushChanges() {
+  size_t changed = 0;
+  uint8_t lastChanged = 0;
+  for (uint8_t i = 0; i < mSlots.size(); ++i) {
+    auto& slot = mSlots[i];
+    auto& state = mSlotStates[i];
+    const auto sequence = slot.Read(&mReports[i]);
+    if (!sequence) {
+      // Skip it for now, leaving the previous report in `mReports`
+      ReclaimIfAbandoned(i);
+      continue;
+    }
+    if (*sequence != state.sentSequence) {
+      state.sentSequence = *sequence;
+      lastChanged = i;
+      ++changed;
+    }
+  }
+
+  if (changed == 1) {
+    mDevice.WriteReport(mReports[lastChanged], lastChanged);
+  } else if (changed > 1) {
+    mDevice.WriteReports(std::span {mReports}.first(lastChanged + 1));
+  }
+  return changed;
+}
+
+void SharedReportServer::ReclaimIfAbandoned(uint8_t slotIndex) {
+  auto& state = mSlotStates[slotIndex];
+  const auto sequence = mSlots[slotIndex].GetSequence();
+  if (!(sequence & 1)) {
+    return;
+  }
+
+  const auto now = std::chrono::steady_clock::now();
+  if (sequence != state.busySequence) {
+    state.busySequence = sequence;
+    state.busySince = now;
+    return;
+  }
+  if (now - state.busySince < ABANDONED_WRITE_TIMEOUT) {
+    return;
+  }
+  // Resend the previous report on the next call
+  mSlots[slotIndex].Reclaim(sequence, mReports[slotIndex]);
+}
+
+void SharedReportServer::Run(
+  std::stop_token stopToken,
+  std::chrono::microseconds idleInterval) {
+  while (!stopToken.stop_requested()) {
+    if (PushChanges() == 0) {
+      std::this_thread::sleep_for(idleInterval);
+    }
+  }
+}
+
+SharedReportClient::SharedReportClient(std::wstring_view name) {
+  const std::wstring nameString {name};
+  mMapping.attach(
+    OpenFileMappingW(FILE_MAP_ALL_ACCESS, FALSE, nameString.c_str()));
+  if (!mMapping) {
+    winrt::throw_last_error();
+  }
+  mView = MapViewOfFile(mMapping.get(), FILE_MAP_ALL_ACCESS, 0, 0, 0);
+  if (!mView) {
+    winrt::throw_last_error();
+  }
+
+  // The mapping may have been created by something else with the same name,
+  // so check its size before trusting the header; if this fails,
+  // `RegionSize` stays 0, and the region is rejected below
+  MEMORY_BASIC_INFORMATION info {};
+  VirtualQuery(mView, &info, sizeof(info));
+  const auto header = static_cast<const SharedReportsHeader*>(mView);
+  if (
+    info.RegionSize < sizeof(SharedReportsHeader)
+    || memcmp(header->magic, SharedReportsHeader::MAGIC, sizeof(header->magic))
+      != 0
+    || header->version != SharedReportsHeader::CURRENT_VERSION) {
+    UnmapViewOfFile(mView);
+    throw std::runtime_error(
+      "Shared report server is not ready, or is an unsupported version");
+  }
+  std::atomic_thread_fence(std::memory_order_acquire);
+  const auto slotsSize = info.RegionSize - sizeof(SharedReportsHeader);
+  if (header->slotCount > slotsSize / sizeof(SharedReportSlot)) {
+    UnmapViewOfFile(mView);
+    throw std::runtime_error(
+      "Shared report region is too small for its slot count");
+  }
+
+  mSlots = {
+    reinterpret_cast<SharedReportSlot*>(
+      static_cast<SharedReportsHeader*>(mView) + 1),
+    header->slotCount,
+  };
+}
+
+SharedReportClient::~SharedReportClient() {
+  if (mView) {
+    UnmapViewOfFile(mView);
+  }
+}
+
+size_t SharedReportClient::GetDeviceCount() const {
+  return mSlots.size();
+}
+
+void SharedReportClient::WriteReport(
+  const FAVJoyState2Report& report,
+  uint8_t deviceIndex) {
+  if (deviceIndex >= mSlots.size()) {
+    throw std::logic_error("Device index is >= device count");
+  }
+  mSlots[deviceIndex].Write(report);
+}
+
+}// namespace FAVHID
@@ -0,0 +1,142 @@
+// Copyright 2023 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: ISC
+
+#include "favhid/SupervisedFAVJoyState2.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+namespace FAVHID {
+
+SupervisedFAVJoyState2::SupervisedFAVJoyState2(
+  std::span<const DeviceProfile> profiles,
+  std::chrono::milliseconds retryInterval)
+  : SupervisedFAVJoyState2(
+    profiles,
+    [profiles = std::vector<DeviceProfile>(profiles.begin(), profiles.end())]() {
+      return FAVJoyState2::Open(profiles);
+    },
+    retryInterval) {
+}
+
+SupervisedFAVJoyState2::SupervisedFAVJoyState2(
+  std::span<const DeviceProfile> profiles,
+  OpenFunction open,
+  std::chrono::milliseconds retryInterval)
+  : mProfiles(profiles.begin(), profiles.end()),
+    mOpen(std::move(open)),
+    mRetryInterval(retryInterval),
+    mReports(profiles.size()),
+    mDirty(profiles.size(), false) {
+  if (profiles.empty()) {
+    throw std::logic_error("At least one device is required");
+  }
+  mThread = std::jthread {[this](std::stop_token stop) { Run(stop); }};
+}
+
+SupervisedFAVJoyState2::~SupervisedFAVJoyState2() = default;
+
+void SupervisedFAVJoyState2::WriteReport(
+  const FAVJoyState2Report& report,
+  uint8_t deviceIndex) {
+  this->WriteReport(DeviceProfile {}, &report, sizeof(report), deviceIndex);
+}
+
+void SupervisedFAVJoyState2::WriteReport(
+  const DeviceProfile& profile,
+  const void* report,
+  size_t size,
+  uint8_t deviceIndex) {
+  if (deviceIndex >= mProfiles.size()) {
+    throw std::logic_error("Device index is >= device count");
+  }
+  if (mProfiles[deviceIndex] != profile) {
+    throw std::logic_error("Report is for a different device profile");
+  }
+  if (size != profile.GetReportSize()) {
+    throw std::logic_error("Report size does not match the device profile");
+  }
+
+  {
+    std::unique_lock lock(mMutex);
+    mReports[deviceIndex].assign(static_cast<const char*>(report), size);
+    mDirty[deviceIndex] = true;
+  }
+  mWake.notify_one();
+}
+
+bool SupervisedFAVJoyState2::IsConnected() const {
+  return mConnected;
+}
+
+size_t SupervisedFAVJoyState2::GetConnectionCount() const {
+  return mConnectionCount;
+}
+
+void SupervisedFAVJoyState2::Run(std::stop_token stopToken) {
+  while (!stopToken.stop_requested()) {
+    std::optional<FAVJoyState2> device;
+    try {
+      device = mOpen();
+    } catch (...) {
+      device.reset();
+    }
+    if (device && device->GetDeviceCount() != mProfiles.size()) {
+      device.reset();
+    }
+
+    if (!device) {
+      std::unique_lock lock(mMutex);
+      mWake.wait_for(lock, stopToken, mRetryInterval, [] { return false; });
+      continue;
+    }
+
+    // Replay everything; the device may have been power-cycled
+    {
+      std::unique_lock lock(mMutex);
+      for (size_t i = 0; i < mReports.size(); ++i) {
+        mDirty[i] = !mReports[i].empty();
+      }
+    }
+    ++mConnectionCount;
+    mConnected = true;
+
+    while (SendDirtyReports(*device, stopToken)) {
+    }
+    mConnected = false;
+  }
+}
+
+bool SupervisedFAVJoyState2::SendDirtyReports(
+  FAVJoyState2& device,
+  std::stop_token stopToken) {
+  std::vector<std::pair<uint8_t, std::string>> pending;
+  {
+    std::unique_lock lock(mMutex);
+    mWake.wait(lock, stopToken, [this] {
+      return std::ranges::find(mDirty, true) != mDirty.end();
+    });
+    if (stopToken.stop_requested()) {
+      return false;
+    }
+    for (uint8_t i = 0; i < mDirty.size(); ++i) {
+      if (mDirty[i]) {
+        pending.emplace_back(i, mReports[i]);
+        mDirty[i] = false;
+      }
+    }
+  }
+
+  try {
+    for (const auto& [deviceIndex, report]: pending) {
+      device.WriteReport(
+        mProfiles[deviceIndex], report.data(), report.size(), deviceIndex);
+    }
+  } catch (...) {
+    return false;
+  }
+  return true;
+}
+
+}// namespace FAVHID
@@ -0,0 +1,152 @@
+// Copyright 2023 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: ISC
+
+#include "favhid/Trace.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace FAVHID::Trace {
+
+namespace {
+
+struct Event {
+  const char* name;
+  uint64_t beginNS;
+  uint64_t durationNS;
+};
+
+// Only written by the thread that's using it
+struct ThreadBuffer {
+  uint32_t threadID {};
+  // Protected by `gBuffersMutex`
+  bool inUse {true};
+  std::atomic<uint64_t> count {0};
+  std::array<Event, BUFFER_SIZE> events {};
+};
+
+std::atomic<bool> gEnabled {true};
+std::atomic<uint64_t> gClearedAtNS {0};
+
+// Only locked when a thread records its first event or exits, and while
+// writing JSON
+std::mutex gBuffersMutex;
+/* Kept after their threads exit, so that their events can still be written.
+ *
+ * Once a thread exits, its buffer is reused by the next new thread, so
+ * there are only as many buffers as concurrent threads.
+ */
+std::vector<std::unique_ptr<ThreadBuffer>> gBuffers;
+
+// Returns the buffer for reuse when its thread exits
+struct ThreadBufferOwner {
+  ThreadBuffer* buffer {nullptr};
+
+  ~ThreadBufferOwner() {
+    if (buffer) {
+      std::unique_lock lock(gBuffersMutex);
+      buffer->inUse = false;
+    }
+  }
+};
+
+uint64_t NowNS() {
+  return static_cast<uint64_t>(
+    std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch())
+      .count());
+}
+
+ThreadBuffer& GetThreadBuffer() {
+  thread_local ThreadBufferOwner owner;
+  if (owner.buffer) {
+    return *owner.buffer;
+  }
+
+  std::unique_lock lock(gBuffersMutex);
+  const auto it = std::ranges::find_if(
+    gBuffers, [](const auto& buffer) { return !buffer->inUse; });
+  if (it != gBuffers.end()) {
+    // Keep the thread ID, as the previous thread's events are still there
+    owner.buffer = it->get();
+    owner.buffer->inUse = true;
+  } else {
+    auto& buffer = gBuffers.emplace_back(std::make_unique<ThreadBuffer>());
+    buffer->threadID = static_cast<uint32_t>(gBuffers.size());
+    owner.buffer = buffer.get();
+  }
+  return *owner.buffer;
+}
+
+void WriteMicroseconds(std::ostream& out, uint64_t ns) {
+  const auto fraction = ns % 1000;
+  out << (ns / 1000) << '.' << (fraction / 100) << ((fraction / 10) % 10)
+      << (fraction % 10);
+}
+
+}// namespace
+
+void SetEnabled(bool enabled) {
+  gEnabled.store(enabled, std::memory_order_relaxed);
+}
+
+bool IsEnabled() {
+  return gEnabled.load(std::memory_order_relaxed);
+}
+
+void Clear() {
+  gClearedAtNS.store(NowNS(), std::memory_order_relaxed);
+}
+
+void WriteChromeJSON(std::ostream& out) {
+  const auto clearedAt = gClearedAtNS.load(std::memory_order_relaxed);
+  std::unique_lock lock(gBuffersMutex);
+
+  out << R"({"displayTimeUnit":"ns","traceEvents":[)";
+  bool first = true;
+  for (const auto& buffer: gBuffers) {
+    const auto count = buffer->count.load(std::memory_order_acquire);
+    const auto begin = (count > BUFFER_SIZE) ? (count - BUFFER_SIZE) : 0;
+    for (auto i = begin; i < count; ++i) {
+      const auto& event = buffer->events[i % BUFFER_SIZE];
+      if (event.beginNS < clearedAt) {
+        continue;
+      }
+      if (!first) {
+        out << ',';
+      }
+      first = false;
+      // Names are identifiers chosen by the caller, so aren't escaped
+      out << R"({"name":")" << event.name
+          << R"(","cat":"favhid","ph":"X","pid":1,"tid":)" << buffer->threadID
+          << R"(,"ts":)";
+      WriteMicroseconds(out, event.beginNS);
+      out << R"(,"dur":)";
+      WriteMicroseconds(out, event.durationNS);
+      out << '}';
+    }
+  }
+  out << "]}";
+}
+
+Scope::Scope(const char* name) noexcept
+  : mName(name), mBeginNS(IsEnabled() ? NowNS() : 0) {
+}
+
+Scope::~Scope() {
+  if (!mBeginNS) {
+    return;
+  }
+  const auto end = NowNS();
+  auto& buffer = GetThreadBuffer();
+  const auto index = buffer.count.load(std::memory_order_relaxed);
+  buffer.events[index % BUFFER_SIZE] = {mName, mBeginNS, end - mBeginNS};
+  buffer.count.store(index + 1, std::memory_order_release);
+}
+
+}// namespace FAVHID::Trace
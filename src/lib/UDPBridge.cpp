@@ -0,0 +1,368 @@
+// Copyright 2023 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: ISC
+
+// Must be included before anything that includes Windows.h
+#include <winsock2.h>
+#include <ws2tcpip.h>
+
+#include "favhid/UDPBridge.hpp"
+
+#include "favhid/Arduino.hpp"
+
+#include <cstring>
+#include <random>
+#include <stdexcept>
+#include <system_error>
+
+namespace FAVHID {
+
+namespace {
+
+constexpr size_t MAX_DATAGRAM_SIZE = 65507;
+
+// Same units and wrapping as the device clock
+uint32_t GetTimeUS() {
+  return static_cast<uint32_t>(
+    std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now().time_since_epoch())
+      .count());
+}
+
+std::chrono::microseconds Elapsed(uint32_t from, uint32_t to) {
+  return std::chrono::microseconds {static_cast<int32_t>(to - from)};
+}
+
+[[noreturn]] void ThrowSocketError(int error, const char* what) {
+  throw std::system_error(error, std::system_category(), what);
+}
+
+// Winsock is reference-counted, so each socket has its own reference
+SOCKET CreateSocket() {
+  WSADATA data {};
+  if (const auto error = WSAStartup(MAKEWORD(2, 2), &data)) {
+    ThrowSocketError(error, "WSAStartup");
+  }
+
+  const auto ret = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  u_long nonBlocking = 1;
+  if (
+    ret == INVALID_SOCKET
+    || ioctlsocket(ret, FIONBIO, &nonBlocking) == SOCKET_ERROR) {
+    const auto error = WSAGetLastError();
+    if (ret != INVALID_SOCKET) {
+      closesocket(ret);
+    }
+    WSACleanup();
+    ThrowSocketError(error, "socket");
+  }
+  return ret;
+}
+
+void CloseSocket(uintptr_t socket) {
+  closesocket(static_cast<SOCKET>(socket));
+  WSACleanup();
+}
+
+}// namespace
+
+UDPBridgeSender::UDPBridgeSender(std::string_view host, uint16_t port)
+  : mSocket(CreateSocket()) {
+  addrinfo hints {};
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_DGRAM;
+  hints.ai_protocol = IPPROTO_UDP;
+  const std::string hostString {host};
+  const auto portString = std::to_string(port);
+  addrinfo* address {nullptr};
+  if (const auto error = getaddrinfo(
+        hostString.c_str(), portString.c_str(), &hints, &address)) {
+    CloseSocket(mSocket);
+    ThrowSocketError(error, "getaddrinfo");
+  }
+
+  // Connected, so that only the receiver's status messages are read
+  const auto connected = connect(
+    mSocket, address->ai_addr, static_cast<int>(address->ai_addrlen));
+  freeaddrinfo(address);
+  if (connected == SOCKET_ERROR) {
+    const auto error = WSAGetLastError();
+    CloseSocket(mSocket);
+    ThrowSocketError(error, "connect");
+  }
+
+  mSession = std::random_device {}();
+}
+
+UDPBridgeSender::~UDPBridgeSender() {
+  CloseSocket(mSocket);
+}
+
+void UDPBridgeSender::WriteReport(
+  uint8_t reportID,
+  const void* report,
+  size_t size) {
+  if (size > MAX_DATAGRAM_SIZE - sizeof(UDPBridgeReportHeader)) {
+    throw std::logic_error("Report is too large for a UDP datagram");
+  }
+
+  ReceiveStatus();
+
+  UDPBridgeReportHeader header {
+    .reportID = reportID,
+    .session = mSession,
+    .sequence = mSequence++,
+    .sentUS = GetTimeUS(),
+  };
+  if (const auto offset = mClockOffset.GetOffset()) {
+    header.flags |= UDPBridgeReportHeader::HAS_CLOCK_OFFSET;
+    header.clockOffsetUS = *offset;
+  }
+
+  WSABUF buffers[] {
+    {sizeof(header), reinterpret_cast<char*>(&header)},
+    {static_cast<ULONG>(size),
+     const_cast<char*>(static_cast<const char*>(report))},
+  };
+  DWORD sent {};
+  ++mStats.sentCount;
+  if (
+    WSASend(mSocket, buffers, std::size(buffers), &sent, 0, nullptr, nullptr)
+    == SOCKET_ERROR) {
+    const auto error = WSAGetLastError();
+    // The send buffer is full; the receiver will see this as a lost report
+    if (error == WSAEWOULDBLOCK) {
+      return;
+    }
+    ThrowSocketError(error, "WSASend");
+  }
+}
+
+void UDPBridgeSender::ReceiveStatus() {
+  while (true) {
+    UDPBridgeStatus status;
+    const auto received = recv(
+      mSocket, reinterpret_cast<char*>(&status), sizeof(status), 0);
+    if (received == SOCKET_ERROR) {
+      const auto error = WSAGetLastError();
+      if (error == WSAEWOULDBLOCK) {
+        return;
+      }
+      // An earlier report was rejected, e.g. if the receiver isn't running
+      // yet
+      if (error == WSAECONNRESET || error == WSAECONNREFUSED) {
+        continue;
+      }
+      ThrowSocketError(error, "recv");
+    }
+    if (
+      received != sizeof(status) || status.type != UDPBridgeMessageType::Status
+      || status.session != mSession) {
+      continue;
+    }
+
+    const auto now = GetTimeUS();
+    mClockOffset.AddSample(
+      status.reportSentUS, status.receivedUS, status.repliedUS, now);
+    mStats.oneWay.Add(Elapsed(
+      status.reportSentUS, mClockOffset.ToHostTime(status.receivedUS)));
+    mStats.roundTrip.Add(Elapsed(status.reportSentUS, now));
+    mStats.receivedCount = status.receivedCount;
+    mStats.lostCount = status.lostCount;
+    mStats.staleCount = status.staleCount;
+  }
+}
+
+const UDPBridgeSender::Stats& UDPBridgeSender::GetStats() const {
+  return mStats;
+}
+
+UDPBridgeReceiver::UDPBridgeReceiver(
+  uint16_t port,
+  uint32_t statusInterval,
+  std::chrono::milliseconds sessionTimeout)
+  : mSocket(CreateSocket()),
+    mStatusInterval(statusInterval),
+    mSessionTimeout(sessionTimeout),
+    mBuffer(MAX_DATAGRAM_SIZE, '\0') {
+  if (statusInterval == 0) {
+    CloseSocket(mSocket);
+    throw std::logic_error("Status interval must be at least 1");
+  }
+
+  sockaddr_in address {};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  if (
+    bind(mSocket, reinterpret_cast<sockaddr*>(&address), sizeof(address))
+    == SOCKET_ERROR) {
+    const auto error = WSAGetLastError();
+    CloseSocket(mSocket);
+    ThrowSocketError(error, "bind");
+  }
+}
+
+UDPBridgeReceiver::~UDPBridgeReceiver() {
+  CloseSocket(mSocket);
+}
+
+uint16_t UDPBridgeReceiver::GetPort() const {
+  sockaddr_in address {};
+  int size = sizeof(address);
+  if (
+    getsockname(mSocket, reinterpret_cast<sockaddr*>(&address), &size)
+    == SOCKET_ERROR) {
+    ThrowSocketError(WSAGetLastError(), "getsockname");
+  }
+  return ntohs(address.sin_port);
+}
+
+bool UDPBridgeReceiver::Poll(
+  std::chrono::milliseconds timeout,
+  const Callback& callback) {
+  WSAPOLLFD pollFD {};
+  pollFD.fd = static_cast<SOCKET>(mSocket);
+  pollFD.events = POLLRDNORM;
+  const auto ready
+    = WSAPoll(&pollFD, 1, static_cast<INT>(timeout.count()));
+  if (ready == SOCKET_ERROR) {
+    ThrowSocketError(WSAGetLastError(), "WSAPoll");
+  }
+  if (ready == 0) {
+    return false;
+  }
+
+  std::map<uint8_t, std::string> latest;
+  while (true) {
+    sockaddr_in from {};
+    int fromSize = sizeof(from);
+    const auto received = recvfrom(
+      mSocket,
+      mBuffer.data(),
+      static_cast<int>(mBuffer.size()),
+      0,
+      reinterpret_cast<sockaddr*>(&from),
+      &fromSize);
+    if (received == SOCKET_ERROR) {
+      const auto error = WSAGetLastError();
+      if (error == WSAEWOULDBLOCK) {
+        break;
+      }
+      // A status message was rejected, e.g. the sender has exited
+      if (error == WSAECONNRESET) {
+        continue;
+      }
+      ThrowSocketError(error, "recvfrom");
+    }
+
+    const auto now = GetTimeUS();
+    UDPBridgeReportHeader header;
+    if (received < static_cast<int>(sizeof(header))) {
+      continue;
+    }
+    memcpy(&header, mBuffer.data(), sizeof(header));
+    if (header.type != UDPBridgeMessageType::Report) {
+      continue;
+    }
+
+    const auto receivedAt = std::chrono::steady_clock::now();
+    if (header.session != mSession) {
+      if (mSession && receivedAt - mSessionActiveAt < mSessionTimeout) {
+        ++mStats.otherSessionCount;
+        continue;
+      }
+      mSession = header.session;
+      mFirstSequence = header.sequence;
+      mLastSequence = header.sequence;
+      mLastSequences.clear();
+      mStats = {};
+    }
+    mSessionActiveAt = receivedAt;
+
+    // Counting these would hide a lost datagram
+    const auto it = mLastSequences.find(header.reportID);
+    if (it != mLastSequences.end() && it->second == header.sequence) {
+      ++mStats.duplicateCount;
+      continue;
+    }
+
+    ++mStats.receivedCount;
+    if (static_cast<int32_t>(header.sequence - mLastSequence) > 0) {
+      mLastSequence = header.sequence;
+    }
+    // Reordered before the first datagram we saw
+    if (static_cast<int32_t>(header.sequence - mFirstSequence) < 0) {
+      mFirstSequence = header.sequence;
+    }
+    const auto expected = (mLastSequence - mFirstSequence) + 1;
+    mStats.lostCount = (expected > mStats.receivedCount)
+      ? (expected - mStats.receivedCount)
+      : 0;
+
+    if (header.flags & UDPBridgeReportHeader::HAS_CLOCK_OFFSET) {
+      mStats.oneWay.Add(
+        Elapsed(header.sentUS + header.clockOffsetUS, now));
+    }
+
+    if (
+      it != mLastSequences.end()
+      && static_cast<int32_t>(header.sequence - it->second) <= 0) {
+      ++mStats.staleCount;
+    } else {
+      mLastSequences[header.reportID] = header.sequence;
+      latest[header.reportID].assign(
+        mBuffer.data() + sizeof(header), received - sizeof(header));
+    }
+
+    if ((mStats.receivedCount - 1) % mStatusInterval == 0) {
+      SendStatus(header, now, &from, fromSize);
+    }
+  }
+
+  for (const auto& [reportID, report]: latest) {
+    callback(
+      reportID,
+      {reinterpret_cast<const uint8_t*>(report.data()), report.size()});
+  }
+  return true;
+}
+
+void UDPBridgeReceiver::SendStatus(
+  const UDPBridgeReportHeader& header,
+  uint32_t receivedUS,
+  const void* address,
+  int addressSize) {
+  const UDPBridgeStatus status {
+    .session = header.session,
+    .reportSentUS = header.sentUS,
+    .receivedUS = receivedUS,
+    .repliedUS = GetTimeUS(),
+    .receivedCount = mStats.receivedCount,
+    .lostCount = mStats.lostCount,
+    .staleCount = mStats.staleCount,
+  };
+  // Best-effort, like the reports
+  sendto(
+    mSocket,
+    reinterpret_cast<const char*>(&status),
+    sizeof(status),
+    0,
+    static_cast<const sockaddr*>(address),
+    addressSize);
+}
+
+void UDPBridgeReceiver::Run(Arduino& arduino, std::stop_token stopToken) {
+  while (!stopToken.stop_requested()) {
+    Poll(
+      std::chrono::milliseconds {100},
+      [&arduino](uint8_t reportID, std::span<const uint8_t> report) {
+        arduino.WriteReport(reportID, report.data(), report.size());
+      });
+  }
+}
+
+const UDPBridgeReceiver::Stats& UDPBridgeReceiver::GetStats() const {
+  return mStats;
+}
+
+}// namespace FAVHID
@@ -0,0 +1,95 @@
+// Copyright 2023 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: ISC
+
+#include "favhid/AxisProcessor.hpp"
+#include "test-check.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <format>
+#include <iostream>
+#include <vector>
+
+using namespace FAVHID;
+
+static void test_curves() {
+  const AxisCurve curves[] {
+    {},
+    {.deadzone = 0.1f},
+    {.deadzone = 0.1f, .saturation = 0.9f},
+    AxisCurve::Power(2.0f),
+    // Not a multiple of the SIMD width, to cover the scalar tail
+    {},
+  };
+  const AxisProcessor processor(curves);
+
+  const float in[] {1.0f, 0.05f, 0.95f, 0.5f, -2.0f};
+  int16_t out[std::size(in)] {};
+  processor.Process(in, out);
+  CHECK(out[0] == INT16_MAX);
+  CHECK(out[1] == 0);
+  CHECK(out[2] == INT16_MAX);
+  CHECK(std::abs(out[3] - (INT16_MAX / 4)) < 16);
+  CHECK(out[4] == -INT16_MAX);
+
+  const float negative[] {-1.0f, -0.05f, -0.95f, -0.5f, 0.0f};
+  processor.Process(negative, out);
+  CHECK(out[0] == -INT16_MAX);
+  CHECK(out[1] == 0);
+  CHECK(out[2] == -INT16_MAX);
+  CHECK(std::abs(out[3] + (INT16_MAX / 4)) < 16);
+  CHECK(out[4] == 0);
+
+  // Halfway between deadzone and saturation
+  const float half[] {0.0f, 0.0f, 0.5f, 0.0f, 0.0f};
+  processor.Process(half, out);
+  CHECK(std::abs(out[2] - (INT16_MAX / 2)) <= 1);
+}
+
+static void test_reports() {
+  std::vector<AxisCurve> curves(16);
+  const AxisProcessor processor(curves);
+
+  std::vector<float> in(16);
+  in[0] = 1.0f;
+  in[15] = -1.0f;
+  FAVJoyState2Report reports[2] {};
+  reports[1].SetButton(3);
+  processor.Process(in, reports);
+  CHECK(reports[0].x == INT16_MAX);
+  CHECK(reports[1].slider[1] == -INT16_MAX);
+  CHECK(reports[1].buttons[0] == 0b1000);
+}
+
+static void benchmark() {
+  constexpr size_t AXES = 64;
+  constexpr size_t ITERATIONS = 100000;
+  std::vector<AxisCurve> curves(AXES, AxisCurve::Power(1.5f, 0.05f));
+  const AxisProcessor processor(curves);
+
+  constexpr size_t FRAMES = 16;
+  std::vector<float> in(AXES * FRAMES);
+  for (size_t i = 0; i < in.size(); ++i) {
+    in[i] = std::sin(static_cast<float>(i));
+  }
+  std::vector<int16_t> out(AXES);
+  const auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < ITERATIONS; ++i) {
+    processor.Process(
+      std::span {in}.subspan((i % FRAMES) * AXES, AXES), out);
+  }
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+  std::cout << std::format(
+    "{} axes: {}ns per frame",
+    AXES,
+    std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()
+      / ITERATIONS)
+            << std::endl;
+}
+
+int main() {
+  test_curves();
+  test_reports();
+  benchmark();
+  return gFailures ? 1 : 0;
+}
@@ -0,0 +1,17 @@
+// Copyright 2023 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: ISC
+
+#pragma once
+
+#include <iostream>
+
+// Incremented by every failed `CHECK()`; tests should return non-zero from
+// `main()` if this is set
+static int gFailures = 0;
+
+#define CHECK(x) \
+  { \
+    const bool ok = (x); \
+    gFailures += ok ? 0 : 1; \
+    std::cout << (ok ? "OK: " : "FAIL: ") << #x << std::endl; \
+  }
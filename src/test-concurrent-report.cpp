@@ -0,0 +1,67 @@
+// Copyright 2023 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: ISC
+
+#include "favhid/ConcurrentReport.hpp"
+#include "test-check.hpp"
+
+#include <thread>
+
+using namespace FAVHID;
+
+int main() {
+  FAVJoyState2Report initial {};
+  initial.y = 123;
+  initial.SetButton(40);
+  initial.SetPOV(2, 3);
+
+  ConcurrentReport state {initial};
+  FAVJoyState2Report report {};
+  const auto initialVersion = state.Snapshot(&report);
+  CHECK(memcmp(&report, &initial, sizeof(report)) == 0);
+
+  state.SetAxis(7, -5);
+  state.SetButton(40, false);
+  state.SetButton(127);
+  state.SetPOV(0, 1);
+  CHECK(state.Snapshot(&report) == initialVersion + 4);
+  CHECK(report.slider[1] == -5);
+  CHECK(report.buttons[40 / 8] == 0);
+  CHECK(report.buttons[127 / 8] == 0x80);
+  CHECK(report.povs[1] == 0x1f);
+  CHECK(report.povs[0] == 0x3f);
+
+  // Threads updating different controls don't overwrite each other
+  constexpr int16_t ITERATIONS = 10000;
+  std::jthread axes([&state]() {
+    for (int16_t i = 0; i < ITERATIONS; ++i) {
+      state.SetAxis(0, i);
+    }
+  });
+  std::jthread buttons([&state]() {
+    for (int16_t i = 0; i < ITERATIONS; ++i) {
+      // Even buttons end up pressed
+      state.SetButton(i % 64, i % 2 == 0);
+    }
+    state.SetButton(1);
+  });
+  std::jthread hats([&state]() {
+    for (int16_t i = 0; i < ITERATIONS; ++i) {
+      state.SetPOV(3, i % 8);
+    }
+  });
+  axes.join();
+  buttons.join();
+  hats.join();
+
+  state.Snapshot(&report);
+  CHECK(report.x == ITERATIONS - 1);
+  CHECK(report.y == 123);
+  CHECK(report.buttons[0] == 0b01010111);
+  CHECK(report.buttons[7] == 0b01010101);
+  CHECK(report.buttons[127 / 8] == 0x80);
+  CHECK(report.povs[0] == 0x37);
+  CHECK(report.povs[1] == 0x1f);
+  CHECK(state.GetVersion() == initialVersion + 4 + (3 * ITERATIONS) + 1);
+
+  return gFailures ? 1 : 0;
+}
@@ -0,0 +1,125 @@
+// Copyright 2023 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: ISC
+
+#include "favhid/DeviceDefinition.hpp"
+#include "test-check.hpp"
+
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+
+using namespace FAVHID;
+
+static bool ThrowsRuntimeError(std::string_view text) {
+  try {
+    ParseDeviceDefinitions(text);
+  } catch (const std::runtime_error&) {
+    return true;
+  }
+  return false;
+}
+
+int main() {
+  constexpr std::string_view TEXT {
+    "# Comment\n"
+    "device\n"
+    "\n"
+    "  device axes=0 hats=1 buttons=12 # button box\r\n"
+    "device axes=6 bits=8 extra=velocity\n"
+    "device axes=0 hats=0 buttons=0 extra=acceleration,force\n"};
+
+  const auto profiles = ParseDeviceDefinitions(TEXT);
+  CHECK(profiles.size() == 4);
+  CHECK(profiles.at(0) == DeviceProfile {});
+  CHECK((profiles.at(1) == Profile<0, 16, 1, 12>::Description));
+  using Velocity = Profile<6, 8, 4, 128, ExtraAxes::Velocity>;
+  CHECK(profiles.at(2) == Velocity::Description);
+  CHECK(
+    profiles.at(3).extraAxes == (ExtraAxes::Acceleration | ExtraAxes::Force));
+
+  CHECK(ThrowsRuntimeError(""));
+  CHECK(ThrowsRuntimeError("joystick\n"));
+  CHECK(ThrowsRuntimeError("device\ndevice axes=9\n"));
+  CHECK(ThrowsRuntimeError("device bits=12\n"));
+  CHECK(ThrowsRuntimeError("device buttons=256\n"));
+  CHECK(ThrowsRuntimeError("device colour=red\n"));
+  CHECK(ThrowsRuntimeError("device extra=velocity,jerk\n"));
+
+  // The config ID depends on the devices, not on how they're written
+  const auto compiled = CompileDeviceDefinitions(TEXT);
+  CHECK(compiled.descriptors.size() == 4);
+  CHECK(
+    compiled.configID == FAVJoyState2::GetConfiguration(profiles).configID);
+  CHECK(
+    CompileDeviceDefinitions("device axes=8\ndevice hats=1 axes=0 buttons=12")
+      .configID
+    != compiled.configID);
+  const DeviceProfile defaults[2] {};
+  CHECK(
+    CompileDeviceDefinitions("device\ndevice").configID
+    == FAVJoyState2::GetConfiguration(defaults).configID);
+
+  const auto cacheDirectory = std::filesystem::temp_directory_path()
+    / "favhid-test-device-definition";
+  std::filesystem::remove_all(cacheDirectory);
+
+  const auto uncached = CompileDeviceDefinitions(TEXT, cacheDirectory);
+  CHECK(uncached.configID == compiled.configID);
+  CHECK(uncached.descriptors == compiled.descriptors);
+  std::filesystem::path cacheFile;
+  size_t fileCount = 0;
+  for (const auto& it: std::filesystem::directory_iterator {cacheDirectory}) {
+    cacheFile = it.path();
+    ++fileCount;
+  }
+  CHECK(!cacheFile.empty());
+  // No temporary files are left behind
+  CHECK(fileCount == 1);
+
+  const auto cached = CompileDeviceDefinitions(TEXT, cacheDirectory);
+  CHECK(cached.configID == compiled.configID);
+  CHECK(cached.profiles == compiled.profiles);
+  CHECK(cached.descriptors == compiled.descriptors);
+
+  // A damaged cache is replaced
+  const auto cacheSize = std::filesystem::file_size(cacheFile);
+  std::filesystem::resize_file(cacheFile, cacheSize - 1);
+  const auto recompiled = CompileDeviceDefinitions(TEXT, cacheDirectory);
+  CHECK(recompiled.descriptors == compiled.descriptors);
+  CHECK(std::filesystem::file_size(cacheFile) == cacheSize);
+
+  // So is one with a config ID that doesn't match the descriptors
+  {
+    constexpr auto offset = offsetof(DeviceDefinitionCacheHeader, configID);
+    std::fstream f {cacheFile, std::ios::binary | std::ios::in | std::ios::out};
+    f.seekg(offset);
+    const auto byte = static_cast<char>(f.get() ^ 0xff);
+    f.seekp(offset);
+    f.put(byte);
+  }
+  const auto reconfigured = CompileDeviceDefinitions(TEXT, cacheDirectory);
+  CHECK(reconfigured.configID == compiled.configID);
+  const auto recached = CompileDeviceDefinitions(TEXT, cacheDirectory);
+  CHECK(recached.configID == compiled.configID);
+
+  // And one with descriptors from a different generator, even if its config
+  // ID matches them
+  {
+    auto stale = compiled.descriptors;
+    stale.back().back() ^= 0xff;
+    const auto staleID = FAVJoyState2::GetConfigID(profiles, stale);
+    std::fstream f {cacheFile, std::ios::binary | std::ios::in | std::ios::out};
+    f.seekp(offsetof(DeviceDefinitionCacheHeader, configID));
+    f.write(reinterpret_cast<const char*>(&staleID), sizeof(staleID));
+    f.seekp(-1, std::ios::end);
+    f.put(stale.back().back());
+  }
+  const auto regenerated = CompileDeviceDefinitions(TEXT, cacheDirectory);
+  CHECK(regenerated.descriptors == compiled.descriptors);
+  CHECK(regenerated.configID == compiled.configID);
+
+  std::filesystem::remove_all(cacheDirectory);
+
+  return gFailures == 0 ? 0 : 1;
+}
@@ -27,6 +27,51 @@ int main() {
     },
   };
 
+  constexpr auto compiledDescriptor = Compile([] {
+    return Descriptor {
+      UsagePage::GenericDesktop,
+      Usage::Joystick,
+      Collection::Application {
+        Collection::Physical {
+          ReportID {REPORT_ID},
+          UsagePage::GenericDesktop,
+          Usage::X,
+          Usage::Y,
+          LogicalMinimum<int8_t> {},
+          LogicalMaximum<int8_t> {},
+          ReportSize {8},
+          ReportCount {2},
+          Input::DataVariableAbsolute,
+        },
+      },
+    };
+  });
+  static_assert(compiledDescriptor.size() == constantDescriptor.size());
+  static_assert(sizeof(compiledDescriptor) < sizeof(constantDescriptor));
+
+  // Stamping a template with the real report ID should give the same bytes
+  constexpr auto descriptorTemplate = CompileTemplate([] {
+    return Descriptor {
+      UsagePage::GenericDesktop,
+      Usage::Joystick,
+      Collection::Application {
+        Collection::Physical {
+          ReportID {0xff},
+          UsagePage::GenericDesktop,
+          Usage::X,
+          Usage::Y,
+          LogicalMinimum<int8_t> {},
+          LogicalMaximum<int8_t> {},
+          ReportSize {8},
+          ReportCount {2},
+          Input::DataVariableAbsolute,
+        },
+      },
+    };
+  });
+  static_assert(descriptorTemplate.GetReportIDOffsets().size() == 1);
+  static_assert(descriptorTemplate.Stamp(REPORT_ID) == compiledDescriptor);
+
   auto force_runtime_eval = [](auto&& x) {
     // Pointer stuff is banned in constant evaluation
     return (&x + 123)[-123];
@@ -61,5 +106,11 @@ int main() {
       dynamicDescriptor.data(),
       constantDescriptor.size())
     == 0);
+  assert(
+    memcmp(
+      constantDescriptor.data(),
+      compiledDescriptor.data(),
+      constantDescriptor.size())
+    == 0);
   return 0;
 }
\ No newline at end of file
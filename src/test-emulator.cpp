@@ -0,0 +1,725 @@
+// Copyright 2023 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: ISC
+
+#include "favhid/Arduino.hpp"
+#include "favhid/Emulator.hpp"
+#include "favhid/FAVJoyState2.hpp"
+#include "favhid/PendingFAVJoyState2.hpp"
+#include "favhid/Recording.hpp"
+#include "favhid/ShardedFAVJoyState2.hpp"
+#include "favhid/SupervisedFAVJoyState2.hpp"
+#include "test-check.hpp"
+
+#include <format>
+#include <future>
+#include <stdexcept>
+#include <thread>
+
+using namespace FAVHID;
+
+static std::optional<Arduino> OpenEmulator(std::wstring_view pipeName) {
+  // The server thread may not have created the pipe yet
+  for (int i = 0; i < 20; ++i) {
+    try {
+      auto ret = Arduino::OpenPath(pipeName);
+      if (ret) {
+        return ret;
+      }
+    } catch (...) {
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  }
+  return {};
+}
+
+static void test_config(Arduino& arduino, Emulator& emulator) {
+  CHECK(arduino.GetSerialNumber() == emulator.GetSerialNumber());
+  CHECK(arduino.GetVolatileConfigID().IsZero());
+
+  for (uint8_t i = 0; i < 2; ++i) {
+    const auto descriptor = FAVJoyState2::GetDescriptor(i);
+    CHECK(arduino.PushDescriptor(descriptor.data(), descriptor.size()).IsOK());
+  }
+
+  const auto configID = OpaqueID::Random();
+  arduino.SetVolatileConfigID(configID);
+  CHECK(arduino.ResetUSB());
+  CHECK(arduino.GetVolatileConfigID() == configID);
+  CHECK(emulator.GetDescriptors().size() == 2);
+}
+
+static void test_multi_report(Arduino& arduino, Emulator& emulator) {
+  FAVJoyState2::Report reports[3] {};
+  reports[0].SetButton(1);
+  reports[1].SetButton(2);
+  reports[2].SetButton(3);
+
+  Arduino::ReportEntry entries[] {
+    {FIRST_AVAILABLE_REPORT_ID, &reports[0], sizeof(reports[0])},
+    {FIRST_AVAILABLE_REPORT_ID + 1, &reports[1], sizeof(reports[1])},
+  };
+  CHECK(arduino.WriteReports(entries).IsOK());
+
+  const auto last = emulator.GetLastReport(FIRST_AVAILABLE_REPORT_ID + 1);
+  CHECK(last && memcmp(last->data(), &reports[1], sizeof(reports[1])) == 0);
+
+  // No descriptor has this report ID, so it should fail without affecting
+  // the others
+  Arduino::ReportEntry withFailure[] {
+    {FIRST_AVAILABLE_REPORT_ID, &reports[2], sizeof(reports[2])},
+    {FIRST_AVAILABLE_REPORT_ID + 2, &reports[2], sizeof(reports[2])},
+  };
+  const auto response = arduino.WriteReports(withFailure);
+  CHECK(response.type == MessageType::Response_MultiReportFailed);
+  CHECK(response.data.size() == 2);
+  CHECK(
+    static_cast<MessageType>(response.data.at(0)) == MessageType::Response_OK);
+  CHECK(
+    static_cast<MessageType>(response.data.at(1))
+    == MessageType::Response_HIDWriteFailed);
+}
+
+static void test_delta_report(Arduino& arduino, Emulator& emulator) {
+  constexpr uint8_t reportID = FIRST_AVAILABLE_REPORT_ID;
+  FAVJoyState2::Report report {};
+  CHECK(arduino.WriteReport(reportID, &report, sizeof(report)).IsOK());
+  // Header, report ID, and report
+  constexpr auto fullSize = sizeof(ShortMessageHeader) + 1 + sizeof(report);
+
+  // Should be sent as a delta; the emulator must reconstruct the full report
+  report.x = 1234;
+  report.SetButton(100);
+  arduino.ClearPacketStats();
+  CHECK(arduino.WriteReport(reportID, &report, sizeof(report)).IsOK());
+  CHECK(arduino.GetPacketStats().messageBytes < fullSize);
+  auto last = emulator.GetLastReport(reportID);
+  CHECK(last && memcmp(last->data(), &report, sizeof(report)) == 0);
+
+  // If every byte changed, the full report is smaller than a delta
+  const auto bytes = reinterpret_cast<uint8_t*>(&report);
+  for (size_t i = 0; i < sizeof(report); ++i) {
+    bytes[i] = ~bytes[i];
+  }
+  arduino.ClearPacketStats();
+  CHECK(arduino.WriteReport(reportID, &report, sizeof(report)).IsOK());
+  CHECK(arduino.GetPacketStats().messageBytes == fullSize);
+  last = emulator.GetLastReport(reportID);
+  CHECK(last && memcmp(last->data(), &report, sizeof(report)) == 0);
+
+  // Reports in a batch are delta-encoded too
+  FAVJoyState2::Report batch[2] {};
+  const Arduino::ReportEntry entries[] {
+    {reportID, &batch[0], sizeof(batch[0])},
+    {reportID + 1, &batch[1], sizeof(batch[1])},
+  };
+  CHECK(arduino.WriteReports(entries).IsOK());
+  batch[0].x = 1234;
+  batch[1].SetButton(100);
+  arduino.ClearPacketStats();
+  CHECK(arduino.WriteReports(entries).IsOK());
+  // Header, count, and two full entries
+  CHECK(
+    arduino.GetPacketStats().messageBytes
+    < sizeof(ShortMessageHeader) + 1
+      + (2 * (sizeof(MultiReportEntryHeader) + sizeof(FAVJoyState2::Report))));
+  for (uint8_t i = 0; i < 2; ++i) {
+    last = emulator.GetLastReport(reportID + i);
+    CHECK(last && memcmp(last->data(), &batch[i], sizeof(batch[i])) == 0);
+  }
+}
+
+static void test_timestamped_reports(Arduino& arduino, Emulator& emulator) {
+  constexpr uint8_t reportID = FIRST_AVAILABLE_REPORT_ID;
+  CHECK(arduino.SetTimestampedReports(true));
+  arduino.ClearReportLatency();
+
+  FAVJoyState2::Report report {};
+  for (int16_t i = 0; i < 10; ++i) {
+    report.y = i;
+    CHECK(arduino.WriteReport(reportID, &report, sizeof(report)).IsOK());
+  }
+  const auto last = emulator.GetLastReport(reportID);
+  CHECK(last && memcmp(last->data(), &report, sizeof(report)) == 0);
+
+  const auto& latency = arduino.GetReportLatency();
+  CHECK(latency.toHID.GetCount() == 10);
+  // The emulator's clock is offset by 2^31us; if that wasn't corrected for,
+  // this would be about 35 minutes
+  CHECK(latency.toHID.GetMax() <= latency.roundTrip.GetMax());
+  CHECK(latency.toDevice.GetMax() <= latency.roundTrip.GetMax());
+
+  // Batches are timestamped too, even though the device supports
+  // `MultiReport`
+  CHECK(arduino.GetCapabilities().flags & Capability::MultiReport);
+  arduino.ClearReportLatency();
+  const Arduino::ReportEntry entries[] {
+    {reportID, &report, sizeof(report)},
+    {reportID + 1, &report, sizeof(report)},
+  };
+  CHECK(arduino.WriteReports(entries).IsOK());
+  CHECK(latency.toHID.GetCount() == 2);
+
+  CHECK(arduino.SetTimestampedReports(false));
+}
+
+static void test_recording(Arduino& arduino, Emulator& emulator) {
+  constexpr uint8_t reportID = FIRST_AVAILABLE_REPORT_ID;
+  wchar_t tempDir[MAX_PATH] {};
+  GetTempPathW(MAX_PATH, tempDir);
+  const auto path = std::format(
+    L"{}favhid-test-recording-{}.bin", tempDir, GetCurrentProcessId());
+  DeleteFileW(path.c_str());
+
+  FAVJoyState2::Report recorded {};
+  {
+    Recorder recorder(path);
+    arduino.SetRecorder(&recorder);
+    for (int16_t i = 0; i < 5; ++i) {
+      recorded.rz = i;
+      CHECK(arduino.WriteReport(reportID, &recorded, sizeof(recorded)).IsOK());
+    }
+    arduino.SetRecorder(nullptr);
+  }
+
+  FAVJoyState2::Report other {};
+  CHECK(arduino.WriteReport(reportID, &other, sizeof(other)).IsOK());
+
+  {
+    Replayer replayer(path);
+    size_t frameCount = 0;
+    replayer.ForEachFrame([&](const Replayer::Frame& frame) {
+      ++frameCount;
+      CHECK(frame.type == MessageType::Report);
+    });
+    CHECK(frameCount == 5);
+
+    const auto result
+      = replayer.Replay(arduino, Replayer::Timing::AsFastAsPossible);
+    CHECK(result.frameCount == 5);
+    CHECK(result.failureCount == 0);
+  }
+  const auto last = emulator.GetLastReport(reportID);
+  CHECK(last && memcmp(last->data(), &recorded, sizeof(recorded)) == 0);
+
+  // Recording again replaces the file, rather than appending to it
+  {
+    Recorder recorder(path);
+    recorder.RecordReport(reportID, &recorded, sizeof(recorded));
+  }
+  {
+    Replayer replayer(path);
+    size_t frameCount = 0;
+    replayer.ForEachFrame([&](const Replayer::Frame&) { ++frameCount; });
+    CHECK(frameCount == 1);
+  }
+
+  DeleteFileW(path.c_str());
+}
+
+static void test_capabilities(Arduino& arduino, Emulator& emulator) {
+  CHECK(arduino.GetCapabilities().flags & Capability::MultiReport);
+  CHECK(arduino.GetCapabilities().flags & Capability::DeltaReport);
+
+  FAVJoyState2::Report reports[2] {};
+  reports[0].SetButton(4);
+  reports[1].SetButton(5);
+  const Arduino::ReportEntry entries[] {
+    {FIRST_AVAILABLE_REPORT_ID, &reports[0], sizeof(reports[0])},
+    {FIRST_AVAILABLE_REPORT_ID + 1, &reports[1], sizeof(reports[1])},
+  };
+
+  // Only room for one report per message, so it must be split; two
+  // messages are sent before waiting for a response
+  emulator.SetCapabilities(Capabilities {
+    .flags = Capability::MultiReport,
+    .maxInFlightRequests = 2,
+    .maxDataLength = 1 + sizeof(MultiReportEntryHeader) + sizeof(reports[0]),
+  });
+  CHECK(arduino.ResetUSB());
+  CHECK(arduino.GetCapabilities().flags == Capability::MultiReport);
+  CHECK(arduino.WriteReports(entries).IsOK());
+  auto last = emulator.GetLastReport(FIRST_AVAILABLE_REPORT_ID + 1);
+  CHECK(last && memcmp(last->data(), &reports[1], sizeof(reports[1])) == 0);
+
+  // Statuses are still in order
+  const Arduino::ReportEntry withFailure[] {
+    entries[0],
+    {FIRST_AVAILABLE_REPORT_ID + 2, &reports[1], sizeof(reports[1])},
+    entries[1],
+  };
+  const auto response = arduino.WriteReports(withFailure);
+  CHECK(response.type == MessageType::Response_MultiReportFailed);
+  const std::string statuses {
+    static_cast<char>(MessageType::Response_OK),
+    static_cast<char>(MessageType::Response_HIDWriteFailed),
+    static_cast<char>(MessageType::Response_OK),
+  };
+  CHECK(response.data == statuses);
+
+  // Entries are checked before anything is sent, so an oversized entry in a
+  // later batch can't leave responses to earlier batches unread
+  const char oversized[sizeof(reports[0]) + 1] {};
+  const Arduino::ReportEntry withOversized[] {
+    entries[0],
+    entries[1],
+    entries[0],
+    {FIRST_AVAILABLE_REPORT_ID, oversized, sizeof(oversized)},
+  };
+  bool threw = false;
+  try {
+    (void)arduino.WriteReports(withOversized);
+  } catch (const std::logic_error&) {
+    threw = true;
+  }
+  CHECK(threw);
+  CHECK(arduino.GetSerialNumber() == emulator.GetSerialNumber());
+
+  // The device can buffer 2 messages, so the status of unacknowledged
+  // reports must be checked after every report, whatever the interval
+  emulator.SetCapabilities(Capabilities {
+    .flags = Capability::UnacknowledgedReport,
+    .maxInFlightRequests = 2,
+  });
+  CHECK(arduino.ResetUSB());
+  CHECK(arduino.SetUnacknowledgedReports(1000));
+  CHECK(!arduino
+           .WriteReport(
+             FIRST_AVAILABLE_REPORT_ID + 2, &reports[0], sizeof(reports[0]))
+           .IsOK());
+  CHECK(arduino.SetUnacknowledgedReports(0));
+
+  // ... and there's no room for a report and a status request
+  emulator.SetCapabilities(Capabilities {
+    .flags = Capability::UnacknowledgedReport,
+    .maxInFlightRequests = 1,
+  });
+  CHECK(arduino.ResetUSB());
+  CHECK(!arduino.SetUnacknowledgedReports(1000));
+
+  // No optional features; must fall back to individual `Report` messages
+  emulator.SetCapabilities(Capabilities {});
+  CHECK(arduino.ResetUSB());
+  CHECK(arduino.GetCapabilities().flags == 0);
+  reports[0].SetButton(6);
+  CHECK(arduino.WriteReports(entries).IsOK());
+  reports[0].x = 42;
+  CHECK(arduino.WriteReport(
+    FIRST_AVAILABLE_REPORT_ID, &reports[0], sizeof(reports[0])).IsOK());
+  last = emulator.GetLastReport(FIRST_AVAILABLE_REPORT_ID);
+  CHECK(last && memcmp(last->data(), &reports[0], sizeof(reports[0])) == 0);
+
+  // Firmware without `GetCapabilities` has no optional features, but still
+  // works
+  emulator.SetCapabilities({});
+  CHECK(arduino.ResetUSB());
+  CHECK(arduino.GetCapabilities().flags == 0);
+  CHECK(arduino.WriteReports(entries).IsOK());
+  CHECK(arduino.WriteReport(
+    FIRST_AVAILABLE_REPORT_ID, &reports[1], sizeof(reports[1])).IsOK());
+  last = emulator.GetLastReport(FIRST_AVAILABLE_REPORT_ID);
+  CHECK(last && memcmp(last->data(), &reports[1], sizeof(reports[1])) == 0);
+}
+
+static void test_unacknowledged_reports(Arduino& arduino, Emulator& emulator) {
+  constexpr uint8_t reportID = FIRST_AVAILABLE_REPORT_ID;
+  CHECK(arduino.SetUnacknowledgedReports(4));
+
+  FAVJoyState2::Report report {};
+  for (int16_t i = 0; i < 10; ++i) {
+    report.x = i;
+    CHECK(arduino.WriteReport(reportID, &report, sizeof(report)).IsOK());
+  }
+  auto stats = arduino.GetUnacknowledgedReportStats();
+  CHECK(stats.sentCount == 10);
+  CHECK(stats.GetLostCount() == 0);
+  CHECK(stats.failedCount == 0);
+  CHECK(stats.outOfSequenceCount == 0);
+  CHECK(stats.isLatestReceived);
+  auto last = emulator.GetLastReport(reportID);
+  CHECK(last && memcmp(last->data(), &report, sizeof(report)) == 0);
+
+  // Batches are unacknowledged too, even though the device supports
+  // `MultiReport`
+  CHECK(arduino.GetCapabilities().flags & Capability::MultiReport);
+  FAVJoyState2::Report batch[2] {};
+  batch[0].x = 100;
+  batch[1].x = 200;
+  const Arduino::ReportEntry entries[] {
+    {reportID, &batch[0], sizeof(batch[0])},
+    {reportID + 1, &batch[1], sizeof(batch[1])},
+  };
+  CHECK(arduino.WriteReports(entries).IsOK());
+  stats = arduino.GetUnacknowledgedReportStats();
+  CHECK(stats.sentCount == 12);
+  CHECK(stats.isLatestReceived);
+  last = emulator.GetLastReport(reportID + 1);
+  CHECK(last && memcmp(last->data(), &batch[1], sizeof(batch[1])) == 0);
+
+  // Failures are only reported by the periodic check
+  const auto badReportID = FIRST_AVAILABLE_REPORT_ID + 2;
+  bool failed = false;
+  for (int i = 0; i < 4; ++i) {
+    const auto response
+      = arduino.WriteReport(badReportID, &report, sizeof(report));
+    failed = failed || !response.IsOK();
+  }
+  CHECK(failed);
+  stats = arduino.GetUnacknowledgedReportStats();
+  CHECK(stats.failedCount == 4);
+  CHECK(stats.lastFailure == MessageType::Response_HIDWriteFailed);
+
+  CHECK(arduino.SetUnacknowledgedReports(0));
+}
+
+// Sequence numbers are checked by the device, so test it directly
+static void test_unacknowledged_sequence() {
+  Emulator emulator;
+  CHECK(
+    emulator.Process("FAVHID" FAVHID_PROTO_VERSION)
+    == "ACKVER" FAVHID_PROTO_VERSION);
+
+  const auto message = [](MessageType type, std::string_view data) {
+    std::string ret {
+      static_cast<char>(type), static_cast<char>(data.size())};
+    ret.append(data);
+    return ret;
+  };
+
+  // A gap, then a report that's behind
+  std::string reports;
+  for (const char sequence: {0, 1, 3, 2}) {
+    const char data[] {sequence, FIRST_AVAILABLE_REPORT_ID};
+    reports += message(
+      MessageType::UnacknowledgedReport, {data, sizeof(data)});
+  }
+  CHECK(emulator.Process(reports).empty());
+
+  const auto response = emulator.Process(
+    message(MessageType::GetUnacknowledgedReportStatus, {}));
+  UnacknowledgedReportStatus status {};
+  CHECK(response.size() == sizeof(ShortMessageHeader) + sizeof(status));
+  if (response.size() == sizeof(ShortMessageHeader) + sizeof(status)) {
+    memcpy(
+      &status, response.data() + sizeof(ShortMessageHeader), sizeof(status));
+  }
+  CHECK(status.receivedCount == 4);
+  CHECK(status.outOfSequenceCount == 2);
+  CHECK(status.lastSequence == 2);
+}
+
+static void test_packet_alignment(Arduino& arduino, Emulator& emulator) {
+  constexpr uint8_t reportID = FIRST_AVAILABLE_REPORT_ID;
+  // Header, sequence, and report ID
+  constexpr size_t messageSize = sizeof(FAVJoyState2::Report) + 4;
+  static_assert(messageSize * 2 > Arduino::USB_PACKET_SIZE);
+  const auto capabilities = arduino.GetCapabilities();
+  CHECK(arduino.SetUnacknowledgedReports(1000));
+
+  // Separate writes are separate transfers, so each starts a new packet
+  FAVJoyState2::Report reports[3] {};
+  arduino.ClearPacketStats();
+  for (int16_t i = 0; i < 2; ++i) {
+    reports[i].x = i;
+    CHECK(
+      arduino.WriteReport(reportID, &reports[i], sizeof(reports[i])).IsOK());
+  }
+  auto stats = arduino.GetPacketStats();
+  CHECK(stats.transferCount == 2);
+  CHECK(stats.messageCount == 2);
+  CHECK(stats.splitMessageCount == 0);
+  CHECK(stats.packetCount == 2);
+
+  // Without multi-report messages, unacknowledged reports are coalesced
+  // into a single transfer
+  emulator.SetCapabilities(Capabilities {
+    .flags = Capability::UnacknowledgedReport | Capability::PacketPadding,
+    .maxInFlightRequests = capabilities.maxInFlightRequests,
+  });
+  CHECK(arduino.ResetUSB());
+  CHECK(arduino.SetUnacknowledgedReports(1000));
+  std::vector<Arduino::ReportEntry> entries;
+  for (int16_t i = 0; i < 3; ++i) {
+    reports[i].x = i + 1;
+    entries.push_back({reportID, &reports[i], sizeof(reports[i])});
+  }
+  arduino.ClearPacketStats();
+  CHECK(arduino.WriteReports(entries).IsOK());
+  stats = arduino.GetPacketStats();
+  CHECK(stats.transferCount == 1);
+  CHECK(stats.messageCount == 3);
+  CHECK(stats.splitMessageCount == 1);
+  CHECK(stats.packetCount == 2);
+
+  // Padding keeps each message within a packet of the transfer
+  CHECK(arduino.SetPacketAlignment(true));
+  arduino.ClearPacketStats();
+  CHECK(arduino.WriteReports(entries).IsOK());
+  stats = arduino.GetPacketStats();
+  CHECK(stats.transferCount == 1);
+  CHECK(stats.messageCount == 3);
+  CHECK(stats.splitMessageCount == 0);
+  CHECK(stats.packetCount == 3);
+  CHECK(stats.paddingBytes == 2 * (Arduino::USB_PACKET_SIZE - messageSize));
+  CHECK(stats.GetEfficiency() < 0.7);
+
+  // The device skipped the padding
+  CHECK(arduino.GetUnacknowledgedReportStats().GetLostCount() == 0);
+  const auto last = emulator.GetLastReport(reportID);
+  CHECK(last && memcmp(last->data(), &reports[2], sizeof(reports[2])) == 0);
+
+  CHECK(arduino.SetPacketAlignment(false));
+  CHECK(arduino.SetUnacknowledgedReports(0));
+  emulator.SetCapabilities(capabilities);
+  CHECK(arduino.ResetUSB());
+}
+
+static void test_device_events(Arduino& arduino, Emulator& emulator) {
+  constexpr uint8_t reportID = FIRST_AVAILABLE_REPORT_ID;
+  std::vector<Arduino::DeviceEvent> events;
+
+  // Dropped, as events aren't enabled yet
+  emulator.SendDeviceEvent(DeviceEventType::OutputReport, reportID, "\x01");
+  CHECK(arduino.SetDeviceEventCallback(
+    [&events](const auto& event) { events.push_back(event); }));
+  CHECK(events.empty());
+
+  // Delivered while waiting for a response
+  emulator.SendDeviceEvent(DeviceEventType::OutputReport, reportID, "\x02");
+  CHECK(arduino.GetVolatileConfigID() == emulator.GetVolatileConfigID());
+  CHECK(events.size() == 1);
+  CHECK(
+    events.size() == 1 && events[0].type == DeviceEventType::OutputReport
+    && events[0].reportID == reportID && events[0].report == "\x02");
+
+  // Unacknowledged reports have no response, so it must be polled for
+  CHECK(arduino.SetUnacknowledgedReports(1000));
+  const std::string feature {"\0\x03", 2};
+  emulator.SendDeviceEvent(DeviceEventType::FeatureReport, reportID, feature);
+  FAVJoyState2::Report report {};
+  CHECK(arduino.WriteReport(reportID, &report, sizeof(report)).IsOK());
+  const auto deadline
+    = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+  while (arduino.PollDeviceEvents() == 0
+         && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  CHECK(
+    events.size() == 2 && events[1].type == DeviceEventType::FeatureReport
+    && events[1].report == feature);
+  CHECK(arduino.SetUnacknowledgedReports(0));
+
+  // Sent straight away, even if the client isn't writing anything
+  emulator.SendDeviceEvent(DeviceEventType::OutputReport, reportID, "\x05");
+  const auto idleDeadline
+    = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+  while (arduino.PollDeviceEvents() == 0
+         && std::chrono::steady_clock::now() < idleDeadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  CHECK(events.size() == 3 && events[2].report == "\x05");
+
+  CHECK(arduino.SetDeviceEventCallback({}));
+  emulator.SendDeviceEvent(DeviceEventType::OutputReport, reportID, "\x04");
+  arduino.GetVolatileConfigID();
+  CHECK(arduino.PollDeviceEvents() == 0);
+  CHECK(events.size() == 3);
+}
+
+static void test_supervised(std::wstring_view pipeName) {
+  Emulator emulator;
+  // Started later, but stopped after `device`
+  std::jthread server;
+
+  const DeviceProfile profiles[1] {};
+  SupervisedFAVJoyState2 device {
+    profiles,
+    [pipeName, &profiles]() -> std::optional<FAVJoyState2> {
+      auto arduino = Arduino::OpenPath(pipeName);
+      if (!arduino) {
+        return {};
+      }
+      return FAVJoyState2::Open(std::move(*arduino), profiles);
+    },
+    std::chrono::milliseconds {10},
+  };
+
+  // Writes don't wait for the device, and only the latest is kept
+  FAVJoyState2::Report report {};
+  report.x = 123;
+  device.WriteReport(report, 0);
+  report.x = 456;
+  device.WriteReport(report, 0);
+  CHECK(!device.IsConnected());
+
+  server = std::jthread {
+    [&](std::stop_token stop) { emulator.Serve(pipeName, stop); }};
+  std::optional<std::string> last;
+  for (int i = 0; i < 100 && !last; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    last = emulator.GetLastReport(FIRST_AVAILABLE_REPORT_ID);
+  }
+  CHECK(last && memcmp(last->data(), &report, sizeof(report)) == 0);
+  CHECK(device.IsConnected());
+  CHECK(device.GetConnectionCount() == 1);
+  CHECK(emulator.GetDescriptors().size() == 1);
+
+  // Writes while the device is gone are replayed when it comes back
+  server.request_stop();
+  server.join();
+  report.x = 789;
+  device.WriteReport(report, 0);
+  for (int i = 0; i < 100 && device.IsConnected(); ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  CHECK(!device.IsConnected());
+  last = emulator.GetLastReport(FIRST_AVAILABLE_REPORT_ID);
+  CHECK(last && memcmp(last->data(), &report, sizeof(report)) != 0);
+
+  server = std::jthread {
+    [&](std::stop_token stop) { emulator.Serve(pipeName, stop); }};
+  bool replayed = false;
+  for (int i = 0; i < 100 && !replayed; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    last = emulator.GetLastReport(FIRST_AVAILABLE_REPORT_ID);
+    replayed = last && memcmp(last->data(), &report, sizeof(report)) == 0;
+  }
+  CHECK(replayed);
+  CHECK(device.IsConnected());
+  CHECK(device.GetConnectionCount() == 2);
+}
+
+static void test_pending(std::wstring_view pipeName) {
+  Emulator emulator;
+  std::jthread server {
+    [&](std::stop_token stop) { emulator.Serve(pipeName, stop); }};
+  const auto open = [pipeName]() { return OpenEmulator(pipeName); };
+
+  const DeviceProfile profiles[2] {};
+  const auto config = FAVJoyState2::GetConfiguration(profiles);
+  std::vector<PendingFAVJoyState2::Phase> phases;
+  PendingFAVJoyState2 pending {
+    config, open, [&phases](auto phase) { phases.push_back(phase); }};
+  CHECK(pending.WaitFor(std::chrono::seconds(10)));
+  auto device = pending.Get();
+  CHECK(device.has_value());
+  CHECK(pending.GetPhase() == PendingFAVJoyState2::Phase::Ready);
+  using enum PendingFAVJoyState2::Phase;
+  CHECK(
+    (phases
+     == std::vector {Discovering, PushingDescriptors, Reenumerating, Ready}));
+  CHECK(emulator.GetVolatileConfigID() == config.configID);
+  device.reset();
+
+  // Already configured
+  phases.clear();
+  PendingFAVJoyState2 reopen {
+    config, open, [&phases](auto phase) { phases.push_back(phase); }};
+  CHECK(reopen.Get().has_value());
+  CHECK((phases == std::vector {Discovering, Ready}));
+
+  // Cancelled while discovering, so nothing is pushed
+  const DeviceProfile otherProfiles[1] {};
+  PendingFAVJoyState2 cancelled {
+    FAVJoyState2::GetConfiguration(otherProfiles),
+    [&]() {
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      return open();
+    }};
+  cancelled.Cancel();
+  CHECK(!cancelled.Get());
+  CHECK(emulator.GetVolatileConfigID() == config.configID);
+
+  // Cancelled while waiting for the Arduino to come back from a hard reset
+  std::promise<void> resetting;
+  PendingFAVJoyState2 cancelledReset {
+    FAVJoyState2::GetConfiguration(otherProfiles),
+    open,
+    [&resetting](auto phase) {
+      if (phase == Resetting) {
+        resetting.set_value();
+      }
+    }};
+  resetting.get_future().wait();
+  const auto cancelledAt = std::chrono::steady_clock::now();
+  cancelledReset.Cancel();
+  CHECK(!cancelledReset.Get());
+  CHECK(
+    std::chrono::steady_clock::now() - cancelledAt < std::chrono::seconds(1));
+}
+
+static void test_sharded() {
+  Emulator emulators[2];
+  std::vector<std::jthread> servers;
+
+  const DeviceProfile profiles[2] {};
+  std::vector<FAVJoyState2> boards;
+  for (size_t i = 0; i < std::size(emulators); ++i) {
+    const auto pipeName = std::format(
+      L"\\\\.\\pipe\\favhid-test-sharded-{}-{}", GetCurrentProcessId(), i);
+    servers.emplace_back([&emulator = emulators[i], pipeName](
+                           std::stop_token stop) {
+      emulator.Serve(pipeName, stop);
+    });
+    auto arduino = OpenEmulator(pipeName);
+    CHECK(arduino.has_value());
+    if (!arduino) {
+      return;
+    }
+    boards.push_back(FAVJoyState2::Open(std::move(*arduino), profiles));
+  }
+
+  ShardedFAVJoyState2 sharded {std::move(boards)};
+  CHECK(sharded.GetDeviceCount() == 4);
+  const auto location = sharded.GetLocation(3);
+  CHECK(location.board == 1 && location.deviceIndex == 1);
+
+  // Fewer reports than devices; the last device isn't written
+  FAVJoyState2::Report reports[3] {};
+  for (uint8_t i = 0; i < std::size(reports); ++i) {
+    reports[i].SetButton(i);
+  }
+  sharded.WriteReports(reports);
+  auto last = emulators[0].GetLastReport(FIRST_AVAILABLE_REPORT_ID + 1);
+  CHECK(last && memcmp(last->data(), &reports[1], sizeof(reports[1])) == 0);
+  last = emulators[1].GetLastReport(FIRST_AVAILABLE_REPORT_ID);
+  CHECK(last && memcmp(last->data(), &reports[2], sizeof(reports[2])) == 0);
+  CHECK(!emulators[1].GetLastReport(FIRST_AVAILABLE_REPORT_ID + 1));
+
+  sharded.WriteReport(reports[0], 3);
+  last = emulators[1].GetLastReport(FIRST_AVAILABLE_REPORT_ID + 1);
+  CHECK(last && memcmp(last->data(), &reports[0], sizeof(reports[0])) == 0);
+}
+
+int main() {
+  const auto pipeName = std::format(
+    L"\\\\.\\pipe\\favhid-test-emulator-{}", GetCurrentProcessId());
+
+  Emulator emulator;
+  std::jthread server(
+    [&](std::stop_token stop) { emulator.Serve(pipeName, stop); });
+
+  auto arduino = OpenEmulator(pipeName);
+  CHECK(arduino.has_value());
+  if (!arduino) {
+    return 1;
+  }
+
+  test_config(*arduino, emulator);
+  test_multi_report(*arduino, emulator);
+  test_delta_report(*arduino, emulator);
+  test_unacknowledged_reports(*arduino, emulator);
+  test_packet_alignment(*arduino, emulator);
+  test_timestamped_reports(*arduino, emulator);
+  test_device_events(*arduino, emulator);
+  test_recording(*arduino, emulator);
+  test_capabilities(*arduino, emulator);
+
+  test_unacknowledged_sequence();
+  test_supervised(std::format(
+    L"\\\\.\\pipe\\favhid-test-supervised-{}", GetCurrentProcessId()));
+  test_sharded();
+  test_pending(std::format(
+    L"\\\\.\\pipe\\favhid-test-pending-{}", GetCurrentProcessId()));
+
+  return gFailures ? 1 : 0;
+}
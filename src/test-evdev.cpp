@@ -0,0 +1,127 @@
+// Copyright 2023 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: ISC
+
+#include "favhid/Evdev.hpp"
+#include "test-check.hpp"
+
+
+#ifdef __linux__
+#include <linux/input.h>
+#include <unistd.h>
+#endif
+
+using namespace FAVHID;
+
+static const EvdevTranslator::AxisInfo TEST_AXES[] {
+  {Evdev::AbsX, 0, 1023},
+  {Evdev::AbsY, -512, 511},
+};
+
+static void test_translator() {
+  auto translator = EvdevTranslator::CreateDefault(TEST_AXES);
+  const auto& report = translator.GetReport();
+
+  // Nothing is visible until the end of the frame
+  CHECK(!translator.Process({Evdev::EventAbsolute, Evdev::AbsX, 1023}));
+  CHECK(!translator.Process({Evdev::EventKey, Evdev::ButtonJoystick + 1, 1}));
+  CHECK(report.x == 0);
+  CHECK(translator.Process({Evdev::EventSync, Evdev::SyncReport, 0}));
+  CHECK(report.x == INT16_MAX);
+  CHECK(report.buttons[0] == 0b10);
+
+  const EvdevEvent frame[] {
+    {Evdev::EventAbsolute, Evdev::AbsY, -512},
+    {Evdev::EventAbsolute, Evdev::AbsHat0X, 1},
+    {Evdev::EventAbsolute, Evdev::AbsHat0X + 1, -1},
+    {Evdev::EventKey, Evdev::ButtonTriggerHappy, 1},
+    {Evdev::EventSync, Evdev::SyncReport, 0},
+  };
+  CHECK(translator.Process(frame));
+  CHECK(report.y == INT16_MIN);
+  // Hat 0 NE; the others centered
+  CHECK(report.povs[1] == 0b00011111);
+  CHECK(report.povs[0] == 0xff);
+  CHECK(report.buttons[32 / 8] == 0b1);
+
+  // Unchanged frames aren't reported
+  CHECK(!translator.Process({Evdev::EventSync, Evdev::SyncReport, 0}));
+
+  // Dropped frames are ignored, then a resync is needed
+  const EvdevEvent dropped[] {
+    {Evdev::EventSync, Evdev::SyncDropped, 0},
+    {Evdev::EventAbsolute, Evdev::AbsX, 0},
+    {Evdev::EventSync, Evdev::SyncReport, 0},
+  };
+  CHECK(!translator.Process(dropped));
+  CHECK(report.x == INT16_MAX);
+  CHECK(translator.IsResyncNeeded());
+  const EvdevEvent resync[] {
+    {Evdev::EventAbsolute, Evdev::AbsX, 0},
+    {Evdev::EventSync, Evdev::SyncReport, 0},
+  };
+  CHECK(translator.Process(resync));
+  CHECK(!translator.IsResyncNeeded());
+  CHECK(report.x == INT16_MIN);
+}
+
+#ifdef __linux__
+static input_event
+MakeEvent(uint16_t type, uint16_t code, int32_t value = 0) {
+  input_event ret {};
+  ret.type = type;
+  ret.code = code;
+  ret.value = value;
+  return ret;
+}
+
+static void test_pipe_source() {
+  int fds[2] {};
+  CHECK(pipe(fds) == 0);
+
+  // Two frames in one write; only the latest should be reported
+  const input_event events[] {
+    MakeEvent(EV_ABS, ABS_X, 1023),
+    MakeEvent(EV_SYN, SYN_REPORT),
+    MakeEvent(EV_KEY, BTN_TRIGGER, 1),
+    MakeEvent(EV_SYN, SYN_REPORT),
+  };
+  // Split mid-event, like a pipe can
+  const auto bytes = reinterpret_cast<const char*>(events);
+  constexpr auto firstWrite = sizeof(input_event) + 3;
+  CHECK(write(fds[1], bytes, firstWrite) == firstWrite);
+
+  EvdevSource source;
+  source.AddFD(fds[0], 2, EvdevTranslator::CreateDefault(TEST_AXES));
+
+  size_t callbacks = 0;
+  FAVJoyState2Report last {};
+  const auto callback = [&](uint8_t deviceIndex, const auto& report) {
+    CHECK(deviceIndex == 2);
+    ++callbacks;
+    last = report;
+  };
+
+  CHECK(source.Poll(std::chrono::milliseconds {100}, callback));
+  CHECK(callbacks == 0);
+
+  CHECK(
+    write(fds[1], bytes + firstWrite, sizeof(events) - firstWrite)
+    == sizeof(events) - firstWrite);
+  CHECK(source.Poll(std::chrono::milliseconds {100}, callback));
+  CHECK(callbacks == 1);
+  CHECK(last.x == INT16_MAX);
+  CHECK(last.buttons[0] == 0b1);
+
+  close(fds[1]);
+  CHECK(!source.Poll(std::chrono::milliseconds {100}, callback));
+  close(fds[0]);
+}
+#endif
+
+int main() {
+  test_translator();
+#ifdef __linux__
+  test_pipe_source();
+#endif
+  return gFailures ? 1 : 0;
+}
@@ -29,8 +29,75 @@ static void test_hat_math() {
   #undef CHECK
 }
 
+static void test_bulk_mutators() {
+  #define CHECK(x) std::cout << ((x) ? "OK: ": "FAIL: ") << #x << std::endl;
+
+  FAVHID::FAVJoyState2::Report report {};
+  report.SetPOVs(0x321f);
+  CHECK(report.povs[1] == 0xf1);
+  CHECK(report.povs[0] == 0x23);
+
+  const int16_t axes[8] {1, 2, 3, 4, 5, 6, 7, 8};
+  report.SetAxes(axes);
+  CHECK(report.x == 1 && report.rz == 6 && report.slider[1] == 8);
+
+  DIJOYSTATE2 di {};
+  di.rgbButtons[0] = 0x80;
+  di.rgbButtons[9] = 0xff;
+  di.rgbButtons[127] = 0x80;
+  di.rgbButtons[126] = 0x7f;
+  di.rgdwPOV[0] = 9000;
+  di.rgdwPOV[1] = di.rgdwPOV[2] = di.rgdwPOV[3] = 0xffffffff;
+  report = FAVHID::FAVJoyState2::ToReport(di);
+  CHECK(report.buttons[0] == 0b1);
+  CHECK(report.buttons[1] == 0b10);
+  CHECK(report.buttons[15] == 0b10000000);
+  CHECK(report.povs[1] == 0b00101111);
+  CHECK(report.povs[0] == 0xff);
+
+  #undef CHECK
+}
+
+static void test_profiles() {
+  #define CHECK(x) std::cout << ((x) ? "OK: ": "FAIL: ") << #x << std::endl;
+
+  using namespace FAVHID;
+  CHECK(
+    DeviceProfile {}.GetDescriptor(FIRST_AVAILABLE_REPORT_ID)
+    == FAVJoyState2::GetDescriptor(0));
+
+  using ButtonBox = Profile<0, 8, 1, 12>;
+  ButtonBox::Report report;
+  CHECK(report.size() == 3);
+  CHECK(report.data()[0] == 0xff);
+  report.SetPOV(0, 2);
+  report.SetButton(9);
+  CHECK(report.data()[0] == 0xf2);
+  CHECK(report.data()[2] == 0b10);
+
+  // Acceleration and force reuse the X..Rz usages, qualified by units
+  using Motion = Profile<
+    0,
+    16,
+    0,
+    0,
+    ExtraAxes::Acceleration | ExtraAxes::Force>;
+  CHECK(Motion::Description.GetTotalAxisCount() == 12);
+  CHECK(Motion::Report {}.size() == 24);
+  const auto motion = Motion::Description.GetDescriptor(1);
+  // Unit (m/s^2), then Unit (N*m), then cleared
+  CHECK(motion.find("\x66\x11\xe0") != std::string::npos);
+  CHECK(motion.find("\x66\x21\xe1") != std::string::npos);
+  CHECK(motion.find(std::string {"\x65\x00", 2}) != std::string::npos);
+  CHECK(!DeviceProfile {.extraAxes = static_cast<ExtraAxes>(1 << 7)}.IsValid());
+
+  #undef CHECK
+}
+
 static void unit_tests() {
   test_hat_math();
+  test_bulk_mutators();
+  test_profiles();
 }
 
 int main() {
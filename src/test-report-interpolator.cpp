@@ -0,0 +1,108 @@
+// Copyright 2023 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: ISC
+
+#include "favhid/ReportInterpolator.hpp"
+#include "test-check.hpp"
+
+#include <thread>
+
+using namespace FAVHID;
+
+int main() {
+  using namespace std::chrono_literals;
+  using Mode = ReportInterpolator::Mode;
+  const ReportInterpolator::Clock::time_point start {};
+
+  FAVJoyState2Report report {};
+  report.x = 1000;
+  report.slider[1] = -1000;
+  report.SetButton(0);
+
+  // The first report is used as-is
+  ReportInterpolator interpolator {2, Mode::Interpolate};
+  CHECK(interpolator.GetDeviceCount() == 2);
+  interpolator.Submit(report, 0, start);
+  CHECK(interpolator.Sample(0, start).x == 1000);
+  CHECK(interpolator.Sample(0, start + 5ms).slider[1] == -1000);
+  CHECK(interpolator.Sample(1, start).x == 0);
+
+  // Later reports are reached after the producer's interval
+  report.x = 2000;
+  report.slider[1] = 1000;
+  report.SetButton(0, false);
+  report.SetButton(1);
+  interpolator.Submit(report, 0, start + 20ms);
+  auto sample = interpolator.Sample(0, start + 20ms);
+  CHECK(sample.x == 1000);
+  // Buttons aren't delayed
+  CHECK(sample.buttons[0] == 0b10);
+  sample = interpolator.Sample(0, start + 25ms);
+  CHECK(sample.x == 1250);
+  CHECK(sample.slider[1] == -500);
+  CHECK(interpolator.Sample(0, start + 40ms).x == 2000);
+  CHECK(interpolator.Sample(0, start + 60ms).x == 2000);
+
+  // A new report part-way through starts from the current output
+  report.x = 1000;
+  interpolator.Submit(report, 0, start + 50ms);
+  CHECK(interpolator.Sample(0, start + 65ms).x == 1500);
+  report.x = 0;
+  interpolator.Submit(report, 0, start + 65ms);
+  CHECK(interpolator.Sample(0, start + 65ms).x == 1500);
+  CHECK(interpolator.Sample(0, start + 70ms).x == 1000);
+  CHECK(interpolator.Sample(0, start + 80ms).x == 0);
+
+  // Producers that pause don't cause a slow ramp
+  report.x = -1000;
+  interpolator.Submit(report, 0, start + 1s);
+  CHECK(interpolator.Sample(0, start + 1s).x == -1000);
+
+  // Extrapolation continues the last movement, for a limited time
+  ReportInterpolator extrapolator {1, Mode::Extrapolate, 250ms, 10ms};
+  report.x = 0;
+  extrapolator.Submit(report, 0, start);
+  report.x = 1000;
+  extrapolator.Submit(report, 0, start + 10ms);
+  CHECK(extrapolator.Sample(0, start + 10ms).x == 1000);
+  CHECK(extrapolator.Sample(0, start + 15ms).x == 1500);
+  CHECK(extrapolator.Sample(0, start + 20ms).x == 2000);
+  // ... then returns to the latest report
+  CHECK(extrapolator.Sample(0, start + 25ms).x == 1500);
+  CHECK(extrapolator.Sample(0, start + 30ms).x == 1000);
+  CHECK(extrapolator.Sample(0, start + 40ms).x == 1000);
+
+  // ... and is clamped to the axis range
+  report.x = 30000;
+  extrapolator.Submit(report, 0, start + 20ms);
+  CHECK(extrapolator.Sample(0, start + 25ms).x == INT16_MAX);
+  CHECK(extrapolator.Sample(0, start + 40ms).x == 30000);
+
+  FAVJoyState2Report reports[2] {};
+  interpolator.Sample(reports, start + 1s);
+  CHECK(reports[0].x == -1000);
+  CHECK(reports[1].x == 0);
+
+  // Producers can submit while another thread samples
+  constexpr int16_t SUBMITS = 20000;
+  ReportInterpolator threaded {1, Mode::Interpolate};
+  std::jthread producer([&threaded]() {
+    FAVJoyState2Report report {};
+    for (int16_t i = 1; i <= SUBMITS; ++i) {
+      const int16_t axes[8] {i, i, i, i, i, i, i, i};
+      report.SetAxes(axes);
+      threaded.Submit(report, 0);
+    }
+  });
+  bool consistent = true;
+  int16_t lastSampled = 0;
+  while (lastSampled != SUBMITS) {
+    const auto sample = threaded.Sample(0);
+    consistent = consistent && sample.y == sample.x
+      && sample.slider[1] == sample.x && sample.x >= lastSampled;
+    lastSampled = sample.x;
+  }
+  producer.join();
+  CHECK(consistent);
+
+  return gFailures == 0 ? 0 : 1;
+}
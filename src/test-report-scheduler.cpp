@@ -0,0 +1,80 @@
+// Copyright 2023 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: ISC
+
+#include "favhid/ReportScheduler.hpp"
+#include "test-check.hpp"
+
+#include <thread>
+
+using namespace FAVHID;
+
+int main() {
+  using namespace std::chrono_literals;
+  using Lane = ReportScheduler::Lane;
+  const ReportScheduler::Clock::time_point start {};
+
+  ReportScheduler scheduler {3, 10ms};
+  CHECK(!scheduler.Next(start));
+
+  // Button edges are sent before axis-only changes
+  FAVJoyState2Report moving {};
+  moving.x = 1000;
+  scheduler.Submit(moving, 0);
+  scheduler.Submit(moving, 1);
+  FAVJoyState2Report pressed {};
+  pressed.SetButton(5);
+  scheduler.Submit(pressed, 2);
+
+  auto next = scheduler.Next(start);
+  CHECK(next && next->deviceIndex == 2 && next->lane == Lane::Edge);
+  next = scheduler.Next(start);
+  CHECK(next && next->deviceIndex == 0 && next->lane == Lane::Axis);
+  next = scheduler.Next(start);
+  CHECK(next && next->deviceIndex == 1 && next->lane == Lane::Axis);
+  CHECK(!scheduler.Next(start));
+
+  // Releases are held for the minimum pulse width
+  scheduler.Submit({}, 2);
+  CHECK(!scheduler.Next(start + 5ms));
+  next = scheduler.Next(start + 10ms);
+  CHECK(next && next->deviceIndex == 2 && next->report.buttons[0] == 0);
+
+  // A press and release between sends is still sent
+  scheduler.Submit(pressed, 1);
+  scheduler.Submit(moving, 1);
+  next = scheduler.Next(start + 20ms);
+  CHECK(next && next->deviceIndex == 1 && next->lane == Lane::Edge);
+  CHECK(next && next->report.buttons[0] == 0b100000);
+  CHECK(!scheduler.Next(start + 25ms));
+  next = scheduler.Next(start + 30ms);
+  CHECK(next && next->deviceIndex == 1 && next->report.buttons[0] == 0);
+  CHECK(!scheduler.Next(start + 40ms));
+
+  // Producers can submit while another thread sends
+  constexpr int16_t SUBMITS = 20000;
+  ReportScheduler threaded {1};
+  std::jthread producer([&threaded]() {
+    FAVJoyState2Report report {};
+    for (int16_t i = 1; i <= SUBMITS; ++i) {
+      const int16_t axes[8] {i, i, i, i, i, i, i, i};
+      report.SetAxes(axes);
+      threaded.Submit(report, 0);
+    }
+  });
+  bool consistent = true;
+  int16_t lastSent = 0;
+  while (lastSent != SUBMITS) {
+    const auto sent = threaded.Next();
+    if (!sent) {
+      continue;
+    }
+    const auto& report = sent->report;
+    consistent = consistent && report.y == report.x
+      && report.slider[1] == report.x && report.x > lastSent;
+    lastSent = report.x;
+  }
+  producer.join();
+  CHECK(consistent);
+
+  return gFailures ? 1 : 0;
+}
@@ -0,0 +1,52 @@
+// Copyright 2023 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: ISC
+
+#include "favhid/Routing.hpp"
+#include "test-check.hpp"
+
+
+using namespace FAVHID;
+
+int main() {
+  using AxisHalf = RoutingBuilder::AxisHalf;
+  const auto table
+    = RoutingBuilder {}
+        .Axis(0, {.device = 0, .index = 0})
+        .Axis(0, {.device = 1, .index = 7}, /* invert = */ true)
+        .Axis(1, AxisHalf::Positive, {.device = 0, .index = 1})
+        .Axis(1, AxisHalf::Negative, {.device = 0, .index = 2})
+        .Button(0, {.device = 1, .index = 9})
+        .Button(1, {.device = 1, .index = 9})
+        .Hat(0, {.device = 0, .index = 3})
+        .HatFromButtons({2, 3, 4, 5}, {.device = 1, .index = 0})
+        .Compile();
+  CHECK(table.GetDeviceCount() == 2);
+
+  const int16_t axes[] {1234, INT16_MIN};
+  uint8_t buttons[] {0, 1, 1, 1, 0, 0};
+  const uint8_t hats[] {0b0100};
+
+  FAVJoyState2Report reports[2] {};
+  table.Evaluate({axes, buttons, hats}, reports);
+
+  CHECK(reports[0].x == 1234);
+  CHECK(reports[1].slider[1] == -1234);
+  // Trigger fully pulled towards the negative end
+  CHECK(reports[0].y == -INT16_MAX);
+  CHECK(reports[0].z == INT16_MAX);
+  CHECK(reports[1].buttons[1] == 0b10);
+  // Hat 3 is the low nibble of `povs[0]`
+  CHECK(reports[0].povs[0] == 0xf4);
+  CHECK(reports[0].povs[1] == 0xff);
+  // Up + right = NE; hat 0 is the high nibble of `povs[1]`
+  CHECK(reports[1].povs[1] == 0x1f);
+
+  // Reports are reset each time
+  buttons[1] = 0;
+  buttons[2] = 0;
+  table.Evaluate({axes, buttons, hats}, reports);
+  CHECK(reports[1].buttons[1] == 0);
+  CHECK(reports[1].povs[1] == 0x2f);
+
+  return gFailures ? 1 : 0;
+}
@@ -0,0 +1,203 @@
+// Copyright 2023 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: ISC
+
+#include "favhid/Arduino.hpp"
+#include "favhid/Emulator.hpp"
+#include "favhid/SharedReports.hpp"
+#include "test-check.hpp"
+
+#include <cstddef>
+#include <cstring>
+#include <format>
+#include <new>
+#include <stdexcept>
+#include <thread>
+
+using namespace FAVHID;
+
+namespace FAVHID {
+struct SharedReportSlotTestHook {
+  // Claim the slot, then never finish writing; returns the odd sequence
+  static uint32_t AbandonWrite(SharedReportSlot& slot) {
+    return slot.Claim();
+  }
+};
+}// namespace FAVHID
+
+static FAVJoyState2Report MakeReport(int16_t value) {
+  FAVJoyState2Report report {};
+  const int16_t axes[8] {
+    value, value, value, value, value, value, value, value};
+  report.SetAxes(axes);
+  memset(report.buttons, static_cast<uint8_t>(value), sizeof(report.buttons));
+  return report;
+}
+
+static bool Equals(const FAVJoyState2Report& a, const FAVJoyState2Report& b) {
+  return memcmp(&a, &b, sizeof(a)) == 0;
+}
+
+static bool LastReportEquals(
+  const Emulator& emulator,
+  uint8_t deviceIndex,
+  const FAVJoyState2Report& report) {
+  const auto last
+    = emulator.GetLastReport(FIRST_AVAILABLE_REPORT_ID + deviceIndex);
+  return last && last->size() == sizeof(report)
+    && memcmp(last->data(), &report, sizeof(report)) == 0;
+}
+
+static void test_server() {
+  const auto pipeName = std::format(
+    L"\\\\.\\pipe\\favhid-test-shared-reports-{}", GetCurrentProcessId());
+  const auto name = std::format(
+    L"Local\\FAVHID-SharedReports-test-{}", GetCurrentProcessId());
+
+  Emulator emulator;
+  std::jthread emulatorThread {
+    [&](std::stop_token stop) { emulator.Serve(pipeName, stop); }};
+  std::optional<Arduino> arduino;
+  // The server thread may not have created the pipe yet
+  for (int i = 0; i < 20 && !arduino; ++i) {
+    try {
+      arduino = Arduino::OpenPath(pipeName);
+    } catch (...) {
+    }
+    if (!arduino) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+  }
+  CHECK(arduino.has_value());
+  if (!arduino) {
+    return;
+  }
+
+  const DeviceProfile profiles[3] {};
+  SharedReportServer server {
+    FAVJoyState2::Open(std::move(*arduino), profiles), name};
+  SharedReportClient client {name};
+  CHECK(client.GetDeviceCount() == 3);
+  CHECK(server.PushChanges() == 0);
+
+  // A single changed slot is sent on its own
+  client.WriteReport(MakeReport(1), 0);
+  CHECK(server.PushChanges() == 1);
+  CHECK(LastReportEquals(emulator, 0, MakeReport(1)));
+  CHECK(!emulator.GetLastReport(FIRST_AVAILABLE_REPORT_ID + 1));
+  CHECK(!emulator.GetLastReport(FIRST_AVAILABLE_REPORT_ID + 2));
+  CHECK(server.PushChanges() == 0);
+
+  // Several changed slots are sent together, along with the untouched
+  // slot between them, which has centered hats
+  client.WriteReport(MakeReport(2), 0);
+  client.WriteReport(MakeReport(3), 2);
+  CHECK(server.PushChanges() == 2);
+  CHECK(LastReportEquals(emulator, 0, MakeReport(2)));
+  CHECK(LastReportEquals(emulator, 1, FAVJoyState2Report {}));
+  CHECK(LastReportEquals(emulator, 2, MakeReport(3)));
+  const auto untouched = emulator.GetLastReport(FIRST_AVAILABLE_REPORT_ID + 1);
+  CHECK(
+    untouched
+    && static_cast<uint8_t>(untouched->at(offsetof(FAVJoyState2Report, povs)))
+      == 0xff);
+
+  // `Run()` sends changes as they're written
+  std::jthread runner {[&](std::stop_token stop) { server.Run(stop); }};
+  client.WriteReport(MakeReport(4), 1);
+  bool sent = false;
+  for (int i = 0; i < 100 && !sent; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    sent = LastReportEquals(emulator, 1, MakeReport(4));
+  }
+  CHECK(sent);
+  runner.request_stop();
+  runner.join();
+}
+
+// Clients must not trust a slot count that doesn't fit in the region
+static void test_oversized_slot_count() {
+  const auto name = std::format(
+    L"Local\\FAVHID-SharedReports-test-oversized-{}", GetCurrentProcessId());
+  winrt::handle mapping {CreateFileMappingW(
+    INVALID_HANDLE_VALUE,
+    nullptr,
+    PAGE_READWRITE,
+    0,
+    sizeof(SharedReportsHeader),
+    name.c_str())};
+  CHECK(!!mapping);
+  auto view = MapViewOfFile(mapping.get(), FILE_MAP_ALL_ACCESS, 0, 0, 0);
+  CHECK(view != nullptr);
+  if (!view) {
+    return;
+  }
+  auto header = new (view) SharedReportsHeader {
+    .version = SharedReportsHeader::CURRENT_VERSION,
+    .slotCount = 0xffff,
+  };
+  memcpy(header->magic, SharedReportsHeader::MAGIC, sizeof(header->magic));
+
+  bool threw = false;
+  try {
+    SharedReportClient client {name};
+  } catch (const std::runtime_error&) {
+    threw = true;
+  }
+  CHECK(threw);
+  UnmapViewOfFile(view);
+}
+
+int main() {
+  SharedReportSlot slot {};
+  FAVJoyState2Report report = MakeReport(1);
+  // New slots contain a default report, with centered hats
+  CHECK(slot.Read(&report) == 0);
+  CHECK(Equals(report, FAVJoyState2Report {}));
+
+  slot.Write(MakeReport(1));
+  CHECK(slot.Read(&report) == 2);
+  CHECK(Equals(report, MakeReport(1)));
+
+  // Reads racing with writes must never see a mix of two reports
+  constexpr int16_t WRITES = 20000;
+  std::jthread writer([&slot]() {
+    for (int16_t i = 2; i <= WRITES; ++i) {
+      slot.Write(MakeReport(i));
+    }
+  });
+  bool consistent = true;
+  uint32_t lastSequence = 0;
+  bool ordered = true;
+  do {
+    const auto sequence = slot.Read(&report);
+    if (!sequence) {
+      continue;
+    }
+    consistent = consistent && Equals(report, MakeReport(report.x));
+    ordered = ordered && (*sequence % 2 == 0) && *sequence >= lastSequence;
+    lastSequence = *sequence;
+  } while (report.x != WRITES);
+  writer.join();
+
+  CHECK(consistent);
+  CHECK(ordered);
+  CHECK(slot.Read(&report) == WRITES * 2);
+
+  // Simulate a writer that exited part-way through a write
+  CHECK(!slot.Reclaim(WRITES * 2 + 1, MakeReport(1)));
+  CHECK(SharedReportSlotTestHook::AbandonWrite(slot) == WRITES * 2 + 1);
+  report = {};
+  CHECK(!slot.Read(&report));
+  CHECK(Equals(report, FAVJoyState2Report {}));
+  CHECK(slot.GetSequence() == WRITES * 2 + 1);
+  CHECK(slot.Reclaim(WRITES * 2 + 1, MakeReport(1)));
+  CHECK(slot.Read(&report) == WRITES * 2 + 2);
+  CHECK(Equals(report, MakeReport(1)));
+  slot.Write(MakeReport(2));
+  CHECK(slot.Read(&report) == WRITES * 2 + 4);
+
+  test_server();
+  test_oversized_slot_count();
+
+  return gFailures ? 1 : 0;
+}
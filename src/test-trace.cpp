@@ -0,0 +1,59 @@
+// Copyright 2023 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: ISC
+
+// Tracing is optional in the library, but always available to this test
+#define FAVHID_ENABLE_TRACING 1
+#include "favhid/Trace.hpp"
+#include "test-check.hpp"
+
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+using namespace FAVHID;
+
+static size_t CountOccurrences(
+  const std::string& haystack,
+  std::string_view needle) {
+  size_t count = 0;
+  for (auto it = haystack.find(needle); it != std::string::npos;
+       it = haystack.find(needle, it + 1)) {
+    ++count;
+  }
+  return count;
+}
+
+int main() {
+  Trace::SetEnabled(true);
+  {
+    FAVHID_TRACE_SCOPE("outer");
+    FAVHID_TRACE_SCOPE("inner");
+  }
+  std::jthread([]() { FAVHID_TRACE_SCOPE("other thread"); }).join();
+  // Reuses the buffer from the previous thread
+  std::jthread([]() { FAVHID_TRACE_SCOPE("other thread"); }).join();
+
+  Trace::SetEnabled(false);
+  { FAVHID_TRACE_SCOPE("disabled"); }
+
+  std::stringstream json;
+  Trace::WriteChromeJSON(json);
+  const auto trace = json.str();
+  std::cout << trace << std::endl;
+  CHECK(trace.starts_with("{"));
+  CHECK(trace.ends_with("]}"));
+  CHECK(CountOccurrences(trace, R"("ph":"X")") == 4);
+  CHECK(CountOccurrences(trace, R"("name":"outer")") == 1);
+  CHECK(CountOccurrences(trace, R"("name":"inner")") == 1);
+  CHECK(CountOccurrences(trace, R"("name":"other thread")") == 2);
+  CHECK(CountOccurrences(trace, R"("tid":2)") == 2);
+  CHECK(CountOccurrences(trace, R"("tid":3)") == 0);
+  CHECK(CountOccurrences(trace, "disabled") == 0);
+
+  Trace::Clear();
+  json.str({});
+  Trace::WriteChromeJSON(json);
+  CHECK(CountOccurrences(json.str(), R"("ph":"X")") == 0);
+
+  return gFailures ? 1 : 0;
+}
@@ -0,0 +1,179 @@
+// Copyright 2023 Fred Emmott <fred@fredemmott.com>
+// SPDX-License-Identifier: ISC
+
+// Must be included before anything that includes Windows.h
+#include <winsock2.h>
+#include <ws2tcpip.h>
+
+#include "favhid/FAVJoyState2Report.hpp"
+#include "favhid/UDPBridge.hpp"
+#include "test-check.hpp"
+
+#include <cstring>
+#include <thread>
+
+using namespace FAVHID;
+
+// Hand-built, so that tests can control the session and sequence
+static void SendDatagram(
+  SOCKET socket,
+  uint16_t port,
+  uint32_t session,
+  uint32_t sequence,
+  uint8_t reportID,
+  int16_t x) {
+  const UDPBridgeReportHeader header {
+    .reportID = reportID,
+    .session = session,
+    .sequence = sequence,
+  };
+  FAVJoyState2Report report {};
+  report.x = x;
+  char buf[sizeof(header) + sizeof(report)];
+  memcpy(buf, &header, sizeof(header));
+  memcpy(buf + sizeof(header), &report, sizeof(report));
+
+  sockaddr_in address {};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  sendto(
+    socket,
+    buf,
+    sizeof(buf),
+    0,
+    reinterpret_cast<const sockaddr*>(&address),
+    sizeof(address));
+}
+
+static void test_sequences() {
+  using namespace std::chrono_literals;
+
+  UDPBridgeReceiver receiver {
+    0, UDPBridgeReceiver::DEFAULT_STATUS_INTERVAL, 50ms};
+  // Winsock is already initialized by the receiver
+  const auto raw = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  const auto port = receiver.GetPort();
+
+  int16_t latest[4] {};
+  const auto callback = [&](uint8_t reportID, auto data) {
+    FAVJoyState2Report report;
+    memcpy(&report, data.data(), sizeof(report));
+    latest[reportID] = report.x;
+  };
+  const auto poll = [&](uint32_t datagrams) {
+    for (int i = 0; i < 10; ++i) {
+      receiver.Poll(100ms, callback);
+      const auto& stats = receiver.GetStats();
+      if (
+        stats.receivedCount + stats.otherSessionCount + stats.duplicateCount
+        >= datagrams) {
+        break;
+      }
+    }
+  };
+
+  // 11 arrives after 12, and 13 and 14 never arrive
+  SendDatagram(raw, port, 1, 10, 1, 10);
+  SendDatagram(raw, port, 1, 12, 1, 12);
+  SendDatagram(raw, port, 1, 11, 1, 11);
+  SendDatagram(raw, port, 1, 15, 2, 15);
+  poll(4);
+  CHECK(receiver.GetStats().receivedCount == 4);
+  CHECK(receiver.GetStats().staleCount == 1);
+  CHECK(receiver.GetStats().lostCount == 2);
+  CHECK(latest[1] == 12);
+  CHECK(latest[2] == 15);
+
+  // Earlier than the first datagram, but the first for its report ID
+  SendDatagram(raw, port, 1, 9, 3, 9);
+  poll(5);
+  CHECK(receiver.GetStats().receivedCount == 5);
+  CHECK(receiver.GetStats().staleCount == 1);
+  CHECK(receiver.GetStats().lostCount == 2);
+  CHECK(latest[3] == 9);
+
+  // Duplicates aren't counted as received, so they can't hide a loss
+  SendDatagram(raw, port, 1, 15, 2, 15);
+  poll(6);
+  CHECK(receiver.GetStats().receivedCount == 5);
+  CHECK(receiver.GetStats().duplicateCount == 1);
+  CHECK(receiver.GetStats().lostCount == 2);
+  CHECK(receiver.GetStats().staleCount == 1);
+
+  // Another session is ignored while this one is active...
+  SendDatagram(raw, port, 2, 1, 1, 100);
+  SendDatagram(raw, port, 1, 16, 1, 16);
+  poll(8);
+  CHECK(receiver.GetStats().receivedCount == 6);
+  CHECK(receiver.GetStats().otherSessionCount == 1);
+  CHECK(receiver.GetStats().lostCount == 2);
+  CHECK(latest[1] == 16);
+
+  // ... but replaces it once it has been quiet for the session timeout
+  std::this_thread::sleep_for(100ms);
+  SendDatagram(raw, port, 2, 2, 1, 200);
+  poll(1);
+  CHECK(receiver.GetStats().receivedCount == 1);
+  CHECK(receiver.GetStats().staleCount == 0);
+  CHECK(receiver.GetStats().lostCount == 0);
+  CHECK(latest[1] == 200);
+
+  closesocket(raw);
+}
+
+int main() {
+  using namespace std::chrono_literals;
+
+  // Reply to every report, so the sender's stats are complete
+  UDPBridgeReceiver receiver {0, 1};
+  UDPBridgeSender sender {"127.0.0.1", receiver.GetPort()};
+
+  FAVJoyState2Report report {};
+  for (int16_t i = 1; i <= 3; ++i) {
+    report.x = i;
+    sender.WriteReport(1, &report, sizeof(report));
+  }
+  report.y = 4;
+  sender.WriteReport(2, &report, sizeof(report));
+
+  FAVJoyState2Report latest[3] {};
+  size_t callbacks = 0;
+  const auto callback = [&](uint8_t reportID, auto data) {
+    ++callbacks;
+    CHECK(data.size() == sizeof(report));
+    memcpy(&latest[reportID], data.data(), sizeof(report));
+  };
+  for (int i = 0; i < 10 && receiver.GetStats().receivedCount < 4; ++i) {
+    receiver.Poll(100ms, callback);
+  }
+  CHECK(receiver.GetStats().receivedCount == 4);
+  CHECK(receiver.GetStats().lostCount == 0);
+  CHECK(receiver.GetStats().staleCount == 0);
+  // Superseded reports may be skipped, but the latest is always delivered
+  CHECK(callbacks >= 2 && callbacks <= 4);
+  CHECK(latest[1].x == 3);
+  CHECK(latest[2].y == 4);
+  CHECK(!receiver.Poll(10ms, callback));
+
+  for (int i = 0; i < 10 && sender.GetStats().receivedCount < 4; ++i) {
+    std::this_thread::sleep_for(10ms);
+    sender.ReceiveStatus();
+  }
+  const auto& stats = sender.GetStats();
+  CHECK(stats.sentCount == 4);
+  CHECK(stats.receivedCount == 4);
+  CHECK(stats.lostCount == 0);
+  CHECK(stats.roundTrip.GetCount() == 4);
+  CHECK(stats.oneWay.GetCount() == 4);
+
+  // Now that the sender knows the clock offset, the receiver can measure
+  // one-way latency too
+  sender.WriteReport(1, &report, sizeof(report));
+  CHECK(receiver.Poll(100ms, callback));
+  CHECK(receiver.GetStats().oneWay.GetCount() == 1);
+
+  test_sequences();
+
+  return gFailures ? 1 : 0;
+}